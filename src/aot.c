@@ -0,0 +1,713 @@
+#include "aot.h"
+#include "resolver.h"
+#include "types/vector.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+
+// Function compiled to a fn_N C function, with the static prototype value_new_fun needs.
+// Methods get theirs in the methods array of their class instead
+struct AotFunction {
+  const FunctionProto* proto;
+  bool is_method;
+};
+
+// Class whose methods are the functions first_method onward
+struct AotClass {
+  Statement* stmt;
+  size_t first_method;
+};
+
+typedef struct {
+  // Function bodies and the script are buffered, they reference data emitted before them
+  FILE* code;
+  struct {
+    struct AotFunction* xs;
+    size_t count;
+    size_t capacity;
+  } functions;
+  struct {
+    struct AotClass* xs;
+    size_t count;
+    size_t capacity;
+  } classes;
+  struct {
+    Token** xs;
+    size_t count;
+    size_t capacity;
+  } tokens;
+  size_t indent;
+  size_t temps;
+  // Inline caches of the get and set expressions
+  size_t caches;
+  // Block scopes opened in the current function, popped by returns
+  size_t blocks;
+  bool in_function;
+  char token_refs[4][32];
+  size_t next_token_ref;
+} Generator;
+
+static size_t gen_expression(Generator* g, Expression* expr);
+static void gen_statement(Generator* g, Statement* stmt);
+
+static void line(Generator* g, const char* fmt, ...) {
+  fprintf(g->code, "%*s", (int)(g->indent * 2), "");
+
+  va_list args;
+  va_start(args, fmt);
+  vfprintf(g->code, fmt, args);
+  va_end(args);
+
+  fprintf(g->code, "\n");
+}
+
+static void emit_string(FILE* out, const char* str, size_t len) {
+  fprintf(out, "\"");
+  for (size_t i = 0; i < len; ++i) {
+    unsigned char c = str[i];
+    if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+    else if (c == '\n') fprintf(out, "\\n");
+    else if (c == '\t') fprintf(out, "\\t");
+    else if (c < 0x20 || c >= 0x7f) fprintf(out, "\\%03o", c);
+    else fprintf(out, "%c", c);
+  }
+  fprintf(out, "\"");
+}
+
+static void emit_sv(FILE* out, StringView sv) {
+  fprintf(out, "(StringView){");
+  emit_string(out, sv.str, sv.len);
+  fprintf(out, ", %zu}", sv.len);
+}
+
+// Expression referencing a copy of the token, tokens are only used for error reporting
+static const char* token_ref(Generator* g, Token* token) {
+  char* ref = g->token_refs[g->next_token_ref++ % 4];
+  if (token == NULL) {
+    snprintf(ref, 32, "NULL");
+    return ref;
+  }
+
+  size_t i = 0;
+  while (i < g->tokens.count && g->tokens.xs[i] != token) ++i;
+  if (i == g->tokens.count) vector_push(g->tokens, token);
+
+  snprintf(ref, 32, "&tok_%zu", i);
+  return ref;
+}
+
+static const char* var_slot(Generator* g, VarSlot var) {
+  char* ref = g->token_refs[g->next_token_ref++ % 4];
+  snprintf(ref, 32, "(VarSlot){%u, %u}", var.depth, var.slot);
+  return ref;
+}
+
+static size_t new_temp(Generator* g) {
+  return g->temps++;
+}
+
+static size_t add_function(Generator* g, const FunctionProto* proto, bool is_method) {
+  struct AotFunction fn = {proto, is_method};
+  vector_push(g->functions, fn);
+  return g->functions.count - 1;
+}
+
+static size_t gen_new_fun(Generator* g, size_t id) {
+  size_t t = new_temp(g);
+  line(g, "Value t%zu = value_new_fun(&proto_%zu, scope_capture(&proto_%zu.upvalues));", t, id, id);
+  return t;
+}
+
+static size_t gen_literal(Generator* g, Expression* expr) {
+  size_t t = new_temp(g);
+  Token* literal = &expr->literal;
+
+  switch (literal->type) {
+    case TOKEN_TYPE_STRING:
+      fprintf(g->code, "%*sValue t%zu = value_new_stringview(", (int)(g->indent * 2), "", t);
+      emit_sv(g->code, literal->content);
+      fprintf(g->code, ");\n");
+      break;
+    case TOKEN_TYPE_NUMBER:
+      line(g, "Value t%zu = value_new_double(%a);", t, value_as_double(parser_constants()[expr->constant]));
+      break;
+    case TOKEN_TYPE_IDENTIFIER:
+    case TOKEN_TYPE_KEYWORD:
+      assert((literal->type == TOKEN_TYPE_IDENTIFIER || literal->keyword == RESERVED_KEYWORD_THIS || literal->keyword == RESERVED_KEYWORD_SUPER) && "Unexpected keyword literal");
+      fprintf(g->code, "%*sValue t%zu = aot_get_var(%s, ", (int)(g->indent * 2), "", t, var_slot(g, expr->var));
+      emit_sv(g->code, literal->lexeme);
+      fprintf(g->code, ");\n");
+      break;
+    default:
+      assert(false && "Unimplemented token type literal");
+  }
+
+  return t;
+}
+
+static size_t gen_static(Generator* g, Expression* expr) {
+  size_t t = new_temp(g);
+
+  switch (value_type(expr->evaluated)) {
+    case EVAL_TYPE_DOUBLE: {
+      // Folded constants may not be finite, %a would print them as nan and inf
+      double d = value_as_double(expr->evaluated);
+      if (isnan(d)) {
+        line(g, "Value t%zu = value_new_double(NAN);", t);
+      } else if (isinf(d)) {
+        line(g, "Value t%zu = value_new_double(%sINFINITY);", t, d < 0 ? "-" : "");
+      } else {
+        line(g, "Value t%zu = value_new_double(%a);", t, d);
+      }
+    }
+      break;
+    case EVAL_TYPE_BOOL:
+      line(g, "Value t%zu = value_new_bool(%s);", t, value_as_bool(expr->evaluated) ? "true" : "false");
+      break;
+    case EVAL_TYPE_NIL:
+      line(g, "Value t%zu = value_new_nil();", t);
+      break;
+    default:
+      assert(false && "Static expressions are only numbers, booleans and nil");
+  }
+
+  return t;
+}
+
+static size_t gen_operand(Generator* g, Expression* expr, bool left, const char* expected) {
+  size_t t = gen_expression(g, expr);
+  line(g, "t%zu = aot_operand(t%zu, %s, %s, %s);", t, t, token_ref(g, find_token(expr)), left ? "true" : "false", expected);
+  return t;
+}
+
+static size_t gen_logical(Generator* g, Expression* expr) {
+  bool is_or = expr->binary.operator.keyword == RESERVED_KEYWORD_OR;
+  assert((is_or || expr->binary.operator.keyword == RESERVED_KEYWORD_AND) && "Error binary expr with unrecognized keyword type");
+
+  size_t t = new_temp(g);
+  line(g, "Value t%zu;", t);
+  line(g, "{");
+  g->indent++;
+
+  size_t left = gen_operand(g, expr->binary.left, true, "EVAL_TYPE_BOOL");
+  line(g, "if (%svalue_as_bool(t%zu)) t%zu = value_new_bool(%s);", is_or ? "" : "!", left, t, is_or ? "true" : "false");
+  line(g, "else {");
+  g->indent++;
+  size_t right = gen_operand(g, expr->binary.right, false, "EVAL_TYPE_BOOL");
+  line(g, "t%zu = value_new_bool(value_as_bool(t%zu));", t, right);
+  g->indent--;
+  line(g, "}");
+
+  g->indent--;
+  line(g, "}");
+  return t;
+}
+
+static size_t gen_binary(Generator* g, Expression* expr) {
+  if (expr->binary.operator.type == TOKEN_TYPE_KEYWORD) {
+    return gen_logical(g, expr);
+  }
+
+  const char* op = NULL;
+  const char* operator = NULL;
+  bool comparison = true;
+  switch (expr->binary.operator.type) {
+    case TOKEN_TYPE_PLUS: op = "+"; operator = "BINARY_OP_ADD"; comparison = false; break;
+    case TOKEN_TYPE_MINUS: op = "-"; operator = "BINARY_OP_SUBTRACT"; comparison = false; break;
+    case TOKEN_TYPE_STAR: op = "*"; operator = "BINARY_OP_MULTIPLY"; comparison = false; break;
+    case TOKEN_TYPE_SLASH: op = "/"; operator = "BINARY_OP_DIVIDE"; comparison = false; break;
+    case TOKEN_TYPE_LESS: op = "<"; operator = "BINARY_OP_LESS"; break;
+    case TOKEN_TYPE_LESS_EQUAL: op = "<="; operator = "BINARY_OP_LESS_EQUAL"; break;
+    case TOKEN_TYPE_GREATER: op = ">"; operator = "BINARY_OP_GREATER"; break;
+    case TOKEN_TYPE_GREATER_EQUAL: op = ">="; operator = "BINARY_OP_GREATER_EQUAL"; break;
+    case TOKEN_TYPE_EQUAL_EQUAL: op = "=="; operator = "BINARY_OP_EQUAL"; break;
+    case TOKEN_TYPE_BANG_EQUAL: op = "!="; operator = "BINARY_OP_NOT_EQUAL"; break;
+    default:
+      assert(false && "Error binary expr with unrecognized token type");
+  }
+
+  size_t left = gen_expression(g, expr->binary.left);
+  line(g, "if (!value_is_double(t%zu)) t%zu = aot_binary_left(%s, t%zu, %s);", left, left, operator, left,
+    token_ref(g, find_token(expr->binary.left)));
+  size_t right = gen_expression(g, expr->binary.right);
+  size_t t = new_temp(g);
+
+  // Doubles are computed inline, other pairs go through the dispatch table
+  line(g, "Value t%zu;", t);
+  line(g, "if (value_is_double(t%zu) && value_is_double(t%zu)) {", left, right);
+  g->indent++;
+  if (expr->binary.operator.type == TOKEN_TYPE_SLASH) {
+    line(g, "t%zu = aot_divide(value_as_double(t%zu), value_as_double(t%zu));", t, left, right);
+  } else {
+    line(g, "t%zu = value_new_%s(value_as_double(t%zu) %s value_as_double(t%zu));", t, comparison ? "bool" : "double", left, op, right);
+  }
+  g->indent--;
+  line(g, "} else {");
+  g->indent++;
+  line(g, "t%zu = aot_binary(%s, t%zu, t%zu, %s, %s);", t, operator, left, right,
+    token_ref(g, find_token(expr->binary.left)), token_ref(g, find_token(expr->binary.right)));
+  g->indent--;
+  line(g, "}");
+  return t;
+}
+
+static size_t gen_unary(Generator* g, Expression* expr) {
+  size_t child = gen_expression(g, expr->unary.child);
+  size_t t = new_temp(g);
+  const char* fn = expr->unary.operator.type == TOKEN_TYPE_MINUS ? "aot_negate" : "aot_not";
+  line(g, "Value t%zu = %s(t%zu, %s);", t, fn, child, token_ref(g, find_token(expr->unary.child)));
+  return t;
+}
+
+static size_t gen_call(Generator* g, Expression* expr) {
+  Expression* callee_expr = expr->call.callee;
+  bool identifier = callee_expr->type == EXPRESSION_LITERAL && callee_expr->literal.type == TOKEN_TYPE_IDENTIFIER;
+  bool method = callee_expr->type == EXPRESSION_GET;
+  bool super = method && expression_is_super(callee_expr->get.object);
+  size_t argc = expr->call.args.count;
+
+  size_t t = new_temp(g);
+  line(g, "Value t%zu;", t);
+  line(g, "{");
+  g->indent++;
+
+  // Identifiers are called in place, other callees are evaluated and released after the call.
+  // Methods are invoked on their receiver without being bound
+  size_t callee = 0;
+  size_t object = 0;
+  if (identifier) {
+    line(g, "Value* callee = aot_callee(%s, %s);", var_slot(g, callee_expr->var), token_ref(g, find_token(callee_expr)));
+    line(g, "if (callee == NULL) t%zu = value_new_err();", t);
+    line(g, "else {");
+  } else if (super) {
+    line(g, "struct Receiver receiver;");
+    fprintf(g->code, "%*sValue method = aot_get_super_method(%s, %s, ", (int)(g->indent * 2), "", var_slot(g, callee_expr->get.object->var), var_slot(g, callee_expr->var));
+    emit_sv(g->code, callee_expr->get.name.lexeme);
+    fprintf(g->code, ", &receiver);\n");
+    line(g, "Value* callee = &method;");
+    line(g, "{");
+  } else if (method) {
+    object = gen_expression(g, callee_expr->get.object);
+    line(g, "struct Receiver receiver;");
+    fprintf(g->code, "%*sValue method = aot_get_method(t%zu, ", (int)(g->indent * 2), "", object);
+    emit_sv(g->code, callee_expr->get.name.lexeme);
+    fprintf(g->code, ", %s, &cache_%zu, &receiver);\n", token_ref(g, find_token(callee_expr)), g->caches++);
+    line(g, "Value* callee = &method;");
+    line(g, "{");
+  } else {
+    callee = gen_expression(g, callee_expr);
+    line(g, "Value* callee = &t%zu;", callee);
+    line(g, "{");
+  }
+  g->indent++;
+
+  line(g, "struct AotCall call;");
+  line(g, "if (aot_call_begin(&call, callee, %s, %zu, %s, %s, &t%zu)) {", method ? "&receiver" : "NULL", argc, token_ref(g, &expr->call.open_paren), token_ref(g, find_token(callee_expr)), t);
+  g->indent++;
+
+  size_t args[argc > 0 ? argc : 1];
+  for (size_t i = 0; i < argc; ++i) {
+    args[i] = gen_expression(g, expr->call.args.xs[i]);
+  }
+
+  if (argc > 0) {
+    fprintf(g->code, "%*sValue args[] = {", (int)(g->indent * 2), "");
+    for (size_t i = 0; i < argc; ++i) {
+      fprintf(g->code, "%st%zu", i > 0 ? ", " : "", args[i]);
+    }
+    fprintf(g->code, "};\n");
+    line(g, "t%zu = aot_call_end(&call, args, %zu);", t, argc);
+  } else {
+    line(g, "t%zu = aot_call_end(&call, NULL, 0);", t);
+  }
+
+  g->indent--;
+  line(g, "}");
+  if (!identifier) {
+    line(g, "value_scopeexit(callee);");
+  }
+  if (method && !super) {
+    line(g, "value_scopeexit(&t%zu);", object);
+  }
+
+  g->indent--;
+  line(g, "}");
+  g->indent--;
+  line(g, "}");
+  return t;
+}
+
+static size_t gen_get(Generator* g, Expression* expr) {
+  if (expression_is_super(expr->get.object)) {
+    size_t t = new_temp(g);
+    fprintf(g->code, "%*sValue t%zu = aot_get_super(%s, %s, ", (int)(g->indent * 2), "", t, var_slot(g, expr->get.object->var), var_slot(g, expr->var));
+    emit_sv(g->code, expr->get.name.lexeme);
+    fprintf(g->code, ");\n");
+    return t;
+  }
+
+  size_t object = gen_expression(g, expr->get.object);
+  size_t t = new_temp(g);
+
+  fprintf(g->code, "%*sValue t%zu = aot_get(t%zu, ", (int)(g->indent * 2), "", t, object);
+  emit_sv(g->code, expr->get.name.lexeme);
+  fprintf(g->code, ", %s, &cache_%zu);\n", token_ref(g, find_token(expr)), g->caches++);
+  return t;
+}
+
+static size_t gen_set(Generator* g, Expression* expr) {
+  size_t object = gen_expression(g, expr->set.object);
+  size_t t = new_temp(g);
+
+  line(g, "Value t%zu;", t);
+  line(g, "if (value_type(t%zu) != EVAL_TYPE_INSTANCE) t%zu = aot_accessor_error(%s);", object, t, token_ref(g, find_token(expr)));
+  line(g, "else {");
+  g->indent++;
+
+  size_t right = gen_expression(g, expr->set.right);
+  fprintf(g->code, "%*st%zu = aot_set(t%zu, ", (int)(g->indent * 2), "", t, object);
+  emit_sv(g->code, expr->set.name.lexeme);
+  fprintf(g->code, ", t%zu, &cache_%zu);\n", right, g->caches++);
+
+  g->indent--;
+  line(g, "}");
+  return t;
+}
+
+static size_t gen_assignment(Generator* g, Expression* expr) {
+  size_t right = gen_expression(g, expr->assignment.right);
+  size_t t = new_temp(g);
+  line(g, "Value t%zu = aot_assign(%s, t%zu, %s);", t, var_slot(g, expr->var), right, token_ref(g, &expr->assignment.name));
+  return t;
+}
+
+static size_t gen_anon_fun(Generator* g, Expression* expr) {
+  struct AnonFun* fn = &expr->anon_fun;
+  size_t id = add_function(g, &fn->proto, false);
+  return gen_new_fun(g, id);
+}
+
+// Emits the statements computing the expression, returns the number of the temporary holding it
+static size_t gen_expression(Generator* g, Expression* expr) {
+  switch (expr->type) {
+    case EXPRESSION_STATIC:
+      return gen_static(g, expr);
+    case EXPRESSION_UNARY:
+      return gen_unary(g, expr);
+    case EXPRESSION_BINARY:
+      return gen_binary(g, expr);
+    case EXPRESSION_GROUP:
+      return gen_expression(g, expr->group.child);
+    case EXPRESSION_CALL:
+      return gen_call(g, expr);
+    case EXPRESSION_GET:
+      return gen_get(g, expr);
+    case EXPRESSION_SET:
+      return gen_set(g, expr);
+    case EXPRESSION_LITERAL:
+      return gen_literal(g, expr);
+    case EXPRESSION_ASSIGNMENT:
+      return gen_assignment(g, expr);
+    case EXPRESSION_ANON_FUN:
+      return gen_anon_fun(g, expr);
+  }
+
+  assert(false && "Unimplemented expression type");
+  return 0;
+}
+
+static void gen_conditional(Generator* g, Statement* stmt, size_t i) {
+  if (i == stmt->cond.count) return;
+
+  struct ConditionalBlock* b = stmt->cond.xs + i;
+  if (b->condition == NULL && i == stmt->cond.count - 1) {
+    gen_statement(g, b->branch);
+    return;
+  }
+
+  size_t c = gen_expression(g, b->condition);
+  line(g, "if (!aot_condition(&t%zu, \"If statement condition can't be evaluated as boolean\")) {}", c);
+  line(g, "else if (value_as_bool(t%zu)) {", c);
+  g->indent++;
+  gen_statement(g, b->branch);
+  line(g, "value_scopeexit(&t%zu);", c);
+  g->indent--;
+  line(g, "} else {");
+  g->indent++;
+  line(g, "value_scopeexit(&t%zu);", c);
+  gen_conditional(g, stmt, i + 1);
+  g->indent--;
+  line(g, "}");
+}
+
+static void gen_while(Generator* g, Statement* stmt) {
+  line(g, "for (;;) {");
+  g->indent++;
+
+  size_t c = gen_expression(g, stmt->while_loop.condition);
+  line(g, "if (!aot_condition(&t%zu, \"While loop condition does not evaluate to bool\")) break;", c);
+  line(g, "bool iterate = value_as_bool(t%zu);", c);
+  line(g, "value_scopeexit(&t%zu);", c);
+  line(g, "if (!iterate) break;");
+  gen_statement(g, stmt->while_loop.body);
+
+  g->indent--;
+  line(g, "}");
+}
+
+static void gen_class_decl(Generator* g, Statement* stmt) {
+  struct StatementClassDecl* decl = &stmt->class_decl;
+
+  // Methods are numbered consecutively, their bodies are generated with the other functions
+  struct AotClass class = {stmt, g->functions.count};
+  for (size_t i = 0; i < decl->methods_decl.count; ++i) {
+    StatementMethodDecl* method = decl->methods_decl.xs + i;
+    add_function(g, &method->proto, true);
+  }
+  vector_push(g->classes, class);
+  size_t id = g->classes.count - 1;
+  size_t count = decl->methods_decl.count;
+
+  fprintf(g->code, "%*saot_class_decl(%u, ", (int)(g->indent * 2), "", decl->slot);
+  emit_sv(g->code, decl->identifier);
+  if (count > 0) {
+    fprintf(g->code, ", (struct ClassMethodsDecl){%zu, %zu, methods_%zu}", count, count, id);
+  } else {
+    fprintf(g->code, ", (struct ClassMethodsDecl){0, 0, NULL}");
+  }
+
+  if (decl->super) {
+    fprintf(g->code, ", %s, %s);\n", var_slot(g, decl->super->var), token_ref(g, &decl->super->literal));
+  } else {
+    fprintf(g->code, ", (VarSlot){0, 0}, NULL);\n");
+  }
+}
+
+static void gen_return(Generator* g, Statement* stmt) {
+  if (!g->in_function) {
+    line(g, "aot_return_outside_function(%s);", token_ref(g, find_token(stmt->ret)));
+    return;
+  }
+
+  size_t t = gen_expression(g, stmt->ret);
+  line(g, "aot_end_statement();");
+  for (size_t i = 0; i < g->blocks; ++i) {
+    line(g, "scope_pop();");
+  }
+  line(g, "return t%zu;", t);
+}
+
+static void gen_statement(Generator* g, Statement* stmt) {
+  line(g, "{");
+  g->indent++;
+
+  switch (stmt->type) {
+    case STATEMENT_EXPR: {
+      size_t t = gen_expression(g, stmt->expr);
+      line(g, "value_scopeexit(&t%zu);", t);
+    }
+      break;
+    case STATEMENT_PRINT_EXPR: {
+      size_t t = gen_expression(g, stmt->expr);
+      line(g, "aot_print(t%zu);", t);
+    }
+      break;
+    case STATEMENT_VAR_DECL: {
+      size_t t = gen_expression(g, stmt->var_decl.expr);
+      fprintf(g->code, "%*sscope_define(%u, ", (int)(g->indent * 2), "", stmt->var_decl.slot);
+      emit_sv(g->code, stmt->var_decl.identifier);
+      fprintf(g->code, ", &t%zu);\n", t);
+      line(g, "value_scopeexit(&t%zu);", t);
+    }
+      break;
+    case STATEMENT_FUN_DECL: {
+      struct StatementFunDecl* decl = &stmt->fun_decl;
+      size_t id = add_function(g, &decl->proto, false);
+      size_t t = gen_new_fun(g, id);
+      fprintf(g->code, "%*sscope_define(%u, ", (int)(g->indent * 2), "", decl->slot);
+      emit_sv(g->code, decl->identifier);
+      fprintf(g->code, ", &t%zu);\n", t);
+      line(g, "value_scopeexit(&t%zu);", t);
+    }
+      break;
+    case STATEMENT_CLASS_DECL:
+      gen_class_decl(g, stmt);
+      break;
+    case STATEMENT_BLOCK:
+      line(g, "scope_enter_block((ScopeLayout){%u, %s});", stmt->scope.size, stmt->scope.captured ? "true" : "false");
+      g->blocks++;
+      for (size_t i = 0; i < stmt->block.count; ++i) {
+        gen_statement(g, stmt->block.xs + i);
+      }
+      g->blocks--;
+      line(g, "scope_pop();");
+      break;
+    case STATEMENT_CONDITIONAL:
+      gen_conditional(g, stmt, 0);
+      break;
+    case STATEMENT_WHILE:
+      gen_while(g, stmt);
+      break;
+    case STATEMENT_RETURN:
+      gen_return(g, stmt);
+      break;
+  }
+
+  line(g, "aot_end_statement();");
+  g->indent--;
+  line(g, "}");
+}
+
+static void gen_function(Generator* g, size_t id) {
+  // Copied, generating the body may add functions
+  struct AotFunction fn = g->functions.xs[id];
+
+  line(g, "static Value fn_%zu() {", id);
+  g->indent++;
+  g->in_function = true;
+  g->blocks = 0;
+
+  // The body shares the call scope
+  for (size_t i = 0; i < fn.proto->body->block.count; ++i) {
+    gen_statement(g, fn.proto->body->block.xs + i);
+  }
+  line(g, "return value_new_nil();");
+
+  g->indent--;
+  line(g, "}");
+  line(g, "");
+}
+
+// Initializer of the prototype of function id, it references the data emit_function_data writes
+static void emit_proto(FILE* out, const FunctionProto* proto, size_t id) {
+  size_t num_params = proto->params.count;
+  size_t num_upvalues = proto->upvalues.count;
+
+  fprintf(out, "{.body = &body_%zu.stmt", id);
+  if (num_params > 0) {
+    fprintf(out, ", .params = {%zu, %zu, params_%zu}", num_params, num_params, id);
+  }
+  if (num_upvalues > 0) {
+    fprintf(out, ", .upvalues = {%zu, %zu, upvalue_descs_%zu}", num_upvalues, num_upvalues, id);
+  }
+  fprintf(out, ", .scope = {%u, %s}", proto->scope.size, proto->scope.captured ? "true" : "false");
+  if (proto->pure) {
+    fprintf(out, ", .pure = true, .name = ");
+    emit_sv(out, proto->name);
+  }
+  fprintf(out, "}");
+}
+
+static void emit_function_data(FILE* out, const struct AotFunction* fn, size_t id) {
+  const FunctionProto* proto = fn->proto;
+  fprintf(out, "static Value fn_%zu();\n", id);
+  fprintf(out, "static AotBody body_%zu = {.stmt = {.type = STATEMENT_BLOCK}, .fn = fn_%zu};\n", id, id);
+
+  if (proto->params.count > 0) {
+    fprintf(out, "static StringView params_%zu[] = {", id);
+    for (size_t i = 0; i < proto->params.count; ++i) {
+      fprintf(out, "%s", i > 0 ? ", " : "");
+      emit_sv(out, proto->params.xs[i]);
+    }
+    fprintf(out, "};\n");
+  }
+
+  size_t count = proto->upvalues.count;
+  if (count > 0) {
+    fprintf(out, "static UpvalueDesc upvalue_descs_%zu[] = {", id);
+    for (size_t i = 0; i < count; ++i) {
+      const UpvalueDesc* desc = proto->upvalues.xs + i;
+      const char* kind = desc->kind == UPVALUE_LOCAL ? "UPVALUE_LOCAL" : "UPVALUE_ENCLOSING";
+      fprintf(out, "%s{%s, {%u, %u}}", i > 0 ? ", " : "", kind, desc->from.depth, desc->from.slot);
+    }
+    fprintf(out, "};\n");
+  }
+
+  if (!fn->is_method) {
+    fprintf(out, "static FunctionProto proto_%zu = ", id);
+    emit_proto(out, proto, id);
+    fprintf(out, ";\n");
+  }
+}
+
+static void emit_class_data(FILE* out, const struct AotClass* class, size_t id) {
+  const struct ClassMethodsDecl* decl = &class->stmt->class_decl.methods_decl;
+  if (decl->count == 0) return;
+
+  fprintf(out, "static StatementMethodDecl methods_%zu[] = {\n", id);
+  for (size_t i = 0; i < decl->count; ++i) {
+    fprintf(out, "  {.identifier = ");
+    emit_sv(out, decl->xs[i].identifier);
+    fprintf(out, ", .proto = ");
+    emit_proto(out, &decl->xs[i].proto, class->first_method + i);
+    fprintf(out, "},\n");
+  }
+  fprintf(out, "};\n");
+}
+
+void aot_compile(Statements stmts, FILE* out) {
+  Generator g = {0};
+  char* code;
+  size_t code_len;
+  g.code = open_memstream(&code, &code_len);
+  vector_new(g.functions, 8);
+  vector_new(g.classes, 4);
+  vector_new(g.tokens, 16);
+
+  line(&g, "static void script() {");
+  g.indent++;
+  for (size_t i = 0; i < stmts.count; ++i) {
+    gen_statement(&g, stmts.xs + i);
+  }
+  g.indent--;
+  line(&g, "}");
+  line(&g, "");
+
+  // Functions found while generating a body are appended and generated in turn
+  for (size_t i = 0; i < g.functions.count; ++i) {
+    gen_function(&g, i);
+  }
+  fclose(g.code);
+
+  fprintf(out, "// Generated by the cox 'compile' command, build with:\n");
+  fprintf(out, "// cc out.c -I<cox>/src -L<build> -lcox_runtime -lm\n\n");
+  fprintf(out, "#include <stdbool.h>\n#include <stdint.h>\n#include <stdalign.h>\n#include <stdio.h>\n#include <math.h>\n\n");
+  fprintf(out, "#include \"types/value.h\"\n#include \"interpreter/scope.h\"\n#include \"aot/runtime.h\"\n\n");
+
+  for (size_t i = 0; i < g.tokens.count; ++i) {
+    Token* token = g.tokens.xs[i];
+    fprintf(out, "static Token tok_%zu = {.type = TOKEN_TYPE_%s, .lexeme = ", i, token_type_to_string(token->type));
+    emit_sv(out, token->lexeme);
+    fprintf(out, ", .line = %zu};\n", token->line);
+  }
+  fprintf(out, "\n");
+
+  for (size_t i = 0; i < g.functions.count; ++i) {
+    emit_function_data(out, g.functions.xs + i, i);
+  }
+  fprintf(out, "\n");
+
+  for (size_t i = 0; i < g.caches; ++i) {
+    fprintf(out, "static PropertyCache cache_%zu;\n", i);
+  }
+  fprintf(out, "\n");
+
+  for (size_t i = 0; i < g.classes.count; ++i) {
+    emit_class_data(out, g.classes.xs + i, i);
+  }
+  fprintf(out, "\n");
+
+  fwrite(code, 1, code_len, out);
+
+  fprintf(out, "int main() {\n");
+  fprintf(out, "  // Disable output buffering\n");
+  fprintf(out, "  setbuf(stdout, NULL);\n  setbuf(stderr, NULL);\n\n");
+  fprintf(out, "  aot_init();\n  scope_new();\n  script();\n  scope_pop();\n  aot_free();\n  return 0;\n}\n");
+
+  free(code);
+  vector_free(g.functions);
+  vector_free(g.classes);
+  vector_free(g.tokens);
+}
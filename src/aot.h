@@ -0,0 +1,12 @@
+#ifndef _AOT_H
+#define _AOT_H
+
+#include <stdio.h>
+
+#include "parser.h"
+
+// Writes a C translation unit running the resolved statements to out.
+// It links against the cox_runtime library, see aot/runtime.h
+void aot_compile(Statements stmts, FILE* out);
+
+#endif
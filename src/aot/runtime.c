@@ -0,0 +1,272 @@
+#include "runtime.h"
+#include "../resolver.h"
+#include "../interpreter.h"
+#include "../interpreter/scope.h"
+#include "../interpreter/memo.h"
+#include "../error/runtime.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+
+static Value get_target;
+
+void aot_init() {
+  const char* this = keyword_to_string(RESERVED_KEYWORD_THIS);
+  assert(this && "Unable to get string value of RESERVED_KEYWORD_THIS");
+  const char* super = keyword_to_string(RESERVED_KEYWORD_SUPER);
+  assert(super && "Unable to get string value of RESERVED_KEYWORD_SUPER");
+
+  value_init(NUM_CLASSES, NUM_INSTANCES, sv_new(this), sv_new(super));
+  get_target = value_new_nil();
+}
+
+void aot_free() {
+  memo_free();
+  value_free();
+}
+
+void aot_end_statement() {
+  if (value_type(get_target) != EVAL_TYPE_NIL) {
+    value_scopeexit(&get_target);
+    get_target = value_new_nil();
+  }
+}
+
+bool aot_condition(Value* v, const char* msg) {
+  if (convert_to(v, EVAL_TYPE_BOOL)) return true;
+
+  runtime_error(NULL, msg);
+  value_scopeexit(v);
+  return false;
+}
+
+Value aot_operand(Value v, const Token* at, bool left, enum ValueType expected) {
+  if (convert_to(&v, expected)) return v;
+
+  runtime_error(
+    (Token*)at,
+    "Binary operation not permitted: %s operand is not convertible to %s",
+    left ? "left" : "right", eval_type_to_str(expected)
+  );
+  return value_new_zero(expected);
+}
+
+Value aot_binary_left(enum BinaryOperator op, Value left, const Token* at) {
+  if (binary_operator_takes_left(op, value_type(left))) return left;
+  return aot_operand(left, at, true, EVAL_TYPE_DOUBLE);
+}
+
+Value aot_binary(enum BinaryOperator op, Value left, Value right, const Token* left_at, const Token* right_at) {
+  BinaryOperatorFn fn = binary_operator_find(op, left, right);
+  if (fn == NULL) {
+    left = aot_operand(left, left_at, true, EVAL_TYPE_DOUBLE);
+    right = aot_operand(right, right_at, false, EVAL_TYPE_DOUBLE);
+    fn = binary_operators[op][EVAL_TYPE_DOUBLE][EVAL_TYPE_DOUBLE];
+  }
+
+  Value e = fn(left, right);
+  value_scopeexit(&left);
+  value_scopeexit(&right);
+  return e;
+}
+
+Value aot_divide(double a, double b) {
+  return value_new_double(b == 0.0 ? NAN : a / b);
+}
+
+Value aot_negate(Value v, const Token* at) {
+  if (!convert_to(&v, EVAL_TYPE_DOUBLE)) {
+    runtime_error((Token*)at, "Unary operation not permitted: operand is not a number");
+    return value_new_err();
+  }
+  return value_new_double(-value_as_double(v));
+}
+
+Value aot_not(Value v, const Token* at) {
+  if (!convert_to(&v, EVAL_TYPE_BOOL)) {
+    runtime_error((Token*)at, "Unary operation not permitted: operand is not convertible to boolean");
+    return value_new_err();
+  }
+  return value_new_bool(!value_as_bool(v));
+}
+
+Value aot_get_var(VarSlot var, StringView name) {
+  Value val = scope_get_val_copy(var);
+  if (value_type(val) == EVAL_TYPE_ERR) {
+    runtime_error(NULL, "Unresolved identifier: "SV_Fmt, SV_Fmt_arg(name));
+  }
+  return val;
+}
+
+Value aot_assign(VarSlot var, Value rhs, const Token* name) {
+  if (!scope_assign(var, &rhs)) {
+    runtime_error((Token*)name, "Assignement failed. Variable must be declared with the 'var' keyword first");
+    return value_new_err();
+  }
+  return rhs;
+}
+
+Value aot_get(Value object, StringView name, const Token* at, PropertyCache* cache) {
+  if (value_type(object) != EVAL_TYPE_INSTANCE) {
+    runtime_error((Token*)at, "Get accessor must be used on instances");
+    value_scopeexit(&object);
+    return value_new_err();
+  }
+
+  Value property = instance_find_property(&object, name, cache);
+
+  // The object is held until the end of the statement
+  aot_end_statement();
+  get_target = object;
+
+  return property;
+}
+
+Value aot_set(Value object, StringView name, Value right, PropertyCache* cache) {
+  instance_set_property(&object, name, &right, cache);
+  value_scopeexit(&right);
+  return object;
+}
+
+Value aot_accessor_error(const Token* at) {
+  runtime_error((Token*)at, "Get accessor must be used on instances");
+  return value_new_err();
+}
+
+Value aot_get_method(Value object, StringView name, const Token* at, PropertyCache* cache, struct Receiver* receiver) {
+  if (value_type(object) != EVAL_TYPE_INSTANCE) {
+    runtime_error((Token*)at, "Get accessor must be used on instances");
+    receiver->this = value_new_nil();
+    return value_new_err();
+  }
+
+  return instance_find_method(&object, name, cache, receiver);
+}
+
+Value aot_get_super(VarSlot super, VarSlot this, StringView name) {
+  return super_find_property(scope_get_val_ref(super), scope_get_val_ref(this), name);
+}
+
+Value aot_get_super_method(VarSlot super, VarSlot this, StringView name, struct Receiver* receiver) {
+  return super_find_method(scope_get_val_ref(super), scope_get_val_ref(this), name, receiver);
+}
+
+Value* aot_callee(VarSlot var, const Token* at) {
+  Value* callee = scope_get_val_ref(var);
+  if (callee == NULL) {
+    runtime_error((Token*)at, "Unresolved identifier as callable");
+  }
+  return callee;
+}
+
+static bool check_arity(const FunctionValue* fn, size_t argc, const Token* paren) {
+  size_t params_count = fn->proto->params.count;
+
+  if (argc < params_count) {
+    runtime_error_missing_args((Token*)paren, fn->proto->params.xs, argc, params_count);
+    return false;
+  } else if (argc > params_count) {
+    runtime_error((Token*)paren, "Extraneous arguments in function call");
+    return false;
+  }
+  return true;
+}
+
+bool aot_call_begin(struct AotCall* call, Value* callee, const struct Receiver* receiver, size_t argc, const Token* paren, const Token* callee_at, Value* ret) {
+  call->fn = NULL;
+  call->receiver = receiver;
+  call->instance = value_new_nil();
+  call->constructor = value_new_nil();
+
+  switch (value_type(*callee)) {
+    case EVAL_TYPE_FUN:
+      if (!check_arity(value_as_fun(*callee), argc, paren)) {
+        *ret = value_new_err();
+        return false;
+      }
+      call->fn = callee;
+      return true;
+
+    case EVAL_TYPE_CLASS:
+      call->instance = value_new_instance(callee);
+      call->constructor = instance_find_method(&call->instance, sv_new("constructor"), NULL, &call->this);
+      if (value_type(call->constructor) == EVAL_TYPE_FUN && check_arity(value_as_fun(call->constructor), argc, paren)) {
+        call->fn = &call->constructor;
+        call->receiver = &call->this;
+        return true;
+      }
+
+      value_scopeexit(&call->constructor);
+      *ret = call->instance;
+      return false;
+
+    default:
+      runtime_error((Token*)callee_at, "Cannot resolve callee as callable");
+      *ret = value_new_err();
+      return false;
+  }
+}
+
+Value aot_call_end(struct AotCall* call, Value* args, size_t argc) {
+  FunctionValue* fn = value_as_fun(*call->fn);
+
+  // Pure functions are looked up in their cache first, keys hold no references to release
+  Value cached;
+  MemoCall memo = {0};
+  if (fn->proto->pure && memo_lookup(fn, args, argc, &cached, &memo)) return cached;
+
+  // Enter the call scope and bind the callee and args
+  scope_enter_call(fn);
+  ScopeRef arg_scope = scope_ref_get_current();
+  scope_define_into(arg_scope, CALLEE_SLOT, sv_new("<callee>"), call->fn);
+  for (size_t i = 0; i < argc; ++i) {
+    scope_define_into(arg_scope, CALLEE_SLOT + 1 + i, fn->proto->params.xs[i], args + i);
+    value_scopeexit(args + i);
+  }
+  scope_define_receiver(arg_scope, fn, call->receiver);
+  scope_ref_release(&arg_scope);
+
+  Value ret = ((AotBody*)fn->proto->body)->fn();
+  scope_leave_call();
+  memo_store(&memo, &ret);
+
+  // Constructors give back the instance
+  if (value_type(call->instance) == EVAL_TYPE_INSTANCE) {
+    value_scopeexit(&ret);
+    value_scopeexit(&call->constructor);
+    return call->instance;
+  }
+
+  return ret;
+}
+
+void aot_print(Value v) {
+  value_pretty_print(&v);
+  printf("\n");
+  value_scopeexit(&v);
+}
+
+void aot_class_decl(uint16_t slot, StringView name, struct ClassMethodsDecl methods_decl, VarSlot super_var, const Token* super_at) {
+  Value* super = NULL;
+  if (super_at) {
+    super = scope_get_val_ref(super_var);
+    if (!super) {
+      runtime_error((Token*)super_at, "Can't find class \""SV_Fmt"\" to inherit from", SV_Fmt_arg(super_at->lexeme));
+      return;
+    } else if (value_type(*super) != EVAL_TYPE_CLASS) {
+      runtime_error((Token*)super_at, "\""SV_Fmt"\" is not a class !", SV_Fmt_arg(super_at->lexeme));
+      return;
+    }
+  }
+
+  ClassMethods methods = build_class_methods(methods_decl, super);
+  Value class = value_new_class(name, methods, super);
+  scope_define(slot, name, &class);
+  value_scopeexit(&class);
+  vector_free(methods);
+}
+
+void aot_return_outside_function(const Token* at) {
+  runtime_error((Token*)at, "Return statement must be used inside a function body");
+}
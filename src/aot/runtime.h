@@ -0,0 +1,69 @@
+#ifndef _AOT_RUNTIME_H
+#define _AOT_RUNTIME_H
+
+#include "../types/value.h"
+#include "../types/token.h"
+#include "../types/statements.h"
+#include "../types/string_view.h"
+
+// Support for the C programs emitted by the 'compile' command,
+// every function mirrors what the tree walker does for the same construct
+
+typedef Value (*AotFn)();
+
+// Body of a compiled function, function values only know about their body statement
+typedef struct {
+  Statement stmt;
+  AotFn fn;
+} AotBody;
+
+// Function called by a call expression, the constructor when calling a class
+struct AotCall {
+  Value* fn;
+  const struct Receiver* receiver;
+  Value instance;
+  Value constructor;
+  // Receiver of the constructor, borrows from instance
+  struct Receiver this;
+};
+
+void aot_init();
+void aot_free();
+
+// Releases the object of the last get expression, runs after every statement
+void aot_end_statement();
+// Converts a condition to bool, reports msg otherwise
+bool aot_condition(Value* v, const char* msg);
+
+Value aot_operand(Value v, const Token* at, bool left, enum ValueType expected);
+// Converts the left operand to a double when op has no entry for its type, before the right one runs
+Value aot_binary_left(enum BinaryOperator op, Value left, const Token* at);
+// Operand pairs without an entry in the dispatch table are converted to doubles
+Value aot_binary(enum BinaryOperator op, Value left, Value right, const Token* left_at, const Token* right_at);
+Value aot_divide(double a, double b);
+Value aot_negate(Value v, const Token* at);
+Value aot_not(Value v, const Token* at);
+
+Value aot_get_var(VarSlot var, StringView name);
+Value aot_assign(VarSlot var, Value rhs, const Token* name);
+Value aot_get(Value object, StringView name, const Token* at, PropertyCache* cache);
+Value aot_set(Value object, StringView name, Value right, PropertyCache* cache);
+Value aot_accessor_error(const Token* at);
+// Method looked up for a call, receiver borrows from object which must outlive the call
+Value aot_get_method(Value object, StringView name, const Token* at, PropertyCache* cache, struct Receiver* receiver);
+// Gets through 'super', the superclass' method runs on 'this'
+Value aot_get_super(VarSlot super, VarSlot this, StringView name);
+Value aot_get_super_method(VarSlot super, VarSlot this, StringView name, struct Receiver* receiver);
+
+// Callee stored in a variable, NULL when it doesn't resolve
+Value* aot_callee(VarSlot var, const Token* at);
+// Returns true when the args must be evaluated and passed to aot_call_end, ret is set otherwise
+bool aot_call_begin(struct AotCall* call, Value* callee, const struct Receiver* receiver, size_t argc, const Token* paren, const Token* callee_at, Value* ret);
+Value aot_call_end(struct AotCall* call, Value* args, size_t argc);
+
+void aot_print(Value v);
+// super_at is NULL for classes without a superclass
+void aot_class_decl(uint16_t slot, StringView name, struct ClassMethodsDecl methods, VarSlot super, const Token* super_at);
+void aot_return_outside_function(const Token* at);
+
+#endif
@@ -0,0 +1,808 @@
+#include "closure.h"
+#include "parser.h"
+#include "interpreter.h"
+#include "resolver.h"
+#include "jit.h"
+#include "interpreter/scope.h"
+#include "interpreter/memo.h"
+#include "types/value.h"
+#include "types/vector.h"
+#include "types/string_view.h"
+#include "types/token.h"
+#include "error/runtime.h"
+
+#include <assert.h>
+#include <string.h>
+#include <math.h>
+
+// Calls with at most this many arguments don't allocate to evaluate them
+#define INLINE_ARGS 8
+
+struct Linker {
+  LinkedProgram* program;
+  bool in_function;
+};
+
+static LinkedProgram linked;
+static Value return_value;
+
+static const StringView CALLEE_NAME = {"<callee>", 8};
+static const StringView CONSTRUCTOR_NAME = {"constructor", 11};
+
+static ExprNode* link_expression(struct Linker* l, Expression* expr);
+static StmtNode* link_statement(struct Linker* l, Statement* stmt);
+
+// -- Expressions --
+
+static Value eval_constant(ExprNode* n) {
+  return n->constant;
+}
+
+static Value eval_var(ExprNode* n) {
+  Value val = scope_get_val_copy(n->var);
+  if (value_type(val) == EVAL_TYPE_ERR) {
+    StringView lexeme = n->origin->literal.lexeme;
+    runtime_error(NULL, "Unresolved identifier: "SV_Fmt, SV_Fmt_arg(lexeme));
+  }
+  return val;
+}
+
+static Value eval_group(ExprNode* n) {
+  return n->unary.child->eval(n->unary.child);
+}
+
+static Value eval_negate(ExprNode* n) {
+  ExprNode* child = n->unary.child;
+  Value right = child->eval(child);
+  if (value_type(right) != EVAL_TYPE_DOUBLE && !convert_to(&right, EVAL_TYPE_DOUBLE)) {
+    runtime_error(find_token(child->origin), "Unary operation not permitted: operand is not a number");
+    value_scopeexit(&right);
+    return value_new_err();
+  }
+
+  return value_new_double(-value_as_double(right));
+}
+
+static Value eval_not(ExprNode* n) {
+  ExprNode* child = n->unary.child;
+  Value right = child->eval(child);
+  if (!convert_to(&right, EVAL_TYPE_BOOL)) {
+    runtime_error(find_token(child->origin), "Unary operation not permitted: operand is not convertible to boolean");
+    value_scopeexit(&right);
+    return value_new_err();
+  }
+
+  return value_new_bool(!value_as_bool(right));
+}
+
+static Value binary_convert_operand(ExprNode* member, Value eval, bool left, enum ValueType expected_type) {
+  if (convert_to(&eval, expected_type)) {
+    return eval;
+  }
+
+  runtime_error(
+    find_token(member->origin),
+    "Binary operation not permitted: %s operand is not convertible to %s",
+    left ? "left" : "right", eval_type_to_str(expected_type)
+  );
+
+  value_scopeexit(&eval);
+  return value_new_zero(expected_type);
+}
+
+static Value binary_operand(ExprNode* member, bool left, enum ValueType expected_type) {
+  return binary_convert_operand(member, member->eval(member), left, expected_type);
+}
+
+// Operand pairs without an entry in the dispatch table are converted to doubles
+static Value binary_apply(ExprNode* n, enum BinaryOperator op, Value l, Value r) {
+  BinaryOperatorFn fn = binary_operator_find(op, l, r);
+  if (fn == NULL) {
+    l = binary_convert_operand(n->binary.left, l, true, EVAL_TYPE_DOUBLE);
+    r = binary_convert_operand(n->binary.right, r, false, EVAL_TYPE_DOUBLE);
+    fn = binary_operators[op][EVAL_TYPE_DOUBLE][EVAL_TYPE_DOUBLE];
+  }
+
+  Value e = fn(l, r);
+  value_scopeexit(&l);
+  value_scopeexit(&r);
+  return e;
+}
+
+// Every binary operator gets a generic node and nodes specialized for
+// variable-variable and variable-constant operands. Those only take their fast path
+// when both operands are doubles and fall back to the generic node otherwise
+#define BINARY_NODES(NAME, OPERATOR, RESULT_CTOR, OPERATION) \
+static Value eval_##NAME(ExprNode* n) { \
+  Value l = n->binary.left->eval(n->binary.left); \
+  if (value_type(l) != EVAL_TYPE_DOUBLE && !binary_operator_takes_left(OPERATOR, value_type(l))) { \
+    l = binary_convert_operand(n->binary.left, l, true, EVAL_TYPE_DOUBLE); \
+  } \
+  Value r = n->binary.right->eval(n->binary.right); \
+  if (value_type(l) == EVAL_TYPE_DOUBLE && value_type(r) == EVAL_TYPE_DOUBLE) { \
+    double a = value_as_double(l); \
+    double b = value_as_double(r); \
+    return RESULT_CTOR(OPERATION); \
+  } \
+  return binary_apply(n, OPERATOR, l, r); \
+} \
+static Value eval_##NAME##_var_var(ExprNode* n) { \
+  ValueRef l = scope_get_val_ref(n->binary.left_var); \
+  ValueRef r = scope_get_val_ref(n->binary.right_var); \
+  if (!l || !r || value_type(*l) != EVAL_TYPE_DOUBLE || value_type(*r) != EVAL_TYPE_DOUBLE) { \
+    return eval_##NAME(n); \
+  } \
+  double a = value_as_double(*l); \
+  double b = value_as_double(*r); \
+  return RESULT_CTOR(OPERATION); \
+} \
+static Value eval_##NAME##_var_constant(ExprNode* n) { \
+  ValueRef l = scope_get_val_ref(n->binary.left_var); \
+  if (!l || value_type(*l) != EVAL_TYPE_DOUBLE) { \
+    return eval_##NAME(n); \
+  } \
+  double a = value_as_double(*l); \
+  double b = n->binary.right_constant; \
+  return RESULT_CTOR(OPERATION); \
+}
+
+BINARY_NODES(add, BINARY_OP_ADD, value_new_double, a + b)
+BINARY_NODES(subtract, BINARY_OP_SUBTRACT, value_new_double, a - b)
+BINARY_NODES(multiply, BINARY_OP_MULTIPLY, value_new_double, a * b)
+BINARY_NODES(divide, BINARY_OP_DIVIDE, value_new_double, (b == 0.0) ? NAN : a / b)
+BINARY_NODES(less, BINARY_OP_LESS, value_new_bool, a < b)
+BINARY_NODES(less_equal, BINARY_OP_LESS_EQUAL, value_new_bool, a <= b)
+BINARY_NODES(greater, BINARY_OP_GREATER, value_new_bool, a > b)
+BINARY_NODES(greater_equal, BINARY_OP_GREATER_EQUAL, value_new_bool, a >= b)
+BINARY_NODES(equal, BINARY_OP_EQUAL, value_new_bool, a == b)
+BINARY_NODES(not_equal, BINARY_OP_NOT_EQUAL, value_new_bool, a != b)
+
+#undef BINARY_NODES
+
+struct BinaryNodes {
+  enum TokenType operator;
+  ExprFn generic;
+  ExprFn var_var;
+  ExprFn var_constant;
+};
+
+static const struct BinaryNodes binary_nodes[] = {
+  {TOKEN_TYPE_PLUS, eval_add, eval_add_var_var, eval_add_var_constant},
+  {TOKEN_TYPE_MINUS, eval_subtract, eval_subtract_var_var, eval_subtract_var_constant},
+  {TOKEN_TYPE_STAR, eval_multiply, eval_multiply_var_var, eval_multiply_var_constant},
+  {TOKEN_TYPE_SLASH, eval_divide, eval_divide_var_var, eval_divide_var_constant},
+  {TOKEN_TYPE_LESS, eval_less, eval_less_var_var, eval_less_var_constant},
+  {TOKEN_TYPE_LESS_EQUAL, eval_less_equal, eval_less_equal_var_var, eval_less_equal_var_constant},
+  {TOKEN_TYPE_GREATER, eval_greater, eval_greater_var_var, eval_greater_var_constant},
+  {TOKEN_TYPE_GREATER_EQUAL, eval_greater_equal, eval_greater_equal_var_var, eval_greater_equal_var_constant},
+  {TOKEN_TYPE_EQUAL_EQUAL, eval_equal, eval_equal_var_var, eval_equal_var_constant},
+  {TOKEN_TYPE_BANG_EQUAL, eval_not_equal, eval_not_equal_var_var, eval_not_equal_var_constant},
+};
+
+static Value eval_or(ExprNode* n) {
+  Value left = binary_operand(n->binary.left, true, EVAL_TYPE_BOOL);
+  if (value_as_bool(left)) return value_new_bool(true);
+
+  Value right = binary_operand(n->binary.right, false, EVAL_TYPE_BOOL);
+  return value_new_bool(value_as_bool(right));
+}
+
+static Value eval_and(ExprNode* n) {
+  Value left = binary_operand(n->binary.left, true, EVAL_TYPE_BOOL);
+  if (!value_as_bool(left)) return value_new_bool(false);
+
+  Value right = binary_operand(n->binary.right, false, EVAL_TYPE_BOOL);
+  return value_new_bool(value_as_bool(right));
+}
+
+static Value call_function(Value* fnvalue, const struct Receiver* receiver, ExprNode* n) {
+  FunctionValue* fn = value_as_fun(*fnvalue);
+  size_t arg_count = n->call.args.count;
+  size_t params_count = fn->proto->params.count;
+
+  if (arg_count < params_count) {
+    runtime_error_missing_args(&n->origin->call.open_paren, fn->proto->params.xs, arg_count, params_count);
+    return value_new_err();
+  } else if (arg_count > params_count) {
+    runtime_error(&n->origin->call.open_paren, "Extraneous arguments in function call");
+    return value_new_err();
+  }
+
+  Value inline_args[INLINE_ARGS];
+  Value* args = (arg_count <= INLINE_ARGS) ? inline_args : malloc(arg_count * sizeof(Value));
+  for (size_t i = 0; i < arg_count; ++i) {
+    ExprNode* arg = n->call.args.xs[i];
+    args[i] = arg->eval(arg);
+  }
+
+  // Pure functions are looked up in their cache first
+  Value native_ret;
+  MemoCall memo = {0};
+  if (fn->proto->pure && memo_lookup(fn, args, arg_count, &native_ret, &memo)) {
+    if (args != inline_args) free(args);
+    return native_ret;
+  }
+
+  if (jit_call(fn, args, arg_count, &native_ret)) {
+    if (args != inline_args) free(args);
+    return native_ret;
+  }
+
+  StmtNode* body = linked_program_find_body(&linked, fn->proto->body);
+  assert(body && "Function body was not linked");
+
+  scope_enter_call(fn);
+  ScopeRef arg_scope = scope_ref_get_current();
+  scope_define_into(arg_scope, CALLEE_SLOT, CALLEE_NAME, fnvalue);
+  for (size_t i = 0; i < arg_count; ++i) {
+    scope_define_into(arg_scope, CALLEE_SLOT + 1 + i, fn->proto->params.xs[i], args + i);
+    value_scopeexit(args + i);
+  }
+  scope_define_receiver(arg_scope, fn, receiver);
+  scope_ref_release(&arg_scope);
+  if (args != inline_args) free(args);
+
+  // The body shares the call scope
+  Value ret = value_new_nil();
+  for (size_t i = 0; i < body->block.count; ++i) {
+    StmtNode* s = body->block.xs[i];
+    if (s->exec(s) == COMPLETION_RETURN) {
+      ret = return_value;
+      return_value = value_new_nil();
+      break;
+    }
+  }
+
+  scope_leave_call();
+  memo_store(&memo, &ret);
+  return ret;
+}
+
+static Value call_class(Value* classvalue, ExprNode* n) {
+  Value instance = value_new_instance(classvalue);
+
+  struct Receiver receiver;
+  Value constructor = instance_find_method(&instance, CONSTRUCTOR_NAME, NULL, &receiver);
+  if (value_type(constructor) == EVAL_TYPE_FUN) {
+    Value ret = call_function(&constructor, &receiver, n);
+    value_scopeexit(&ret);
+  }
+  value_scopeexit(&constructor);
+
+  return instance;
+}
+
+static Value call_value(Value* callee, const struct Receiver* receiver, ExprNode* n) {
+  switch (value_type(*callee)) {
+    case EVAL_TYPE_FUN:
+      return call_function(callee, receiver, n);
+    case EVAL_TYPE_CLASS:
+      return call_class(callee, n);
+    default:
+      runtime_error(find_token(n->call.callee->origin), "Cannot resolve callee as callable");
+      return value_new_err();
+  }
+}
+
+static Value eval_call(ExprNode* n) {
+  Value callee = n->call.callee->eval(n->call.callee);
+  Value ret = call_value(&callee, NULL, n);
+  value_scopeexit(&callee);
+  return ret;
+}
+
+// Callee stored in a variable, unresolved callees get their own error
+static Value eval_call_var(ExprNode* n) {
+  ValueRef callee = scope_get_val_ref(n->call.callee->var);
+  if (callee == NULL) {
+    runtime_error(find_token(n->call.callee->origin), "Unresolved identifier as callable");
+    return value_new_err();
+  }
+
+  // The call may reassign the variable holding the callee
+  Value held = value_copy(callee);
+  Value ret = call_value(&held, NULL, n);
+  value_scopeexit(&held);
+  return ret;
+}
+
+// Method call on an instance, the method runs on it without being bound
+static Value eval_invoke(ExprNode* n) {
+  ExprNode* get = n->call.callee;
+  ExprNode* object_node = get->property.object;
+  Value object = object_node->eval(object_node);
+  if (value_type(object) != EVAL_TYPE_INSTANCE) {
+    runtime_error(find_token(get->origin), "Get accessor must be used on instances");
+    value_scopeexit(&object);
+    runtime_error(find_token(get->origin), "Cannot resolve callee as callable");
+    return value_new_err();
+  }
+
+  struct Receiver receiver;
+  Value callee = instance_find_method(&object, get->property.name, get->property.cache, &receiver);
+  Value ret = call_value(&callee, &receiver, n);
+
+  value_scopeexit(&callee);
+  value_scopeexit(&object);
+  return ret;
+}
+
+// Method of the superclass called on 'this'
+static Value eval_invoke_super(ExprNode* n) {
+  ExprNode* get = n->call.callee;
+  const Value* super = scope_get_val_ref(get->property.object->var);
+  const Value* this = scope_get_val_ref(get->property.this_var);
+
+  struct Receiver receiver;
+  Value callee = super_find_method(super, this, get->property.name, &receiver);
+  Value ret = call_value(&callee, &receiver, n);
+
+  value_scopeexit(&callee);
+  return ret;
+}
+
+static Value eval_get_super(ExprNode* n) {
+  const Value* super = scope_get_val_ref(n->property.object->var);
+  const Value* this = scope_get_val_ref(n->property.this_var);
+  return super_find_property(super, this, n->property.name);
+}
+
+static Value eval_get(ExprNode* n) {
+  ExprNode* object_node = n->property.object;
+  Value object = object_node->eval(object_node);
+  if (value_type(object) != EVAL_TYPE_INSTANCE) {
+    runtime_error(find_token(n->origin), "Get accessor must be used on instances");
+    value_scopeexit(&object);
+    return value_new_err();
+  }
+
+  Value property = instance_find_property(&object, n->property.name, n->property.cache);
+  value_scopeexit(&object);
+  return property;
+}
+
+static Value eval_set(ExprNode* n) {
+  ExprNode* object_node = n->property.object;
+  Value object = object_node->eval(object_node);
+  if (value_type(object) != EVAL_TYPE_INSTANCE) {
+    runtime_error(find_token(n->origin), "Get accessor must be used on instances");
+    value_scopeexit(&object);
+    return value_new_err();
+  }
+
+  ExprNode* right_node = n->property.right;
+  Value right = right_node->eval(right_node);
+  instance_set_property(&object, n->property.name, &right, n->property.cache);
+  value_scopeexit(&right);
+
+  return object;
+}
+
+static Value eval_assign(ExprNode* n) {
+  Value rhs = n->assign.right->eval(n->assign.right);
+
+  if (!scope_assign(n->assign.var, &rhs)) {
+    runtime_error(&n->origin->assignment.name, "Assignement failed. Variable must be declared with the 'var' keyword first");
+    value_scopeexit(&rhs);
+    return value_new_err();
+  }
+
+  return rhs;
+}
+
+static Value eval_fun(ExprNode* n) {
+  return value_new_fun(n->fun, scope_capture(&n->fun->upvalues));
+}
+
+// -- Statements --
+
+static enum Completion exec_expr(StmtNode* n) {
+  Value v = n->expr->eval(n->expr);
+  value_scopeexit(&v);
+  return COMPLETION_NORMAL;
+}
+
+static enum Completion exec_print(StmtNode* n) {
+  Value e = n->expr->eval(n->expr);
+  value_pretty_print(&e);
+  printf("\n");
+  value_scopeexit(&e);
+  return COMPLETION_NORMAL;
+}
+
+static enum Completion exec_var_decl(StmtNode* n) {
+  Value e = n->decl.expr->eval(n->decl.expr);
+  scope_define(n->decl.slot, n->decl.identifier, &e);
+  value_scopeexit(&e);
+  return COMPLETION_NORMAL;
+}
+
+static enum Completion exec_fun_decl(StmtNode* n) {
+  struct StatementFunDecl* decl = &n->origin->fun_decl;
+  Value fn = value_new_fun(&decl->proto, scope_capture(&decl->proto.upvalues));
+  scope_define(decl->slot, decl->identifier, &fn);
+  value_scopeexit(&fn);
+  return COMPLETION_NORMAL;
+}
+
+static enum Completion exec_class_decl(StmtNode* n) {
+  struct StatementClassDecl* decl = &n->origin->class_decl;
+
+  Value* super = NULL;
+  if (decl->super) {
+    Token* super_token = &decl->super->literal;
+    super = scope_get_val_ref(decl->super->var);
+    if (!super) {
+      runtime_error(super_token, "Can't find class \""SV_Fmt"\" to inherit from", SV_Fmt_arg(super_token->lexeme));
+      return COMPLETION_NORMAL;
+    } else if (value_type(*super) != EVAL_TYPE_CLASS) {
+      runtime_error(super_token, "\""SV_Fmt"\" is not a class !", SV_Fmt_arg(super_token->lexeme));
+      return COMPLETION_NORMAL;
+    }
+  }
+
+  ClassMethods methods = build_class_methods(decl->methods_decl, super);
+  Value class = value_new_class(decl->identifier, methods, super);
+  scope_define(decl->slot, decl->identifier, &class);
+  value_scopeexit(&class);
+  vector_free(methods);
+  return COMPLETION_NORMAL;
+}
+
+static enum Completion exec_statements(struct StmtNodes* stmts) {
+  for (size_t i = 0; i < stmts->count; ++i) {
+    StmtNode* s = stmts->xs[i];
+    if (s->exec(s) == COMPLETION_RETURN) return COMPLETION_RETURN;
+  }
+
+  return COMPLETION_NORMAL;
+}
+
+static enum Completion exec_block(StmtNode* n) {
+  scope_enter_block(n->origin->scope);
+  enum Completion completion = exec_statements(&n->block);
+  scope_pop();
+  return completion;
+}
+
+static enum Completion exec_conditional(StmtNode* n) {
+  for (size_t i = 0; i < n->cond.branches.count; ++i) {
+    ExprNode* condition = n->cond.conditions.xs[i];
+    StmtNode* branch = n->cond.branches.xs[i];
+
+    // else branch
+    if (condition == NULL) {
+      return branch->exec(branch);
+    }
+
+    Value e = condition->eval(condition);
+    if (!convert_to(&e, EVAL_TYPE_BOOL)) {
+      runtime_error(NULL, "If statement condition can't be evaluated as boolean");
+      value_scopeexit(&e);
+      return COMPLETION_NORMAL;
+    }
+
+    if (value_as_bool(e)) {
+      return branch->exec(branch);
+    }
+  }
+
+  return COMPLETION_NORMAL;
+}
+
+static enum Completion exec_while(StmtNode* n) {
+  ExprNode* condition = n->while_loop.condition;
+  StmtNode* body = n->while_loop.body;
+
+  for (;;) {
+    Value e = condition->eval(condition);
+    if (!convert_to(&e, EVAL_TYPE_BOOL)) {
+      runtime_error(NULL, "While loop condition does not evaluate to bool");
+      value_scopeexit(&e);
+      return COMPLETION_NORMAL;
+    }
+
+    if (!value_as_bool(e)) return COMPLETION_NORMAL;
+    if (body->exec(body) == COMPLETION_RETURN) return COMPLETION_RETURN;
+  }
+}
+
+static enum Completion exec_return(StmtNode* n) {
+  return_value = n->expr->eval(n->expr);
+  return COMPLETION_RETURN;
+}
+
+static enum Completion exec_return_outside_function(StmtNode* n) {
+  runtime_error(find_token(n->origin->ret), "Return statement must be used inside a function body");
+  return COMPLETION_NORMAL;
+}
+
+// -- Linker --
+
+static bool is_variable(const Expression* expr) {
+  return expr->type == EXPRESSION_LITERAL && expr->literal.type == TOKEN_TYPE_IDENTIFIER;
+}
+
+// Number literals and constants folded by the optimizer
+static bool is_number(const Expression* expr) {
+  return (expr->type == EXPRESSION_LITERAL && expr->literal.type == TOKEN_TYPE_NUMBER) ||
+    (expr->type == EXPRESSION_STATIC && value_is_double(expr->evaluated));
+}
+
+static void link_function_body(struct Linker* l, Statement* body) {
+  assert(body->type == STATEMENT_BLOCK && "Function body must be a block");
+
+  struct Linker fl = {
+    .program = l->program,
+    .in_function = true,
+  };
+
+  StmtNode* node = stmt_node_new(l->program, exec_block, body);
+  vector_new(node->block, body->block.count);
+  for (size_t i = 0; i < body->block.count; ++i) {
+    vector_push(node->block, link_statement(&fl, body->block.xs + i));
+  }
+  linked_program_own(l->program, node->block.xs);
+
+  linked_program_add_body(l->program, body, node);
+}
+
+static ExprNode* link_literal(struct Linker* l, Expression* expr) {
+  Token* literal = &expr->literal;
+
+  switch (literal->type) {
+    case TOKEN_TYPE_STRING:
+    case TOKEN_TYPE_NUMBER: {
+      ExprNode* n = expr_node_new(l->program, eval_constant, expr);
+      n->constant = parser_constants()[expr->constant];
+      return n;
+    }
+    case TOKEN_TYPE_IDENTIFIER: {
+      ExprNode* n = expr_node_new(l->program, eval_var, expr);
+      n->var = expr->var;
+      return n;
+    }
+    case TOKEN_TYPE_KEYWORD:
+      switch (literal->keyword) {
+        case RESERVED_KEYWORD_THIS:
+        case RESERVED_KEYWORD_SUPER: {
+          ExprNode* n = expr_node_new(l->program, eval_var, expr);
+          n->var = expr->var;
+          return n;
+        }
+        case RESERVED_KEYWORD_TRUE:
+        case RESERVED_KEYWORD_FALSE: {
+          ExprNode* n = expr_node_new(l->program, eval_constant, expr);
+          n->constant = value_new_bool(literal->keyword == RESERVED_KEYWORD_TRUE);
+          return n;
+        }
+        case RESERVED_KEYWORD_NIL: {
+          ExprNode* n = expr_node_new(l->program, eval_constant, expr);
+          n->constant = value_new_nil();
+          return n;
+        }
+        default:
+          internal_logic_error(literal, "Keyword cannot be linked");
+          exit(1);
+      }
+    default:
+      internal_logic_error(literal, "Unimplemented token type literal");
+      exit(1);
+  }
+}
+
+static ExprNode* link_binary(struct Linker* l, Expression* expr) {
+  Token* op = &expr->binary.operator;
+  ExprNode* left = link_expression(l, expr->binary.left);
+  ExprNode* right = link_expression(l, expr->binary.right);
+
+  ExprFn eval = NULL;
+  if (op->type == TOKEN_TYPE_KEYWORD) {
+    bool is_or = op->keyword == RESERVED_KEYWORD_OR;
+    assert((is_or || op->keyword == RESERVED_KEYWORD_AND) && "Unrecognized logical operator");
+    eval = is_or ? eval_or : eval_and;
+  } else {
+    const struct BinaryNodes* nodes = NULL;
+    for (size_t i = 0; i < sizeof(binary_nodes) / sizeof(*binary_nodes); ++i) {
+      if (binary_nodes[i].operator == op->type) nodes = binary_nodes + i;
+    }
+
+    if (!nodes) {
+      internal_logic_error(op, "Binary expression with unrecognized operator");
+      exit(1);
+    }
+
+    if (is_variable(expr->binary.left) && is_variable(expr->binary.right)) eval = nodes->var_var;
+    else if (is_variable(expr->binary.left) && is_number(expr->binary.right)) eval = nodes->var_constant;
+    else eval = nodes->generic;
+  }
+
+  ExprNode* n = expr_node_new(l->program, eval, expr);
+  n->binary.left = left;
+  n->binary.right = right;
+  n->binary.left_var = expr->binary.left->var;
+  n->binary.right_var = expr->binary.right->var;
+  if (is_number(expr->binary.right)) {
+    n->binary.right_constant = value_as_double(right->constant);
+  }
+  return n;
+}
+
+static ExprNode* link_expression(struct Linker* l, Expression* expr) {
+  switch (expr->type) {
+    case EXPRESSION_STATIC: {
+      ExprNode* n = expr_node_new(l->program, eval_constant, expr);
+      n->constant = expr->evaluated;
+      return n;
+    }
+    case EXPRESSION_LITERAL:
+      return link_literal(l, expr);
+    case EXPRESSION_GROUP: {
+      ExprNode* n = expr_node_new(l->program, eval_group, expr);
+      n->unary.child = link_expression(l, expr->group.child);
+      return n;
+    }
+    case EXPRESSION_UNARY: {
+      ExprFn eval = NULL;
+      switch (expr->unary.operator.type) {
+        case TOKEN_TYPE_MINUS: eval = eval_negate; break;
+        case TOKEN_TYPE_BANG: eval = eval_not; break;
+        default:
+          internal_logic_error(&expr->unary.operator, "Unary expression with unrecognized operator");
+          exit(1);
+      }
+
+      ExprNode* n = expr_node_new(l->program, eval, expr);
+      n->unary.child = link_expression(l, expr->unary.child);
+      return n;
+    }
+    case EXPRESSION_BINARY:
+      return link_binary(l, expr);
+    case EXPRESSION_CALL: {
+      ExprFn eval = eval_call;
+      if (is_variable(expr->call.callee)) eval = eval_call_var;
+      else if (expr->call.callee->type == EXPRESSION_GET) {
+        eval = expression_is_super(expr->call.callee->get.object) ? eval_invoke_super : eval_invoke;
+      }
+
+      ExprNode* n = expr_node_new(l->program, eval, expr);
+      n->call.callee = link_expression(l, expr->call.callee);
+      vector_new(n->call.args, expr->call.args.count);
+      for (size_t i = 0; i < expr->call.args.count; ++i) {
+        vector_push(n->call.args, link_expression(l, expr->call.args.xs[i]));
+      }
+      linked_program_own(l->program, n->call.args.xs);
+      return n;
+    }
+    case EXPRESSION_GET: {
+      bool super = expression_is_super(expr->get.object);
+      ExprNode* n = expr_node_new(l->program, super ? eval_get_super : eval_get, expr);
+      n->property.this_var = expr->var;
+      n->property.object = link_expression(l, expr->get.object);
+      n->property.name = expr->get.name.lexeme;
+      n->property.cache = &expr->get.cache;
+      return n;
+    }
+    case EXPRESSION_SET: {
+      ExprNode* n = expr_node_new(l->program, eval_set, expr);
+      n->property.object = link_expression(l, expr->set.object);
+      n->property.name = expr->set.name.lexeme;
+      n->property.cache = &expr->set.cache;
+      n->property.right = link_expression(l, expr->set.right);
+      return n;
+    }
+    case EXPRESSION_ASSIGNMENT: {
+      ExprNode* n = expr_node_new(l->program, eval_assign, expr);
+      n->assign.var = expr->var;
+      n->assign.right = link_expression(l, expr->assignment.right);
+      return n;
+    }
+    case EXPRESSION_ANON_FUN: {
+      link_function_body(l, expr->anon_fun.proto.body);
+
+      ExprNode* n = expr_node_new(l->program, eval_fun, expr);
+      n->fun = &expr->anon_fun.proto;
+      return n;
+    }
+  }
+
+  assert(false && "Unimplemented expression type");
+  return NULL;
+}
+
+static StmtNode* link_statement(struct Linker* l, Statement* stmt) {
+  switch (stmt->type) {
+    case STATEMENT_EXPR: {
+      StmtNode* n = stmt_node_new(l->program, exec_expr, stmt);
+      n->expr = link_expression(l, stmt->expr);
+      return n;
+    }
+    case STATEMENT_PRINT_EXPR: {
+      StmtNode* n = stmt_node_new(l->program, exec_print, stmt);
+      n->expr = link_expression(l, stmt->expr);
+      return n;
+    }
+    case STATEMENT_VAR_DECL: {
+      StmtNode* n = stmt_node_new(l->program, exec_var_decl, stmt);
+      n->decl.expr = link_expression(l, stmt->var_decl.expr);
+      n->decl.identifier = stmt->var_decl.identifier;
+      n->decl.slot = stmt->var_decl.slot;
+      return n;
+    }
+    case STATEMENT_FUN_DECL:
+      link_function_body(l, stmt->fun_decl.proto.body);
+      return stmt_node_new(l->program, exec_fun_decl, stmt);
+    case STATEMENT_CLASS_DECL:
+      for (size_t i = 0; i < stmt->class_decl.methods_decl.count; ++i) {
+        link_function_body(l, stmt->class_decl.methods_decl.xs[i].proto.body);
+      }
+      return stmt_node_new(l->program, exec_class_decl, stmt);
+    case STATEMENT_BLOCK: {
+      StmtNode* n = stmt_node_new(l->program, exec_block, stmt);
+      vector_new(n->block, stmt->block.count);
+      for (size_t i = 0; i < stmt->block.count; ++i) {
+        vector_push(n->block, link_statement(l, stmt->block.xs + i));
+      }
+      linked_program_own(l->program, n->block.xs);
+      return n;
+    }
+    case STATEMENT_CONDITIONAL: {
+      StmtNode* n = stmt_node_new(l->program, exec_conditional, stmt);
+      vector_new(n->cond.conditions, stmt->cond.count);
+      vector_new(n->cond.branches, stmt->cond.count);
+      for (size_t i = 0; i < stmt->cond.count; ++i) {
+        struct ConditionalBlock* b = stmt->cond.xs + i;
+        vector_push(n->cond.conditions, b->condition ? link_expression(l, b->condition) : NULL);
+        vector_push(n->cond.branches, link_statement(l, b->branch));
+      }
+      linked_program_own(l->program, n->cond.conditions.xs);
+      linked_program_own(l->program, n->cond.branches.xs);
+      return n;
+    }
+    case STATEMENT_WHILE: {
+      StmtNode* n = stmt_node_new(l->program, exec_while, stmt);
+      n->while_loop.condition = link_expression(l, stmt->while_loop.condition);
+      n->while_loop.body = link_statement(l, stmt->while_loop.body);
+      return n;
+    }
+    case STATEMENT_RETURN: {
+      if (!l->in_function) {
+        return stmt_node_new(l->program, exec_return_outside_function, stmt);
+      }
+
+      StmtNode* n = stmt_node_new(l->program, exec_return, stmt);
+      n->expr = link_expression(l, stmt->ret);
+      return n;
+    }
+  }
+
+  assert(false && "Unimplemented statement type");
+  return NULL;
+}
+
+void closure_run(Statements stmts) {
+  const char* this = keyword_to_string(RESERVED_KEYWORD_THIS);
+  assert(this && "Unable to get string value of RESERVED_KEYWORD_THIS");
+  const char* super = keyword_to_string(RESERVED_KEYWORD_SUPER);
+  assert(super && "Unable to get string value of RESERVED_KEYWORD_SUPER");
+
+  value_init(NUM_CLASSES, NUM_INSTANCES, sv_new(this), sv_new(super));
+  return_value = value_new_nil();
+
+  linked_program_new(&linked);
+  struct Linker l = {
+    .program = &linked,
+    .in_function = false,
+  };
+  for (size_t i = 0; i < stmts.count; ++i) {
+    vector_push(linked.script, link_statement(&l, stmts.xs + i));
+  }
+
+  scope_new();
+  exec_statements(&linked.script);
+  scope_pop();
+
+  value_free();
+  jit_free();
+  linked_program_free(&linked);
+}
@@ -0,0 +1,10 @@
+#ifndef _CLOSURE_H
+#define _CLOSURE_H
+
+#include "parser.h"
+#include "closure/node.h"
+
+// Links the statements into a tree of nodes holding the function evaluating them, then runs it
+void closure_run(Statements stmts);
+
+#endif
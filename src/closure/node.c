@@ -0,0 +1,100 @@
+#include "node.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "../types/vector.h"
+
+void linked_program_new(LinkedProgram* program) {
+  vector_new(program->script, 16);
+  vector_new(program->allocations, 64);
+  program->bodies.count = 0;
+  program->bodies.capacity = 16;
+  program->bodies.keys = calloc(program->bodies.capacity, sizeof(Statement*));
+  program->bodies.values = calloc(program->bodies.capacity, sizeof(StmtNode*));
+}
+
+void linked_program_free(LinkedProgram* program) {
+  for (size_t i = 0; i < program->allocations.count; ++i) {
+    free(program->allocations.xs[i]);
+  }
+  vector_free(program->allocations);
+  vector_free(program->script);
+  free(program->bodies.keys);
+  free(program->bodies.values);
+}
+
+void linked_program_own(LinkedProgram* program, void* allocation) {
+  vector_push(program->allocations, allocation);
+}
+
+static void* node_alloc(LinkedProgram* program, size_t sz) {
+  void* node = calloc(1, sz);
+  linked_program_own(program, node);
+  return node;
+}
+
+ExprNode* expr_node_new(LinkedProgram* program, ExprFn eval, Expression* origin) {
+  ExprNode* node = node_alloc(program, sizeof(ExprNode));
+  node->eval = eval;
+  node->origin = origin;
+  return node;
+}
+
+StmtNode* stmt_node_new(LinkedProgram* program, StmtFn exec, Statement* origin) {
+  StmtNode* node = node_alloc(program, sizeof(StmtNode));
+  node->exec = exec;
+  node->origin = origin;
+  return node;
+}
+
+static size_t body_table_hash(const Statement* body, size_t capacity) {
+  uintptr_t h = (uintptr_t)body;
+  h ^= h >> 17;
+  h *= 0x9E3779B97F4A7C15ull;
+  return (size_t)(h >> 7) & (capacity - 1);
+}
+
+static void body_table_insert(struct BodyTable* table, Statement* body, StmtNode* linked) {
+  size_t idx = body_table_hash(body, table->capacity);
+  while (table->keys[idx]) idx = (idx + 1) & (table->capacity - 1);
+  table->keys[idx] = body;
+  table->values[idx] = linked;
+  table->count += 1;
+}
+
+void linked_program_add_body(LinkedProgram* program, Statement* body, StmtNode* linked) {
+  struct BodyTable* table = &program->bodies;
+
+  // Keep the table at most half full
+  if ((table->count + 1) * 2 > table->capacity) {
+    struct BodyTable grown = {
+      .count = 0,
+      .capacity = table->capacity * 2,
+    };
+    grown.keys = calloc(grown.capacity, sizeof(Statement*));
+    grown.values = calloc(grown.capacity, sizeof(StmtNode*));
+
+    for (size_t i = 0; i < table->capacity; ++i) {
+      if (table->keys[i]) body_table_insert(&grown, table->keys[i], table->values[i]);
+    }
+
+    free(table->keys);
+    free(table->values);
+    *table = grown;
+  }
+
+  body_table_insert(table, body, linked);
+}
+
+StmtNode* linked_program_find_body(const LinkedProgram* program, const Statement* body) {
+  const struct BodyTable* table = &program->bodies;
+  size_t idx = body_table_hash(body, table->capacity);
+
+  while (table->keys[idx]) {
+    if (table->keys[idx] == body) return table->values[idx];
+    idx = (idx + 1) & (table->capacity - 1);
+  }
+
+  return NULL;
+}
@@ -0,0 +1,125 @@
+#ifndef _CLOSURE_NODE_H
+#define _CLOSURE_NODE_H
+
+#include <stdint.h>
+
+#include "../types/value.h"
+#include "../types/statements.h"
+#include "../types/expressions.h"
+
+typedef struct ExprNode ExprNode;
+typedef struct StmtNode StmtNode;
+
+// Whether a statement completed normally or hit a return
+enum Completion {
+  COMPLETION_NORMAL,
+  COMPLETION_RETURN,
+};
+
+typedef Value (*ExprFn)(ExprNode* node);
+typedef enum Completion (*StmtFn)(StmtNode* node);
+
+struct ExprNodes {
+  ExprNode** xs;
+  size_t count;
+  size_t capacity;
+};
+
+struct StmtNodes {
+  StmtNode** xs;
+  size_t count;
+  size_t capacity;
+};
+
+// An expression pre-linked to the function evaluating it.
+// Specialized nodes keep their generic children to fall back on when their fast path doesn't apply
+struct ExprNode {
+  ExprFn eval;
+  // Source expression, only used to report errors
+  Expression* origin;
+  union {
+    Value constant;
+    VarSlot var;
+    struct {
+      ExprNode* left;
+      ExprNode* right;
+      VarSlot left_var;
+      VarSlot right_var;
+      double right_constant;
+    } binary;
+    struct {
+      ExprNode* child;
+    } unary;
+    struct {
+      ExprNode* callee;
+      struct ExprNodes args;
+    } call;
+    struct {
+      ExprNode* object;
+      StringView name;
+      PropertyCache* cache;
+      ExprNode* right;
+      // 'this' for gets through 'super'
+      VarSlot this_var;
+    } property;
+    struct {
+      VarSlot var;
+      ExprNode* right;
+    } assign;
+    const FunctionProto* fun;
+  };
+};
+
+struct StmtNode {
+  StmtFn exec;
+  Statement* origin;
+  union {
+    ExprNode* expr;
+    struct {
+      ExprNode* expr;
+      StringView identifier;
+      uint16_t slot;
+    } decl;
+    struct StmtNodes block;
+    struct {
+      // NULL condition for the else branch
+      struct ExprNodes conditions;
+      struct StmtNodes branches;
+    } cond;
+    struct {
+      ExprNode* condition;
+      StmtNode* body;
+    } while_loop;
+  };
+};
+
+// Maps a function body to its linked statements, function values only know about their body
+struct BodyTable {
+  Statement** keys;
+  StmtNode** values;
+  size_t count;
+  size_t capacity;
+};
+
+struct NodeAllocations {
+  void** xs;
+  size_t count;
+  size_t capacity;
+};
+
+typedef struct {
+  struct StmtNodes script;
+  struct BodyTable bodies;
+  struct NodeAllocations allocations;
+} LinkedProgram;
+
+void linked_program_new(LinkedProgram* program);
+void linked_program_free(LinkedProgram* program);
+// Freed along with the program, vectors must not grow once they are owned
+void linked_program_own(LinkedProgram* program, void* allocation);
+ExprNode* expr_node_new(LinkedProgram* program, ExprFn eval, Expression* origin);
+StmtNode* stmt_node_new(LinkedProgram* program, StmtFn exec, Statement* origin);
+void linked_program_add_body(LinkedProgram* program, Statement* body, StmtNode* linked);
+StmtNode* linked_program_find_body(const LinkedProgram* program, const Statement* body);
+
+#endif
@@ -0,0 +1,19 @@
+#include "runtime.h"
+
+size_t runtime_error_count = 0;
+
+void runtime_error_missing_args(Token* token, const StringView* params, size_t arg_count, size_t params_count) {
+  char errmsg[1024] = "Missing arguments: ";
+  size_t cursor = strlen(errmsg);
+  for (size_t i = arg_count; i < params_count; ++i) {
+    StringView param_name = params[i];
+    snprintf(errmsg + cursor, param_name.len + 3, "\""SV_Fmt"\"", SV_Fmt_arg(param_name));
+    cursor += param_name.len + 2;
+    if (i < params_count - 1) {
+      snprintf(errmsg + cursor, 3, ", ");
+      cursor += 2;
+    }
+  }
+  snprintf(errmsg + cursor, strlen(" in function call") + 1, " in function call");
+  runtime_error(token, errmsg);
+}
@@ -3,10 +3,16 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 
 #include "../types/token.h"
+#include "../types/string_view.h"
+
+// Runtime errors reported so far, pure function calls that reported one aren't memoized
+extern size_t runtime_error_count;
 
 static void runtime_error(Token* token, const char* msg, ...) {
+  runtime_error_count += 1;
   fprintf(stderr, "[Runtime Error] ");
 
   va_list args;
@@ -34,4 +40,7 @@ static void runtime_error(Token* token, const char* msg, ...) {
   va_end(args);
 }
 
+// Reports the parameters left without argument in a function call
+void runtime_error_missing_args(Token* token, const StringView* params, size_t arg_count, size_t params_count);
+
 #endif
@@ -1,7 +1,11 @@
 #include "interpreter.h"
 #include "parser.h"
+#include "resolver.h"
+#include "jit.h"
+#include "jit/trace.h"
 #include "lexer.h"
 #include "interpreter/scope.h"
+#include "interpreter/memo.h"
 #include "types/value.h"
 #include "types/string_view.h"
 #include "types/token.h"
@@ -13,23 +17,9 @@
 #include <math.h>
 
 static Interpreter interpreter;
-static Value take_return() {
-  interpreter.pending_return.await_return = false;
-  interpreter.pending_return.should_return = false;
-  Value ret = interpreter.pending_return.value;
-  interpreter.pending_return.value = value_new_nil();
-  return ret;
-}
-static void set_return(Value v) {
-  interpreter.pending_return.should_return = true;
-  interpreter.pending_return.value = v;
-}
-static bool should_return() {
-  return interpreter.pending_return.should_return && interpreter.pending_return.await_return;
-}
 
 bool has_get_target() {
-  return interpreter.get_target.type != EVAL_TYPE_NIL;
+  return value_type(interpreter.get_target) != EVAL_TYPE_NIL;
 }
 
 void discard_get_target() {
@@ -45,118 +35,193 @@ void set_get_target(Value* v) {
 }
 
 static Value evaluate_expression(Expression* expr);
-static Value evaluate_expression_call(Expression* expr);
-static void evaluate_statement(Statement* stmt);
-static void evaluate_statement_block(Statement* stmt);
+static bool evaluate_statement(Statement* stmt);
+static bool evaluate_statement_block(Statement* stmt);
 
-static Value evaluate_expression_literal_string(Expression* expr) {
-  assert(expr->type == EXPRESSION_LITERAL && expr->literal.type == TOKEN_TYPE_STRING);
-  return value_new_stringview(expr->literal.content);
+// Strings are interned and numbers immediate, constants don't need to be copied
+static Value evaluate_expression_literal_constant(Expression* expr) {
+  assert(expr->type == EXPRESSION_LITERAL && (expr->literal.type == TOKEN_TYPE_STRING || expr->literal.type == TOKEN_TYPE_NUMBER));
+  return interpreter.constants[expr->constant];
 }
 
-static Value evaluate_expression_literal_double(Expression* expr) {
-  assert(expr->type == EXPRESSION_LITERAL && expr->literal.type == TOKEN_TYPE_NUMBER);
-  Number num = expr->literal.value;
-  double val = NAN;
-  if (num.decimal == 0) {
-    val = (double)num.whole;
-  } else {
-    long temp = num.decimal;
-    int numdigits = 0;
-    while (temp > 0) {
-      temp /= 10;
-      ++numdigits;
-    }
-
-    val = num.whole + num.decimal / pow(10, numdigits);
+// Operators only raise errors on the generic path, nodes still specialized after running didn't
+static bool evaluated_without_errors(const Expression* expr) {
+  switch (expr->type) {
+    case EXPRESSION_GROUP:
+      return evaluated_without_errors(expr->group.child);
+    case EXPRESSION_UNARY:
+      return evaluated_without_errors(expr->unary.child);
+    case EXPRESSION_BINARY:
+      return (expr->binary.specialization == BINARY_DOUBLES || expr->binary.specialization == BINARY_BOOLS) &&
+        evaluated_without_errors(expr->binary.left) && evaluated_without_errors(expr->binary.right);
+    default:
+      return true;
   }
-
-  return value_new_double(val);
 }
 
 static Value evaluate_expression_group(Expression* expr) {
   assert(expr->type == EXPRESSION_GROUP);
-  return evaluate_expression(expr->group.child);
+  struct Group* group = &expr->group;
+  if (group->cached) return group->value;
+
+  Value v = evaluate_expression(group->child);
+  // Errors are raised again by every evaluation, only values without references are kept
+  bool plain = value_type(v) == EVAL_TYPE_DOUBLE || value_type(v) == EVAL_TYPE_BOOL;
+  if (group->invariant && plain && evaluated_without_errors(group->child)) {
+    group->value = v;
+    group->cached = true;
+  }
+  return v;
+}
+
+// Binds the callee, the args and the receiver into the current call scope
+static void bind_call(Value* fnvalue, const struct Receiver* receiver, const Value* args) {
+  FunctionValue* fn = value_as_fun(*fnvalue);
+  ScopeRef arg_scope = scope_ref_get_current();
+  scope_define_into(arg_scope, CALLEE_SLOT, sv_new("<callee>"), fnvalue);
+  for (size_t i = 0; i < fn->proto->params.count; ++i) {
+    StringView param_name = fn->proto->params.xs[i];
+    scope_define_into(arg_scope, CALLEE_SLOT + 1 + i, param_name, args + i);
+  }
+  scope_define_receiver(arg_scope, fn, receiver);
+  scope_ref_release(&arg_scope);
+}
+
+// The call is left for the frame its return statement leaves, it holds the callee, 'this' and the args
+static void schedule_tail_call(Value* fnvalue, const struct Receiver* receiver, const Value* args, size_t count) {
+  struct TailCall* tail = &interpreter.tail_call;
+  tail->pending = true;
+  tail->callee = value_copy(fnvalue);
+  tail->receiver.this = (receiver) ? value_copy(&receiver->this) : value_new_nil();
+  tail->args.count = 0;
+  for (size_t i = 0; i < count; ++i) {
+    vector_push(tail->args, args[i]);
+  }
+}
+
+// Runs the tail calls scheduled by the function that just returned, each one in the call scope
+// of the previous one: the C stack and the scope pool don't grow with tail recursion
+static void run_tail_calls() {
+  struct TailCall* tail = &interpreter.tail_call;
+
+  while (tail->pending) {
+    tail->pending = false;
+
+    Value callee = tail->callee;
+    struct Receiver receiver = tail->receiver;
+    FunctionValue* fn = value_as_fun(callee);
+
+    Value native_ret;
+    bool native = jit_call(fn, tail->args.xs, tail->args.count, &native_ret);
+    if (native) {
+      interpreter.frames.xs[interpreter.frames.count - 1].ret = native_ret;
+    } else {
+      scope_reenter_call(fn);
+      bind_call(&callee, &receiver, tail->args.xs);
+    }
+
+    for (size_t i = 0; i < tail->args.count; ++i) {
+      value_scopeexit(tail->args.xs + i);
+    }
+    value_scopeexit(&receiver.this);
+    value_scopeexit(&callee);
+
+    if (!native) evaluate_statement_block(fn->proto->body);
+  }
 }
 
-static Value evaluate_expression_call_fn(Value* fnvalue, Expression* callexpr) {
+// tail is true for the call of a return statement, see evaluate_statement_return
+static Value evaluate_expression_call_fn(Value* fnvalue, const struct Receiver* receiver, Expression* callexpr, bool tail) {
   // Check arguments arity
-  FunctionValue* fn = &fnvalue->fnvalue;
+  FunctionValue* fn = value_as_fun(*fnvalue);
   size_t arg_count = callexpr->call.args.count;
-  size_t params_count = fn->params.count;
+  size_t params_count = fn->proto->params.count;
 
   if (arg_count < params_count) {
-    char errmsg[1024] = "Missing arguments: ";
-    size_t cursor = strlen(errmsg);
-    for (size_t i = arg_count; i < params_count; ++i) {
-      StringView param_name = fn->params.xs[i];
-      snprintf(errmsg + cursor, param_name.len + 3, "\""SV_Fmt"\"", SV_Fmt_arg(param_name));
-      cursor += param_name.len + 2;
-      if (i < params_count - 1) {
-        snprintf(errmsg + cursor, 3, ", ");
-        cursor += 2;
-      }
-    }
-    snprintf(errmsg + cursor, strlen(" in function call") + 1, " in function call");
-    runtime_error(&callexpr->call.open_paren, errmsg);
+    runtime_error_missing_args(&callexpr->call.open_paren, fn->proto->params.xs, arg_count, params_count);
     return value_new_err();
   } else if (arg_count > params_count) {
     runtime_error(&callexpr->call.open_paren, "Extraneous arguments in function call");
     return value_new_err();
   }
 
-  // Evaluate args first
-  struct Args {
-    size_t count;
-    size_t capacity;
-    Value* xs;
-  } args;
-  vector_new(args, fn->params.count);
-  for (size_t i = 0; i < fn->params.count; ++i) {
-    vector_push(args, evaluate_expression(callexpr->call.args.xs[i]));
+  // Evaluate args first, an arg is evaluated before it's pushed since it may push the args of its own calls
+  size_t base = interpreter.args.count;
+  for (size_t i = 0; i < arg_count; ++i) {
+    Value arg = evaluate_expression(callexpr->call.args.xs[i]);
+    vector_push(interpreter.args, arg);
   }
-  // Swap to function scope and bind args
-  scope_swap(fn->capture);
-  scope_new();
-  ScopeRef arg_scope = scope_ref_get_current();
-  for (size_t i = 0; i < fn->params.count; ++i) {
-    StringView param_name = fn->params.xs[i];
-    scope_insert_into(arg_scope, param_name, args.xs + i);
+  Value* args = interpreter.args.xs + base;
+
+  // Pure functions are looked up in their cache first. They're never tail called, their result
+  // has to come back here to be cached
+  MemoCall memo = {0};
+  if (fn->proto->pure) {
+    Value cached;
+    if (memo_lookup(fn, args, arg_count, &cached, &memo)) {
+      interpreter.args.count = base;
+      return cached;
+    }
+    tail = false;
   }
-  rc_release(&arg_scope);
-  vector_free(args);
 
-  interpreter.pending_return.await_return = true;
-  evaluate_statement_block(fn->body);
-  Value ret = take_return();
+  if (tail) {
+    schedule_tail_call(fnvalue, receiver, args, arg_count);
+    interpreter.args.count = base;
+    return value_new_nil();
+  }
 
-  scope_pop();
-  scope_restore();
+  Value native_ret;
+  if (jit_call(fn, args, arg_count, &native_ret)) {
+    interpreter.args.count = base;
+    return native_ret;
+  }
+
+  // Enter the call scope and bind the callee and args
+  scope_enter_call(fn);
+  bind_call(fnvalue, receiver, args);
+  for (size_t i = 0; i < arg_count; ++i) {
+    value_scopeexit(args + i);
+  }
+  interpreter.args.count = base;
+
+  vector_push(interpreter.frames, ((struct CallFrame){value_new_nil()}));
+  evaluate_statement_block(fn->proto->body);
+  run_tail_calls();
+  Value ret = interpreter.frames.xs[interpreter.frames.count - 1].ret;
+  vector_pop(interpreter.frames);
+
+  scope_leave_call();
+  memo_store(&memo, &ret);
   return ret;
 }
 
 static Value evaluate_expression_call_class(Value* classvalue, Expression* callexpr) {
   Value instance = value_new_instance(classvalue);
 
-  Value constructor = instance_find_property(&instance, sv_new("constructor"));
-  if (constructor.type == EVAL_TYPE_FUN) {
-    Expression constructor_callee;
-    constructor_callee.type = EXPRESSION_STATIC;
-    constructor_callee.evaluated = constructor;
-
-    Expression constructor_call;
-    constructor_call.type = EXPRESSION_CALL;
-    constructor_call.call.callee = &constructor_callee;
-    constructor_call.call.open_paren = callexpr->call.open_paren;
-    constructor_call.call.args = callexpr->call.args;
-
-    evaluate_expression_call(&constructor_call);
+  struct Receiver receiver;
+  Value constructor = instance_find_method(&instance, sv_new("constructor"), NULL, &receiver);
+  if (value_type(constructor) == EVAL_TYPE_FUN) {
+    Value ret = evaluate_expression_call_fn(&constructor, &receiver, callexpr, false);
+    value_scopeexit(&ret);
   }
   value_scopeexit(&constructor);
 
   return instance;
 }
 
+static Value evaluate_call_value(Value* calleeval, const struct Receiver* receiver, Expression* expr) {
+  switch (value_type(*calleeval)) {
+    case EVAL_TYPE_FUN:
+      return evaluate_expression_call_fn(calleeval, receiver, expr, expr == interpreter.tail_call.expr);
+    case EVAL_TYPE_CLASS:
+      return evaluate_expression_call_class(calleeval, expr);
+    default:
+      runtime_error(find_token(expr->call.callee), "Cannot resolve callee as callable");
+      return value_new_err();
+  }
+}
+
 static Value evaluate_expression_call(Expression* expr) {
   Value calleeval_evaluated;
   Value* calleeval; 
@@ -171,7 +236,7 @@ static Value evaluate_expression_call(Expression* expr) {
     callee_expr->type == EXPRESSION_LITERAL && 
     callee_expr->literal.type == TOKEN_TYPE_IDENTIFIER
   ) {
-    calleeval = scope_get_val_ref(callee_expr->literal.lexeme);
+    calleeval = scope_get_val_ref(callee_expr->var);
     if (calleeval == NULL) {
       runtime_error(find_token(callee_expr), "Unresolved identifier as callable");
       return value_new_err();
@@ -182,18 +247,7 @@ static Value evaluate_expression_call(Expression* expr) {
     clean_callee = true;
   }
 
-  Value ret = value_new_nil();
-  switch (calleeval->type) {
-    case EVAL_TYPE_FUN:
-      ret = evaluate_expression_call_fn(calleeval, expr);
-      break;
-    case EVAL_TYPE_CLASS:
-      ret = evaluate_expression_call_class(calleeval, expr);
-      break;
-    default:
-      runtime_error(find_token(callee_expr), "Cannot resolve callee as callable");
-      ret = value_new_err();
-  }
+  Value ret = evaluate_call_value(calleeval, NULL, expr);
 
   if (clean_callee) {
     value_scopeexit(calleeval);
@@ -202,16 +256,52 @@ static Value evaluate_expression_call(Expression* expr) {
   return ret;
 }
 
+// Method call on an instance, the method runs on it without being bound
+static Value evaluate_expression_invoke(Expression* expr) {
+  Expression* get = expr->call.callee;
+  struct Receiver receiver;
+
+  if (expression_is_super(get->get.object)) {
+    const Value* super = scope_get_val_ref(get->get.object->var);
+    const Value* this = scope_get_val_ref(get->var);
+    Value callee = super_find_method(super, this, get->get.name.lexeme, &receiver);
+    Value ret = evaluate_call_value(&callee, &receiver, expr);
+    value_scopeexit(&callee);
+    return ret;
+  }
+
+  Value object = evaluate_expression(get->get.object);
+  if (value_type(object) != EVAL_TYPE_INSTANCE) {
+    runtime_error(find_token(get), "Get accessor must be used on instances");
+    value_scopeexit(&object);
+    runtime_error(find_token(get), "Cannot resolve callee as callable");
+    return value_new_err();
+  }
+
+  Value callee = instance_find_method(&object, get->get.name.lexeme, &get->get.cache, &receiver);
+  Value ret = evaluate_call_value(&callee, &receiver, expr);
+
+  value_scopeexit(&callee);
+  value_scopeexit(&object);
+  return ret;
+}
+
 Value evaluate_expression_get(Expression* expr) {
+  if (expression_is_super(expr->get.object)) {
+    const Value* super = scope_get_val_ref(expr->get.object->var);
+    const Value* this = scope_get_val_ref(expr->var);
+    return super_find_property(super, this, expr->get.name.lexeme);
+  }
+
   Value object = evaluate_expression(expr->get.object);
-  if (object.type != EVAL_TYPE_INSTANCE) {
+  if (value_type(object) != EVAL_TYPE_INSTANCE) {
     runtime_error(find_token(expr), "Get accessor must be used on instances");
     value_scopeexit(&object);
     return value_new_err();
   }
 
   StringView looking_for = expr->get.name.lexeme;
-  Value retval = instance_find_property(&object, looking_for);
+  Value retval = instance_find_property(&object, looking_for, &expr->get.cache);
 
   set_get_target(&object);
 
@@ -220,14 +310,14 @@ Value evaluate_expression_get(Expression* expr) {
 
 Value evaluate_expression_set(Expression* expr) {
   Value object = evaluate_expression(expr->set.object);
-  if (object.type != EVAL_TYPE_INSTANCE) {
+  if (value_type(object) != EVAL_TYPE_INSTANCE) {
     runtime_error(find_token(expr), "Get accessor must be used on instances");
     return value_new_err();
   }
 
   Value right = evaluate_expression(expr->set.right);
   StringView name = expr->set.name.lexeme;
-  instance_set_property(&object, name, &right);
+  instance_set_property(&object, name, &right, &expr->set.cache);
   value_scopeexit(&right);
 
   return object;
@@ -244,7 +334,7 @@ static Value evaluate_expression_unary(Expression* expr) {
         return value_new_err();
       }
 
-      return value_new_double(-right.dvalue);
+      return value_new_double(-value_as_double(right));
     break;
 
     case TOKEN_TYPE_BANG:
@@ -253,7 +343,7 @@ static Value evaluate_expression_unary(Expression* expr) {
         return value_new_err();
       }
 
-      return value_new_bool(!right.bvalue);
+      return value_new_bool(!value_as_bool(right));
     break;
 
     default:
@@ -267,146 +357,151 @@ static Value evaluate_expression_unary(Expression* expr) {
 }
 
 // helper function
-static Value binary_eval_member(Expression* expr, bool eval_left, enum ValueType expected_type) {
-  Expression* to_eval = (eval_left) ? expr->binary.left : expr->binary.right;
-  Value eval = evaluate_expression(to_eval);
-
+static Value binary_convert_member(Expression* expr, Value eval, bool eval_left, enum ValueType expected_type) {
   if (!convert_to(&eval, expected_type)) {
     runtime_error(
-      find_token(to_eval),
+      find_token((eval_left) ? expr->binary.left : expr->binary.right),
       "Binary operation not permitted: %s operand is not convertible to %s",
       (eval_left) ? "left" : "right", eval_type_to_str(expected_type)
     );
 
-    return value_new_err();
+    return value_new_zero(expected_type);
   }
 
   return eval;
 }
 
-static Value evaluate_expression_binary(Expression* expr) {
-  assert(expr->type == EXPRESSION_BINARY);
-
-  Value e;
-
+static enum BinaryOperator binary_operator(const Expression* expr) {
   switch (expr->binary.operator.type) {
-    // Arithmetic operators evaluation
-    case TOKEN_TYPE_PLUS:
-    case TOKEN_TYPE_MINUS:
-    case TOKEN_TYPE_STAR:
-    case TOKEN_TYPE_SLASH: {
-      Value left = binary_eval_member(expr, true, EVAL_TYPE_DOUBLE);
-      Value right = binary_eval_member(expr, false, EVAL_TYPE_DOUBLE);
-
-      e.type = EVAL_TYPE_DOUBLE;
-      switch (expr->binary.operator.type) {
-        case TOKEN_TYPE_PLUS:
-          e.dvalue = left.dvalue + right.dvalue;
-          break;
-        case TOKEN_TYPE_MINUS:
-          e.dvalue = left.dvalue - right.dvalue;
-          break;
-        case TOKEN_TYPE_STAR:
-          e.dvalue = left.dvalue * right.dvalue;
-          break;
-        case TOKEN_TYPE_SLASH:
-          if (right.dvalue == 0.0) {
-            e.dvalue = NAN;
-          } else {
-            e.dvalue = left.dvalue / right.dvalue;
-          }
-          break;
-        default:
-          break;
-      }
-    }
-      break;
+    case TOKEN_TYPE_PLUS: return BINARY_OP_ADD;
+    case TOKEN_TYPE_MINUS: return BINARY_OP_SUBTRACT;
+    case TOKEN_TYPE_STAR: return BINARY_OP_MULTIPLY;
+    case TOKEN_TYPE_SLASH: return BINARY_OP_DIVIDE;
+    case TOKEN_TYPE_LESS: return BINARY_OP_LESS;
+    case TOKEN_TYPE_LESS_EQUAL: return BINARY_OP_LESS_EQUAL;
+    case TOKEN_TYPE_GREATER: return BINARY_OP_GREATER;
+    case TOKEN_TYPE_GREATER_EQUAL: return BINARY_OP_GREATER_EQUAL;
+    case TOKEN_TYPE_EQUAL_EQUAL: return BINARY_OP_EQUAL;
+    case TOKEN_TYPE_BANG_EQUAL: return BINARY_OP_NOT_EQUAL;
+    default:
+      fprintf(stderr, "Error binary expr with unrecognized token type");
+      exit(1);
+  }
+}
 
-    // Comparison operators evaluation
-    case TOKEN_TYPE_LESS:
-    case TOKEN_TYPE_LESS_EQUAL:
-    case TOKEN_TYPE_GREATER:
-    case TOKEN_TYPE_GREATER_EQUAL:
-    case TOKEN_TYPE_EQUAL_EQUAL:
-    case TOKEN_TYPE_BANG_EQUAL: {
-      Value left = binary_eval_member(expr, true, EVAL_TYPE_DOUBLE);
-      Value right = binary_eval_member(expr, false, EVAL_TYPE_DOUBLE);
-
-      e.type = EVAL_TYPE_BOOL;
-      switch (expr->binary.operator.type) {
-        case TOKEN_TYPE_LESS:
-          e.bvalue = left.dvalue < right.dvalue;
-        break;
-        case TOKEN_TYPE_LESS_EQUAL:
-          e.bvalue = left.dvalue <= right.dvalue;
-        break;
-        case TOKEN_TYPE_GREATER:
-          e.bvalue = left.dvalue > right.dvalue;
-        break;
-        case TOKEN_TYPE_GREATER_EQUAL:
-          e.bvalue = left.dvalue >= right.dvalue;
-        break;
-        case TOKEN_TYPE_EQUAL_EQUAL:
-          e.bvalue = left.dvalue == right.dvalue;
-        break;
-        case TOKEN_TYPE_BANG_EQUAL:
-          e.bvalue = left.dvalue != right.dvalue;
-        break;
-        default:
-        break;
-      }
+// Operands go through the dispatch tables. The left one is always evaluated,
+// the right one too when a specialized node gave up after evaluating it
+static Value evaluate_binary_generic(Expression* expr, Value left, const Value* right) {
+  if (expr->binary.operator.type == TOKEN_TYPE_KEYWORD) {
+    // Logic operator evaluations
+    bool is_or = expr->binary.operator.keyword == RESERVED_KEYWORD_OR;
+    left = binary_convert_member(expr, left, true, EVAL_TYPE_BOOL);
+    if (value_as_bool(left) == is_or) {
+      return value_new_bool(is_or);
     }
-      break;
 
-    case TOKEN_TYPE_KEYWORD:
-      // Logic operator evaluations
-      e.type = EVAL_TYPE_BOOL;
-      switch (expr->binary.operator.keyword) {
-        case RESERVED_KEYWORD_OR: {
-          Value left = binary_eval_member(expr, true, EVAL_TYPE_BOOL);
-          if (left.bvalue) {
-            e.bvalue = true;
-          } else {
-            Value right = binary_eval_member(expr, false, EVAL_TYPE_BOOL);
-            e.bvalue = right.bvalue;
-          }
-        }
-          break;
-          
-        case RESERVED_KEYWORD_AND: {
-          Value left = binary_eval_member(expr, true, EVAL_TYPE_BOOL);
-          if (!left.bvalue) {
-            e.bvalue = false;
-          } else {
-            Value right = binary_eval_member(expr, false, EVAL_TYPE_BOOL);
-            e.bvalue = right.bvalue;
-          }
-        }
-          break;
-        default:
-          fprintf(stderr, "Error binary expr with unrecognized keyword type");
-          exit(1);
-      }
-      break;
+    Value r = (right) ? *right : evaluate_expression(expr->binary.right);
+    return binary_convert_member(expr, r, false, EVAL_TYPE_BOOL);
+  }
 
-    default:
-      fprintf(stderr, "Error binary expr with unrecognized token type");
-      exit(1);
+  enum BinaryOperator op = binary_operator(expr);
+  // Errors on the left operand are reported before the right one runs
+  if (!binary_operator_takes_left(op, value_type(left))) {
+    left = binary_convert_member(expr, left, true, EVAL_TYPE_DOUBLE);
+  }
+
+  Value r = (right) ? *right : evaluate_expression(expr->binary.right);
+  BinaryOperatorFn fn = binary_operator_find(op, left, r);
+  if (fn == NULL) {
+    left = binary_convert_member(expr, left, true, EVAL_TYPE_DOUBLE);
+    r = binary_convert_member(expr, r, false, EVAL_TYPE_DOUBLE);
+    fn = binary_operators[op][EVAL_TYPE_DOUBLE][EVAL_TYPE_DOUBLE];
   }
 
+  Value e = fn(left, r);
+  value_scopeexit(&left);
+  value_scopeexit(&r);
   return e;
 }
 
+// A guard failed, the node is rewritten to the generic path for good
+static Value binary_despecialize(Expression* expr, Value left, const Value* right) {
+  expr->binary.specialization = BINARY_GENERIC;
+  return evaluate_binary_generic(expr, left, right);
+}
+
+static Value evaluate_binary_doubles(Expression* expr, Value left) {
+  if (!value_is_double(left)) return binary_despecialize(expr, left, NULL);
+
+  Value right = evaluate_expression(expr->binary.right);
+  if (!value_is_double(right)) return binary_despecialize(expr, left, &right);
+
+  return expr->binary.operation(left, right);
+}
+
+static Value evaluate_binary_bools(Expression* expr, Value left) {
+  if (value_type(left) != EVAL_TYPE_BOOL) return binary_despecialize(expr, left, NULL);
+
+  bool is_or = expr->binary.operator.keyword == RESERVED_KEYWORD_OR;
+  if (value_as_bool(left) == is_or) {
+    return value_new_bool(is_or);
+  }
+
+  Value right = evaluate_expression(expr->binary.right);
+  if (value_type(right) != EVAL_TYPE_BOOL) return binary_despecialize(expr, left, &right);
+
+  return right;
+}
+
+// Picked on the first execution from the operator and the left operand,
+// the guard of the specialized path checks the right one right away
+static void binary_specialize(Expression* expr, Value left) {
+  bool is_logic = expr->binary.operator.type == TOKEN_TYPE_KEYWORD;
+
+  switch (value_type(left)) {
+    case EVAL_TYPE_DOUBLE:
+      if (is_logic) break;
+      expr->binary.specialization = BINARY_DOUBLES;
+      expr->binary.operation = binary_operators[binary_operator(expr)][EVAL_TYPE_DOUBLE][EVAL_TYPE_DOUBLE];
+      return;
+    case EVAL_TYPE_BOOL:
+      if (!is_logic) break;
+      expr->binary.specialization = BINARY_BOOLS;
+      return;
+    default:
+      break;
+  }
+
+  expr->binary.specialization = BINARY_GENERIC;
+}
+
+static Value evaluate_expression_binary(Expression* expr) {
+  assert(expr->type == EXPRESSION_BINARY);
+
+  Value left = evaluate_expression(expr->binary.left);
+  if (expr->binary.specialization == BINARY_UNINITIALIZED) {
+    binary_specialize(expr, left);
+  }
+
+  switch (expr->binary.specialization) {
+    case BINARY_DOUBLES:
+      return evaluate_binary_doubles(expr, left);
+    case BINARY_BOOLS:
+      return evaluate_binary_bools(expr, left);
+    default:
+      return evaluate_binary_generic(expr, left, NULL);
+  }
+}
+
 static Value evaluate_expression_anon_fun(Expression* expr) {
-  Value fn = value_new_fun(expr->anon_fun.body, expr->anon_fun.params.xs, expr->anon_fun.params.count, scope_ref_get_current());
+  Value fn = value_new_fun(&expr->anon_fun.proto, scope_capture(&expr->anon_fun.proto.upvalues));
   return fn;
 }
 
 static Value evaluate_expression_assignment(Expression* expr) {
   Value rhs = evaluate_expression(expr->assignment.right);
-  StringView lexeme = expr->assignment.name.lexeme;
 
-  if (!scope_replace(lexeme, &rhs)) {
+  if (!scope_assign(expr->var, &rhs)) {
     runtime_error(&expr->assignment.name, "Assignement failed. Variable must be declared with the 'var' keyword first"); 
     return value_new_err();
   }
@@ -426,6 +521,9 @@ static Value evaluate_expression(Expression* expr) {
     case EXPRESSION_GROUP:
       return evaluate_expression_group(expr);
     case EXPRESSION_CALL:
+      if (expr->call.callee->type == EXPRESSION_GET) {
+        return evaluate_expression_invoke(expr);
+      }
       return evaluate_expression_call(expr);
     case EXPRESSION_GET:
       return evaluate_expression_get(expr);
@@ -434,12 +532,11 @@ static Value evaluate_expression(Expression* expr) {
     case EXPRESSION_LITERAL:
       switch (expr->literal.type) {
         case TOKEN_TYPE_STRING:
-          return evaluate_expression_literal_string(expr);
         case TOKEN_TYPE_NUMBER:
-          return evaluate_expression_literal_double(expr);
+          return evaluate_expression_literal_constant(expr);
         case TOKEN_TYPE_IDENTIFIER: {
-          Value val = scope_get_val_copy(expr->literal.lexeme);
-          if (val.type == EVAL_TYPE_ERR) {
+          Value val = scope_get_val_copy(expr->var);
+          if (value_type(val) == EVAL_TYPE_ERR) {
             StringView lexeme = expr->literal.lexeme;
             runtime_error(NULL, "Unresolved identifier: "SV_Fmt, SV_Fmt_arg(lexeme));
           }
@@ -450,25 +547,21 @@ static Value evaluate_expression(Expression* expr) {
           switch(expr->literal.keyword) {
             case RESERVED_KEYWORD_SUPER:
             case RESERVED_KEYWORD_THIS: {
-              Value val = scope_get_val_copy(expr->literal.lexeme);
-              if (val.type == EVAL_TYPE_ERR) {
+              Value val = scope_get_val_copy(expr->var);
+              if (value_type(val) == EVAL_TYPE_ERR) {
                 StringView lexeme = expr->literal.lexeme;
                 runtime_error(NULL, "Unresolved identifier: "SV_Fmt, SV_Fmt_arg(lexeme));
               }
               return val;
             }
             case RESERVED_KEYWORD_TRUE: {
-                Value e = {EVAL_TYPE_BOOL};
-                e.bvalue = true;
-                return e;
+                return value_new_bool(true);
             }
             case RESERVED_KEYWORD_FALSE: {
-                Value e = {EVAL_TYPE_BOOL};
-                e.bvalue = false;
-                return e;
+                return value_new_bool(false);
             }
             case RESERVED_KEYWORD_NIL:
-                return (Value){EVAL_TYPE_NIL};
+                return value_new_nil();
             default:
               fprintf(stderr, "Keyword cannot be evaluated");
               exit(1);
@@ -508,55 +601,153 @@ static void evaluate_statement_print(Statement* stmt) {
 
 static void evaluate_statement_var_decl(Statement* stmt) {
   Value e = evaluate_expression(stmt->var_decl.expr);
-  scope_insert(stmt->var_decl.identifier, &e);
+  scope_define(stmt->var_decl.slot, stmt->var_decl.identifier, &e);
   value_scopeexit(&e);
 }
 
 static void evaluate_statement_fun_decl(Statement* stmt) {
-  Value fn = value_new_fun(stmt->fun_decl.body, stmt->fun_decl.params.xs, stmt->fun_decl.params.count, scope_ref_get_current());
-  scope_insert(stmt->fun_decl.identifier, &fn);
+  Value fn = value_new_fun(&stmt->fun_decl.proto, scope_capture(&stmt->fun_decl.proto.upvalues));
+  scope_define(stmt->fun_decl.slot, stmt->fun_decl.identifier, &fn);
   value_scopeexit(&fn);
 }
 
-static void evaluate_statement_block(Statement* stmt) {
+static bool evaluate_statement_block(Statement* stmt) {
   for (size_t i = 0; i < stmt->block.count; ++i) {
-    Statement* s = stmt->block.xs + i;
-    evaluate_statement(s);   
-
-    if (should_return())
-      break;
+    if (evaluate_statement(stmt->block.xs + i)) return true;
   }
+  return false;
 }
 
-static void evaluate_statement_conditional(Statement* stmt) {
+static bool evaluate_statement_conditional(Statement* stmt) {
   for (size_t i = 0; i < stmt->cond.count; ++i) {
     struct ConditionalBlock* b = stmt->cond.xs + i;
     Expression* condition = b->condition;
     
     // else statement
     if (condition == NULL && i == stmt->cond.count - 1) {
-      evaluate_statement(b->branch);
-      return;
+      if (trace_recording()) trace_record_branch(stmt, i);
+      return evaluate_statement(b->branch);
     }
 
     Value e = evaluate_expression(condition);
     if (!convert_to(&e, EVAL_TYPE_BOOL)) {
       runtime_error(NULL, "If statement condition can't be evaluated as boolean");
-      goto cleanup;
+      value_scopeexit(&e);
+      return false;
     }
 
-    if(e.bvalue) {
-      evaluate_statement(b->branch);
-      goto cleanup;
+    if(value_as_bool(e)) {
+      if (trace_recording()) trace_record_branch(stmt, i);
+      value_scopeexit(&e);
+      return evaluate_statement(b->branch);
     }
 
-  cleanup:
     value_scopeexit(&e);
-    return;
   }
+
+  if (trace_recording()) trace_record_branch(stmt, stmt->cond.count);
+  return false;
 }
 
-static void evaluate_statement_while(Statement* stmt) {
+// Finishes the iteration a trace left, rebuilding the scopes of the blocks it was in.
+// Returns true when a return statement left the function
+static bool resume_trace_exit(const Trace* trace, const struct TraceExit* exit, size_t level) {
+  const struct TraceFrame* frame = exit->xs + level;
+  if (frame->new_scope) scope_new();
+
+  for (size_t i = 0; i < frame->locals.count; ++i) {
+    const struct TraceLocal* local = frame->locals.xs + i;
+    Value v = trace_local_value(trace, local);
+    scope_define(local->slot, local->name, &v);
+  }
+
+  // The innermost frame runs the statement whose guard failed again, outer ones continue after theirs
+  size_t start = frame->index;
+  bool returned = false;
+  if (level + 1 < exit->count) {
+    returned = resume_trace_exit(trace, exit, level + 1);
+    start += 1;
+  }
+
+  for (size_t i = start; i < frame->count && !returned; ++i) {
+    returned = evaluate_statement(frame->stmts + i);
+  }
+
+  if (frame->new_scope) scope_pop();
+  return returned;
+}
+
+// Runs one iteration of the loop body, natively once the loop has been traced.
+// Returns false when the trace ran the loop to completion or a return statement left the function
+static bool evaluate_loop_iteration(Trace* trace, Statement* stmt, bool* returned) {
+  if (trace && trace->native) {
+    const struct TraceExit* exit = NULL;
+    switch (trace_run(trace, &exit)) {
+      case TRACE_LOOP_EXIT:
+        return false;
+      case TRACE_SIDE_EXIT:
+        *returned = resume_trace_exit(trace, exit, 0);
+        return !*returned;
+      case TRACE_GUARD_FAILED:
+        break;
+    }
+  } else if (trace && trace_count_iteration(trace)) {
+    trace_record_begin(trace);
+    *returned = evaluate_statement(stmt->while_loop.body);
+    trace_record_end(trace);
+    return !*returned;
+  }
+
+  *returned = evaluate_statement(stmt->while_loop.body);
+  return !*returned;
+}
+
+// Runs a counted loop with its counter in a double, written to its slot before every iteration.
+// Returns false when the counter or the bound isn't a double, or once the loop's trace should be
+// recorded, the generic loop then goes on from the condition
+static bool evaluate_counted_loop(Statement* stmt, Trace* trace, bool* returned) {
+  const struct LoopInfo* info = &stmt->while_loop.info;
+  const Statements* body = &stmt->while_loop.body->block;
+
+  ValueRef counter = scope_get_val_ref(info->counter);
+  if (!counter || value_type(*counter) != EVAL_TYPE_DOUBLE) return false;
+  double i = value_as_double(*counter);
+
+  Value bound = evaluate_expression(info->bound);
+  while (value_type(bound) == EVAL_TYPE_DOUBLE) {
+    double n = value_as_double(bound);
+    if (!(info->inclusive ? i <= n : i < n)) return true;
+
+    // The body block without the increment
+    scope_enter_block(stmt->while_loop.body->scope);
+    for (size_t k = 0; k + 1 < body->count && !*returned; ++k) {
+      *returned = evaluate_statement(body->xs + k);
+    }
+    scope_pop();
+    if (*returned) return true;
+
+    i += info->step;
+    *scope_get_val_ref(info->counter) = value_new_double(i);
+    if (trace && trace_count_iteration(trace)) break;
+    if (!info->bound_invariant) bound = evaluate_expression(info->bound);
+  }
+
+  value_scopeexit(&bound);
+  return false;
+}
+
+static bool evaluate_statement_while(Statement* stmt) {
+  const struct LoopInfo* info = &stmt->while_loop.info;
+  for (size_t i = 0; i < info->invariants.count; ++i) {
+    info->invariants.xs[i]->group.cached = false;
+  }
+
+  Trace* trace = trace_find(stmt);
+  bool returned = false;
+  // Traces run counted loops natively already, until then the counted loop warms the trace up
+  bool native = trace && trace->native;
+  if (info->counted && !native && evaluate_counted_loop(stmt, trace, &returned)) return returned;
+
   Value e = evaluate_expression(stmt->while_loop.condition);
 
   if (!convert_to(&e, EVAL_TYPE_BOOL)) {
@@ -564,9 +755,17 @@ static void evaluate_statement_while(Statement* stmt) {
     goto cleanup;
   }
 
-  bool iterate = e.bvalue;
+  bool iterate = value_as_bool(e);
+  bool warming = trace && !trace->native && !trace->rejected;
   while (iterate) {
-    evaluate_statement(stmt->while_loop.body);
+    if (!evaluate_loop_iteration(trace, stmt, &returned))
+      break;
+
+    // The recorded iteration got its trace rejected, the counted loop goes on from the condition
+    if (warming && trace->rejected) {
+      warming = false;
+      if (info->counted && evaluate_counted_loop(stmt, trace, &returned)) break;
+    }
 
     value_scopeexit(&e);
     e = evaluate_expression(stmt->while_loop.condition);
@@ -576,12 +775,12 @@ static void evaluate_statement_while(Statement* stmt) {
       goto cleanup;
     }
 
-    iterate = e.bvalue;
+    iterate = value_as_bool(e);
   }
 
 cleanup:
   value_scopeexit(&e);
-  return;
+  return returned;
 }
 
 static void evaluate_statement_class_decl(Statement* stmt) {
@@ -589,37 +788,48 @@ static void evaluate_statement_class_decl(Statement* stmt) {
 
   Value* super = NULL;
   if (stmt->class_decl.super) {
-    if (strncmp(identifier.str, stmt->class_decl.super->literal.lexeme.str, identifier.len) == 0) {
-      runtime_error(&stmt->class_decl.super->literal, "A class can't inherit from itself");
-      return;
-    }
-
-    super = scope_get_val_ref(stmt->class_decl.super->literal.lexeme);
+    super = scope_get_val_ref(stmt->class_decl.super->var);
     if (!super) {
         runtime_error(&stmt->class_decl.super->literal, "Can't find class \""SV_Fmt"\" to inherit from", SV_Fmt_arg(stmt->class_decl.super->literal.lexeme));
       return;
-    } else if (super->type != EVAL_TYPE_CLASS) {
+    } else if (value_type(*super) != EVAL_TYPE_CLASS) {
       runtime_error(&stmt->class_decl.super->literal, "\""SV_Fmt"\" is not a class !", SV_Fmt_arg(stmt->class_decl.super->literal.lexeme));
       return;
     }
   }
 
-  ClassMethods methods = build_class_methods(stmt->class_decl.methods_decl);
+  ClassMethods methods = build_class_methods(stmt->class_decl.methods_decl, super);
   Value class = value_new_class(stmt->class_decl.identifier, methods, super);
-  scope_insert(identifier, &class);
+  scope_define(stmt->class_decl.slot, identifier, &class);
   value_scopeexit(&class);
   vector_free(methods);
 }
 
-static void evaluate_statement_return(Statement* stmt) {
-  if (interpreter.pending_return.await_return) {
-    set_return(evaluate_expression(stmt->ret));
-  } else {
+static bool evaluate_statement_return(Statement* stmt) {
+  if (interpreter.frames.count == 0) {
     runtime_error(find_token(stmt->ret), "Return statement must be used inside a function body");
+    return false;
+  }
+
+  // Calls in tail position are run by the frame being left instead of a nested one.
+  // The callee and the args may contain return statements of their own
+  const Expression* enclosing_tail = interpreter.tail_call.expr;
+  if (stmt->ret->type == EXPRESSION_CALL && stmt->ret->call.is_tail) {
+    interpreter.tail_call.expr = stmt->ret;
   }
+  Value ret = evaluate_expression(stmt->ret);
+  interpreter.tail_call.expr = enclosing_tail;
+
+  // Nested calls may have grown the frames
+  interpreter.frames.xs[interpreter.frames.count - 1].ret = ret;
+  return true;
 }
 
-static void evaluate_statement(Statement* stmt) {
+// Returns true when a return statement left the current function, the statements enclosing it
+// stop right away and the value is in the current frame
+static bool evaluate_statement(Statement* stmt) {
+  bool returned = false;
+
   switch (stmt->type) {
     case STATEMENT_EXPR:
       evaluate_statement_expr(stmt);
@@ -637,24 +847,25 @@ static void evaluate_statement(Statement* stmt) {
       evaluate_statement_class_decl(stmt);
     break;
     case STATEMENT_BLOCK:
-      scope_new();
-      evaluate_statement_block(stmt);
+      scope_enter_block(stmt->scope);
+      returned = evaluate_statement_block(stmt);
       scope_pop();
     break;
     case STATEMENT_CONDITIONAL:
-      evaluate_statement_conditional(stmt);
+      returned = evaluate_statement_conditional(stmt);
     break;
     case STATEMENT_WHILE:
-      evaluate_statement_while(stmt);
+      returned = evaluate_statement_while(stmt);
     break;
     case STATEMENT_RETURN:
-      evaluate_statement_return(stmt);
+      returned = evaluate_statement_return(stmt);
     break;
   }
 
   if (has_get_target()) {
     discard_get_target();
   }
+  return returned;
 }
 
 void init_interpreter() {
@@ -665,8 +876,12 @@ void init_interpreter() {
 
   value_init(NUM_CLASSES, NUM_INSTANCES, sv_new(this), sv_new(super));
 
-  interpreter.pending_return = (struct PendingReturn){value_new_nil(), false, false};
+  vector_new(interpreter.frames, 64);
   interpreter.get_target = value_new_nil();
+  interpreter.constants = parser_constants();
+  interpreter.tail_call = (struct TailCall){0};
+  vector_new(interpreter.tail_call.args, 8);
+  vector_new(interpreter.args, 64);
 }
 
 void interpret(Statements stmts) {
@@ -679,5 +894,10 @@ void interpret(Statements stmts) {
   }
 
   scope_pop();
+  vector_free(interpreter.tail_call.args);
+  vector_free(interpreter.args);
+  vector_free(interpreter.frames);
   value_free();
+  jit_free();
+  trace_free();
 }
@@ -7,15 +7,44 @@
 #define NUM_CLASSES 255
 #define NUM_INSTANCES 255
 
-struct PendingReturn {
-  Value value;
-  bool await_return;
-  bool should_return;
+// Function being run by the tree walker, its locals live in the call scope it entered
+struct CallFrame {
+  // Set by the return statement leaving the function, nil when it ends without one
+  Value ret;
+};
+
+// Call of a return statement, run by the frame the statement leaves
+struct TailCall {
+  // Call expression of the return statement being evaluated
+  const Expression* expr;
+  bool pending;
+  Value callee;
+  struct Receiver receiver;
+  struct {
+    Value* xs;
+    size_t count;
+    size_t capacity;
+  } args;
 };
 
 typedef struct {
-  struct PendingReturn pending_return;
+  // Grows with the calls, empty while running the script's top level
+  struct {
+    struct CallFrame* xs;
+    size_t count;
+    size_t capacity;
+  } frames;
+  struct TailCall tail_call;
+  // Arguments of the calls being evaluated, the ones of nested calls are pushed above.
+  // A call pops its args once they're bound so the stack is allocated once
+  struct {
+    Value* xs;
+    size_t count;
+    size_t capacity;
+  } args;
   Value get_target;
+  // Literals of the program, see parser_constants
+  const Value* constants;
 } Interpreter;
 
 void evaluation_pretty_print(Value* e);
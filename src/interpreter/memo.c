@@ -0,0 +1,222 @@
+#include "memo.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../types/vector.h"
+#include "../error/runtime.h"
+
+#define MEMO_NONE UINT32_MAX
+// Power of two, keeps the chains short when the cache is full
+#define MEMO_BUCKETS (MEMO_CAPACITY * 2)
+
+// Call of a pure function, chained in its bucket and in the recency list
+struct MemoEntry {
+  uint32_t hash;
+  uint32_t next;
+  uint32_t newer;
+  uint32_t older;
+  // Changes every time the entry is handed to a call
+  uint32_t stamp;
+  // The call returned a result that could be cached
+  bool done;
+  Value result;
+};
+
+struct MemoTable {
+  const FunctionProto* proto;
+  size_t argc;
+  // argc per entry
+  Value* keys;
+  struct MemoEntry* entries;
+  uint32_t count;
+  uint32_t* buckets;
+  uint32_t newest;
+  uint32_t oldest;
+  uint32_t stamps;
+  size_t hits;
+  size_t misses;
+};
+
+// In the order the functions were first called, a program only declares a few pure functions
+static struct {
+  struct MemoTable** xs;
+  size_t count;
+  size_t capacity;
+  // Recursive calls find the same table again
+  struct MemoTable* last;
+} tables = {0};
+
+static struct MemoTable* table_find(const FunctionProto* proto) {
+  if (tables.last && tables.last->proto == proto) return tables.last;
+
+  for (size_t i = 0; i < tables.count; ++i) {
+    if (tables.xs[i]->proto == proto) return tables.last = tables.xs[i];
+  }
+
+  struct MemoTable* t = calloc(1, sizeof(struct MemoTable));
+  t->proto = proto;
+  t->argc = proto->params.count;
+  t->keys = malloc(MEMO_CAPACITY * t->argc * sizeof(Value));
+  t->entries = malloc(MEMO_CAPACITY * sizeof(struct MemoEntry));
+  t->buckets = malloc(MEMO_BUCKETS * sizeof(uint32_t));
+  memset(t->buckets, 0xFF, MEMO_BUCKETS * sizeof(uint32_t));
+  t->newest = MEMO_NONE;
+  t->oldest = MEMO_NONE;
+
+  if (tables.capacity == 0) vector_new(tables, 4);
+  vector_push(tables, t);
+  return tables.last = t;
+}
+
+static bool is_key(Value v) {
+  switch (value_type(v)) {
+    case EVAL_TYPE_DOUBLE:
+    case EVAL_TYPE_STRING_VIEW:
+    case EVAL_TYPE_BOOL:
+    case EVAL_TYPE_NIL:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Strings are interned, equal keys have the same bits. Doubles are told apart by their bits too
+static uint32_t hash_args(const Value* args, size_t argc) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < argc; ++i) {
+    h ^= args[i].bits;
+    h *= 0x9E3779B97F4A7C15ull;
+    h ^= h >> 29;
+  }
+  return (uint32_t)(h ^ (h >> 32));
+}
+
+static Value* entry_keys(struct MemoTable* t, uint32_t i) {
+  return t->keys + (size_t)i * t->argc;
+}
+
+static bool same_args(const Value* a, const Value* b, size_t argc) {
+  for (size_t i = 0; i < argc; ++i) {
+    if (a[i].bits != b[i].bits) return false;
+  }
+  return true;
+}
+
+static void unlink_recent(struct MemoTable* t, uint32_t i) {
+  struct MemoEntry* e = t->entries + i;
+  if (e->newer != MEMO_NONE) t->entries[e->newer].older = e->older;
+  else t->newest = e->older;
+  if (e->older != MEMO_NONE) t->entries[e->older].newer = e->newer;
+  else t->oldest = e->newer;
+}
+
+static void push_newest(struct MemoTable* t, uint32_t i) {
+  struct MemoEntry* e = t->entries + i;
+  e->newer = MEMO_NONE;
+  e->older = t->newest;
+  if (t->newest != MEMO_NONE) t->entries[t->newest].newer = i;
+  t->newest = i;
+  if (t->oldest == MEMO_NONE) t->oldest = i;
+}
+
+static void unlink_bucket(struct MemoTable* t, uint32_t i) {
+  uint32_t* link = t->buckets + (t->entries[i].hash & (MEMO_BUCKETS - 1));
+  while (*link != i) {
+    assert(*link != MEMO_NONE && "Memo entry missing from its bucket");
+    link = &t->entries[*link].next;
+  }
+  *link = t->entries[i].next;
+}
+
+// Least recently used entry once the cache is full
+static uint32_t take_entry(struct MemoTable* t) {
+  if (t->count < MEMO_CAPACITY) return t->count++;
+
+  uint32_t i = t->oldest;
+  unlink_bucket(t, i);
+  unlink_recent(t, i);
+  return i;
+}
+
+bool memo_lookup(const FunctionValue* fn, const Value* args, size_t argc, Value* ret, MemoCall* call) {
+  *call = (MemoCall){0};
+  if (argc != fn->proto->params.count) return false;
+  for (size_t i = 0; i < argc; ++i) {
+    if (!is_key(args[i])) return false;
+  }
+
+  struct MemoTable* t = table_find(fn->proto);
+  uint32_t hash = hash_args(args, argc);
+  uint32_t* bucket = t->buckets + (hash & (MEMO_BUCKETS - 1));
+
+  for (uint32_t i = *bucket; i != MEMO_NONE; i = t->entries[i].next) {
+    struct MemoEntry* e = t->entries + i;
+    if (e->hash != hash || !same_args(entry_keys(t, i), args, argc)) continue;
+
+    unlink_recent(t, i);
+    push_newest(t, i);
+    if (e->done) {
+      t->hits += 1;
+      *ret = e->result;
+      return true;
+    }
+
+    // Still running or its result couldn't be cached, this call takes the entry over
+    t->misses += 1;
+    e->stamp = ++t->stamps;
+    *call = (MemoCall){t, i, e->stamp, runtime_error_count};
+    return false;
+  }
+
+  t->misses += 1;
+  uint32_t i = take_entry(t);
+  struct MemoEntry* e = t->entries + i;
+  e->hash = hash;
+  e->stamp = ++t->stamps;
+  e->done = false;
+  Value* keys = entry_keys(t, i);
+  for (size_t k = 0; k < argc; ++k) {
+    keys[k] = args[k];
+  }
+  e->next = *bucket;
+  *bucket = i;
+  push_newest(t, i);
+
+  *call = (MemoCall){t, i, e->stamp, runtime_error_count};
+  return false;
+}
+
+void memo_store(const MemoCall* call, const Value* ret) {
+  if (!call->table || !is_key(*ret) || runtime_error_count != call->errors) return;
+
+  struct MemoEntry* e = call->table->entries + call->entry;
+  if (e->stamp != call->stamp) return;
+
+  e->result = *ret;
+  e->done = true;
+}
+
+void memo_report() {
+  for (size_t i = 0; i < tables.count; ++i) {
+    const struct MemoTable* t = tables.xs[i];
+    size_t cached = 0;
+    for (uint32_t k = 0; k < t->count; ++k) {
+      cached += t->entries[k].done;
+    }
+    fprintf(stderr, "[memo] " SV_Fmt ": %zu hits, %zu misses, %zu cached\n", SV_Fmt_arg(t->proto->name), t->hits, t->misses, cached);
+  }
+}
+
+void memo_free() {
+  for (size_t i = 0; i < tables.count; ++i) {
+    free(tables.xs[i]->keys);
+    free(tables.xs[i]->entries);
+    free(tables.xs[i]->buckets);
+    free(tables.xs[i]);
+  }
+  if (tables.capacity) vector_free(tables);
+  tables.last = NULL;
+}
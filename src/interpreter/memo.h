@@ -0,0 +1,33 @@
+#ifndef _MEMO_H
+#define _MEMO_H
+
+#include <stdint.h>
+#include "../types/value.h"
+
+// Results kept per pure function, the least recently used one is evicted past it
+#define MEMO_CAPACITY 4096
+
+struct MemoTable;
+
+// Call memo_lookup missed, its result is stored once it returns. The entry may be evicted
+// and reused by the calls it makes, the stamp tells
+typedef struct {
+  // NULL when the call isn't cached
+  struct MemoTable* table;
+  uint32_t entry;
+  uint32_t stamp;
+  // runtime_error_count when the call started, the result isn't cached if it reported errors
+  size_t errors;
+} MemoCall;
+
+// Looks the call of a pure function up in its cache, keyed on the args. Returns true with the cached
+// result on a hit. call is set on a miss when the args can be a key: doubles, bools, nil and strings
+bool memo_lookup(const FunctionValue* fn, const Value* args, size_t argc, Value* ret, MemoCall* call);
+// Caches the result of a call memo_lookup missed. Objects aren't cached, nor the results of
+// calls that reported runtime errors: they're reported again by the next call
+void memo_store(const MemoCall* call, const Value* ret);
+// Prints the hits and misses of the pure functions called so far to stderr
+void memo_report();
+void memo_free();
+
+#endif
@@ -7,12 +7,21 @@
 #include "../types/allocators/pool.h"
 #include "../types/vector.h"
 #include "../types/ref_count.h"
+#include "../resolver.h"
 #include "scope_ref.h"
 
 #define MAX_SCOPES 256
+#define MAX_LOCAL_SCOPES 4096
+#define LOCAL_VALUES_CAPACITY (1 << 16)
+
+// Scope and upvalues of a caller, restored once the call returns
+struct SidedScope {
+  ScopeRef scope;
+  struct Captures* captures;
+};
 
 struct SidedScopes {
-  ScopeRef* xs;
+  struct SidedScope* xs;
   size_t capacity;
   size_t count;
 };
@@ -20,8 +29,19 @@ struct SidedScopes {
 static uint64_t scope_ids = 0;
 static Pool scope_alloc;
 static ScopeRef curr_scope = {0};
+// Upvalues of the function being executed, borrowed from the callee value held by the call scope
+static struct Captures* curr_captures = NULL;
 static struct SidedScopes sided_scopes;
 
+// Scopes no closure can capture are taken from these stacks instead of the pool and the refcount
+// blocks. Their values are reserved when they're entered and released by moving the top back
+static struct {
+  Scope scopes[MAX_LOCAL_SCOPES];
+  size_t scope_count;
+  StoredValue values[LOCAL_VALUES_CAPACITY];
+  size_t value_count;
+} locals;
+
 static void scope_stats(const Scope* s) {
   assert(s && "Can't print NULL scope");
   printf("Scope [%llu] (%zu values) %p", s->id, s->count, s);
@@ -45,17 +65,23 @@ static void scope_stats(const Scope* s) {
 }
 
 ScopeRef scope_ref_acquire(ScopeRef ref) {
+  if (!ref.rc) return ref;
+
   ScopeRef acq;
   rc_acquire(ref, &acq);
   return acq;
 }
 
-ScopeRef scope_ref_get_current() { 
-  return scope_ref_acquire(curr_scope);
+void scope_ref_release(ScopeRef* ref) {
+  if (ref->rc) {
+    rc_release(ref);
+  } else {
+    *ref = (ScopeRef){0};
+  }
 }
 
-void scope_set_upper(ScopeRef ref, ScopeRef upper) {
-  rc_move(&ref.rsc->upper, &upper);
+ScopeRef scope_ref_get_current() { 
+  return scope_ref_acquire(curr_scope);
 }
 
 ScopeRef scope_create() {
@@ -73,6 +99,8 @@ ScopeRef scope_create() {
   pool_alloc(&scope_alloc, (void**)&newscope);
   newscope->id = scope_ids++;
   newscope->released_values = false;
+  newscope->local = false;
+  newscope->open_upvalues = NULL;
   vector_new(*newscope, ID_INITIAL_CAP); 
   newscope->upper.rc = NULL;
   newscope->upper.rsc = NULL;
@@ -83,9 +111,41 @@ ScopeRef scope_create() {
   return new_ref;
 }
 
-void scope_new() {
-  ScopeRef new_scope = scope_create();
+// Falls back to the pool when the local stacks are full
+static ScopeRef scope_create_for(ScopeLayout layout) {
+  if (layout.captured || locals.scope_count == MAX_LOCAL_SCOPES || LOCAL_VALUES_CAPACITY - locals.value_count < layout.size) {
+    return scope_create();
+  }
 
+  Scope* s = locals.scopes + locals.scope_count++;
+  s->id = scope_ids++;
+  s->released_values = false;
+  s->local = true;
+  s->open_upvalues = NULL;
+  s->upper = (ScopeRef){0};
+  s->xs = locals.values + locals.value_count;
+  s->count = 0;
+  s->capacity = layout.size;
+  locals.value_count += layout.size;
+
+  return (ScopeRef){s, NULL};
+}
+
+// Gives up the ref the current scope chain holds, its values are already released
+static void scope_drop(ScopeRef* ref) {
+  Scope* s = ref->rsc;
+  if (!s->local) {
+    rc_release(ref);
+    return;
+  }
+
+  assert(s == locals.scopes + locals.scope_count - 1 && "Local scopes are dropped in reverse order");
+  locals.value_count = (size_t)(s->xs - locals.values);
+  locals.scope_count -= 1;
+  *ref = (ScopeRef){0};
+}
+
+static void scope_push(ScopeRef new_scope) {
   if (curr_scope.rsc) {
     rc_move(&new_scope.rsc->upper, &curr_scope);
   } 
@@ -93,157 +153,265 @@ void scope_new() {
   rc_move(&curr_scope, &new_scope);
 }
 
-void scope_swap(ScopeRef new) {
-  if (!curr_scope.rsc) assert(false && "Attempted to scope swap with NULL curr_scope");
-  if (!new.rsc) assert(false && "Attempted to scope swap with NULL new scope");
+void scope_new() {
+  scope_push(scope_create());
+}
 
-  ScopeRef moved;
-  rc_move(&moved, &curr_scope);
-  vector_push(sided_scopes, moved);
-  rc_acquire(new, &curr_scope);
+void scope_enter_block(ScopeLayout layout) {
+  scope_push(scope_create_for(layout));
 }
 
-void scope_restore() {
-  assert(sided_scopes.count > 0 && "Attempted to scope_restore() without calling scope_swap first");
-  ScopeRef popped;
-  ScopeRef last_sided = sided_scopes.xs[sided_scopes.count - 1];
-  rc_move(&popped, &last_sided);
-  vector_pop(sided_scopes);
+// Call scopes have no upper scope, the function reaches the variables it captured through its upvalues
+void scope_enter_call(const FunctionValue* fn) {
+  assert(curr_scope.rsc && "Attempted to enter a call with NULL curr_scope");
+
+  struct SidedScope caller = {.captures = curr_captures};
+  rc_move(&caller.scope, &curr_scope);
+  vector_push(sided_scopes, caller);
 
-  rc_release(&curr_scope);
-  rc_move(&curr_scope, &popped);
+  curr_scope = scope_create_for(fn->proto->scope);
+  curr_captures = fn->captures;
 }
 
-static StoredValue* _scope_get_ident_recursive(Scope* s, StringView name) {
-  StoredValue* id = NULL;
+void scope_leave_call() {
+  assert(sided_scopes.count > 0 && "Attempted to leave a call that was never entered");
+  assert(!curr_scope.rsc->upper.rsc && "Attempted to leave a call with block scopes still open");
 
-  for (size_t i = 0; i < s->count; ++i) {
-    StoredValue* el = s->xs + i;
-    if (el->name.len == name.len) {
-      if (strncmp(el->name.str, name.str, name.len) == 0) {
-        id = el;
-      }
-    }
-  }
+  scope_release_values(curr_scope.rsc);
+  curr_scope.rsc->released_values = true;
+  scope_drop(&curr_scope);
 
-  if (0);
-  else if (id) return id;
-  else if (s->upper.rsc) return _scope_get_ident_recursive(s->upper.rsc, name);
-  else return NULL;
+  struct SidedScope* caller = sided_scopes.xs + sided_scopes.count - 1;
+  rc_move(&curr_scope, &caller->scope);
+  curr_captures = caller->captures;
+  vector_pop(sided_scopes);
 }
 
-static StoredValue* _scope_get_ident(Scope* s, StringView name) {
-  StoredValue* id = NULL;
+void scope_reenter_call(const FunctionValue* fn) {
+  assert(sided_scopes.count > 0 && "Attempted to reenter a call that was never entered");
+  assert(!curr_scope.rsc->upper.rsc && "Attempted to reenter a call with block scopes still open");
 
-  for (size_t i = 0; i < s->count; ++i) {
-    StoredValue* el = s->xs + i;
-    if (el->name.len == name.len) {
-      if (strncmp(el->name.str, name.str, name.len) == 0) {
-        id = el;
-      }
-    }
-  }
+  scope_release_values(curr_scope.rsc);
+  curr_scope.rsc->released_values = true;
+  scope_drop(&curr_scope);
 
-  if (id) return id;
-  else return NULL;
+  // The next function may need a bigger or a captured scope
+  curr_scope = scope_create_for(fn->proto->scope);
+  curr_captures = fn->captures;
 }
 
-static void scope_override_current() {
-  ScopeRef new_scope = scope_create();
-
-  if (curr_scope.rsc->upper.rsc) {
-    rc_move(&new_scope.rsc->upper, &curr_scope.rsc->upper);
-  } else {
-    rc_null(&new_scope.rsc->upper);
+static Scope* scope_walk_up(uint16_t depth) {
+  Scope* s = (Scope*)curr_scope.rsc;
+  for (uint16_t i = 0; i < depth && s; ++i) {
+    s = s->upper.rsc;
   }
 
-  for (size_t i = 0; i < curr_scope.rsc->count; ++i) {
-    StoredValue* val = curr_scope.rsc->xs + i;
-    vector_push(*new_scope.rsc, ((StoredValue){val->name, value_copy(&val->value)}));
-  }
+  return s;
+}
 
-  ScopeRef old;
-  rc_move(&old, &curr_scope);
-  rc_move(&curr_scope, &new_scope);
-  rc_release(&old);
+// Local scopes never grow past the slots the resolver counted
+static void scope_append(Scope* s, StoredValue value) {
+  if (s->local) {
+    assert(s->count < s->capacity && "Local scope defined past its layout");
+    s->xs[s->count++] = value;
+  } else {
+    vector_push(*s, value);
+  }
 }
 
-void scope_insert_into(ScopeRef scope, StringView name, const Value* value) {
+// Scopes are only ever appended to or updated in place.
+// A closure holds a ref to the scope it was created in, the resolver guarantees it
+// only reads slots declared before it so later declarations don't change what it sees
+void scope_define_into(ScopeRef scope, uint16_t slot, StringView name, const Value* value) {
   Scope* s = (Scope*)scope.rsc;
 
-  // Update existing identifier if it already exists
-  // as specified by lang spec
-  StoredValue* id_maybe = _scope_get_ident(s, name);
-  if (id_maybe) {
-    id_maybe->value = value_copy(value);
+  // Redefinition of a slot, happens when a declaration is evaluated more than once
+  if (slot < s->count) {
+    StoredValue* stored = s->xs + slot;
+    value_scopeexit(&stored->value);
+    stored->name = name;
+    stored->value = value_copy(value);
     return;
   }
 
+  // Slots of declarations that were skipped are left undefined
+  while (s->count < slot) {
+    scope_append(s, (StoredValue){{NULL, 0}, value_new_err()});
+  }
+
   StoredValue id = {
     .name = name,
     .value = value_copy(value),
   };
 
-  vector_push((*s), id);
+  scope_append(s, id);
 }
 
-bool scope_remove_from(ScopeRef scope, StringView name) {
-  bool should_remove = false;
-  size_t remove_idx = 0;
-  for (size_t i = 0; i < scope.rsc->count; ++i) {
-    StoredValue* v = scope.rsc->xs + i;
-    if (strncmp(v->name.str, name.str, name.len) == 0) {
-      remove_idx = i;
-      should_remove = true;
-      value_scopeexit(&v->value);
-      break;
+void scope_define(uint16_t slot, StringView name, const Value* value) {
+  scope_define_into(curr_scope, slot, name, value);
+}
+
+static ValueRef upvalue_get(const Upvalue* u) {
+  if (!u) return NULL;
+  if (!u->scope) return (ValueRef)&u->closed;
+
+  Scope* s = u->scope;
+  if (u->slot >= s->count || s->xs[u->slot].name.str == NULL) return NULL;
+  return &s->xs[u->slot].value;
+}
+
+static ValueRef scope_slot_ref(VarSlot at) {
+  if (at.depth == UPVALUE_DEPTH) {
+    return upvalue_get(curr_captures->xs[at.slot]);
+  }
+
+  Scope* s = scope_walk_up(at.depth);
+  if (!s || at.slot >= s->count) return NULL;
+
+  StoredValue* stored = s->xs + at.slot;
+  if (stored->name.str == NULL) return NULL;
+  return &stored->value;
+}
+
+bool scope_assign(VarSlot at, const Value* value) {
+  ValueRef stored = scope_slot_ref(at);
+  if (!stored) {
+    return false;
+  }
+
+  value_scopeexit(stored);
+  *stored = value_copy(value);
+  return true;
+}
+
+ValueRef scope_get_val_ref(VarSlot at) {
+  return scope_slot_ref(at);
+}
+
+Value scope_get_val_copy(VarSlot at) {
+  ValueRef v = scope_get_val_ref(at);
+  if (v) return value_copy(v);
+  else return value_new_err();
+}
+
+static Upvalue* upvalue_new() {
+  Upvalue* u = malloc(sizeof(Upvalue));
+  u->refs = 1;
+  u->scope = NULL;
+  u->slot = 0;
+  u->closed = value_new_nil();
+  u->next = NULL;
+  return u;
+}
+
+// Open upvalues are shared, every closure capturing the same variable sees the same value
+static Upvalue* scope_capture_slot(Scope* s, uint16_t slot) {
+  for (Upvalue* u = s->open_upvalues; u; u = u->next) {
+    if (u->slot == slot) {
+      u->refs += 1;
+      return u;
     }
   }
 
-  if (should_remove) {
-    vector_remove(*scope.rsc, remove_idx);
+  Upvalue* u = upvalue_new();
+  u->scope = s;
+  u->slot = slot;
+  u->next = s->open_upvalues;
+  s->open_upvalues = u;
+  return u;
+}
+
+static void upvalue_release(Upvalue* u) {
+  if (!u) return;
+
+  u->refs -= 1;
+  if (u->refs > 0) return;
+
+  if (u->scope) {
+    Upvalue** link = &u->scope->open_upvalues;
+    while (*link != u) link = &(*link)->next;
+    *link = u->next;
+  } else {
+    value_scopeexit(&u->closed);
   }
 
-  return should_remove;
+  free(u);
 }
 
-void scope_insert(StringView name, const Value* value) {
-  scope_override_current();
-  scope_insert_into(curr_scope, name, value);
+static void scope_close_upvalues(Scope* s) {
+  Upvalue* u = s->open_upvalues;
+  while (u) {
+    if (u->slot < s->count && s->xs[u->slot].name.str != NULL) {
+      u->closed = s->xs[u->slot].value;
+      s->xs[u->slot].value = value_new_nil();
+    } else {
+      u->closed = value_new_err();
+    }
+
+    Upvalue* next = u->next;
+    u->scope = NULL;
+    u->next = NULL;
+    u = next;
+  }
+
+  s->open_upvalues = NULL;
 }
 
-bool scope_replace(StringView name, const Value* value) {
-  scope_override_current();
+static struct Captures* captures_new(size_t count) {
+  struct Captures* c = malloc(sizeof(struct Captures) + count * sizeof(Upvalue*));
+  c->refs = 1;
+  c->count = count;
+  return c;
+}
 
-  Scope* s = (Scope*)curr_scope.rsc;
-  StoredValue* id_maybe = _scope_get_ident_recursive(s, name);
+struct Captures* scope_capture(const struct UpvalueDescs* descs) {
+  if (descs->count == 0) return NULL;
 
-  if (!id_maybe) {
-    return false;
+  struct Captures* c = captures_new(descs->count);
+  for (size_t i = 0; i < descs->count; ++i) {
+    const UpvalueDesc* desc = descs->xs + i;
+    switch (desc->kind) {
+      case UPVALUE_LOCAL:
+        c->xs[i] = scope_capture_slot(scope_walk_up(desc->from.depth), desc->from.slot);
+      break;
+      case UPVALUE_ENCLOSING:
+        c->xs[i] = curr_captures->xs[desc->from.slot];
+        if (c->xs[i]) c->xs[i]->refs += 1;
+      break;
+    }
   }
 
-  id_maybe->value = value_copy(value);
-  return true;
+  return c;
 }
 
+void scope_define_receiver(ScopeRef scope, const FunctionValue* fn, const struct Receiver* receiver) {
+  if (!receiver || value_type(receiver->this) != EVAL_TYPE_INSTANCE) {
+    receiver = fn->receiver;
+  }
+  if (!receiver) return;
 
-ValueRef scope_get_val_ref(StringView name) {
-  Scope* s = (Scope*)curr_scope.rsc;
-  StoredValue* id = _scope_get_ident_recursive(s, name);
-  if (id) return &(id->value);
-  else return NULL;
+  scope_define_into(scope, RECEIVER_SLOT(fn->proto->params.count), sv_new("this"), &receiver->this);
 }
 
-Value scope_get_val_copy(StringView name) {
-  Scope* s = (Scope*)curr_scope.rsc;
-  StoredValue* id = _scope_get_ident_recursive(s, name);
-  if (id) { 
-    return value_copy(&id->value);
+struct Captures* captures_acquire(struct Captures* c) {
+  if (c) c->refs += 1;
+  return c;
+}
+
+void captures_release(struct Captures* c) {
+  if (!c) return;
+
+  c->refs -= 1;
+  if (c->refs > 0) return;
+
+  for (size_t i = 0; i < c->count; ++i) {
+    upvalue_release(c->xs[i]);
   }
-  else return value_new_err();
+  free(c);
 }
 
-void scope_release_values(const Scope* scope) {
+void scope_release_values(Scope* scope) {
+  scope_close_upvalues(scope);
   for (size_t i = 0; i < scope->count; ++i) {
     StoredValue* v = scope->xs + i;
     value_scopeexit(&v->value);
@@ -262,7 +430,7 @@ void scope_pop() {
   } else {
     ScopeRef upper;
     rc_move(&upper, &curr_scope.rsc->upper);
-    rc_release(&curr_scope);
+    scope_drop(&curr_scope);
     rc_move(&curr_scope, &upper);
   }
 }
@@ -270,12 +438,12 @@ void scope_pop() {
 void scope_free(void* scope) {
   Scope* s = (Scope*)scope;
   if (!s) return;
-  if (s->upper.rsc) rc_release(&s->upper);
+  if (s->upper.rsc) scope_ref_release(&s->upper);
 
   if (!s->released_values) {
     scope_release_values(s);
   }
 
-  pool_free(&scope_alloc, s);
   vector_free(*s);
+  pool_free(&scope_alloc, s);
 }
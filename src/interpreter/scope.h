@@ -16,7 +16,11 @@ typedef struct Scope Scope;
 struct Scope {
   uint64_t id;
   bool released_values;
+  // lives on the local scopes stack instead of the pool, its values are reserved on the values stack
+  bool local;
   ScopeRef upper;
+  // upvalues still reading values of this scope
+  Upvalue* open_upvalues;
 
   // dynamic array data for storedvalues, should be in its own datastructure
   size_t capacity;
@@ -27,17 +31,29 @@ struct Scope {
 ScopeRef scope_ref_get_current();
 ScopeRef scope_create();
 ScopeRef scope_ref_acquire(ScopeRef ref);
-void scope_set_upper(ScopeRef ref, ScopeRef upper);
+// Local scopes aren't refcounted, their refs are only borrowed
+void scope_ref_release(ScopeRef* ref);
 void scope_new();
-void scope_swap(ScopeRef new);
-void scope_insert_into(ScopeRef scope, StringView name, const Value* value);
-bool scope_remove_from(ScopeRef scope, StringView name);
-void scope_insert(StringView name, const Value* value);
-bool scope_replace(StringView name, const Value* value);
-ValueRef scope_get_val_ref(StringView name);
-Value scope_get_val_copy(StringView name);
+// Scope of a block, local unless the resolver found it captured
+void scope_enter_block(ScopeLayout layout);
+void scope_enter_call(const FunctionValue* fn);
+void scope_leave_call();
+// Replaces the current call scope for a tail call, the caller's scope isn't restored
+void scope_reenter_call(const FunctionValue* fn);
+void scope_define_into(ScopeRef scope, uint16_t slot, StringView name, const Value* value);
+void scope_define(uint16_t slot, StringView name, const Value* value);
+// Defines 'this' after the parameters of a method. receiver is the one of a method invocation,
+// the function's bound receiver is used when it's NULL or holds no instance
+void scope_define_receiver(ScopeRef scope, const FunctionValue* fn, const struct Receiver* receiver);
+bool scope_assign(VarSlot at, const Value* value);
+ValueRef scope_get_val_ref(VarSlot at);
+Value scope_get_val_copy(VarSlot at);
+void scope_release_values(Scope* scope);
 void scope_pop();
-void scope_restore();
 void scope_free(void* scope);
 
+struct Captures* scope_capture(const struct UpvalueDescs* descs);
+struct Captures* captures_acquire(struct Captures* c);
+void captures_release(struct Captures* c);
+
 #endif
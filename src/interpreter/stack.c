@@ -7,14 +7,8 @@ Stack stack_new() {
   return s;
 }
 
-void stack_push(Stack* s, const StackValue* value) {
-  vector_push(*s, *value);
-}
-
-StackValue stack_pop(Stack* s) {
-  StackValue value = s->xs[s->count - 1]; 
-  vector_pop(*s);
-  return value;
+void stack_free(Stack* s) {
+  vector_free(*s);
 }
 
 size_t stack_count(Stack* s) {
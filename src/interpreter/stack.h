@@ -2,6 +2,7 @@
 #define _STACK_H
 
 #include "../types/value.h"
+#include "../types/vector.h"
 
 #define STACK_CAPACITY 1024
 
@@ -14,8 +15,24 @@ typedef struct {
 } Stack;
 
 Stack stack_new();
-StackValue stack_pop(Stack* s);
-void stack_push(Stack* s, const StackValue* value);
+void stack_free(Stack* s);
 size_t stack_count(Stack* s);
 
+// Push/pop/peek sit on the VM's hot path, they are kept inlinable
+
+static inline void stack_push(Stack* s, const StackValue* value) {
+  vector_push(*s, *value);
+}
+
+static inline StackValue stack_pop(Stack* s) {
+  StackValue value = s->xs[s->count - 1]; 
+  vector_pop(*s);
+  return value;
+}
+
+// distance 0 is the top of the stack
+static inline StackValue* stack_peek(Stack* s, size_t distance) {
+  return s->xs + s->count - 1 - distance;
+}
+
 #endif
@@ -0,0 +1,502 @@
+#include "jit.h"
+#include "parser.h"
+#include "resolver.h"
+#include "launch_context.h"
+#include "jit/x64.h"
+#include "types/statements.h"
+#include "types/expressions.h"
+#include "types/token.h"
+#include "types/vector.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+typedef double (*JitFn)(const double* args);
+
+// Call count and compiled code of a function body
+struct JitEntry {
+  Statement* body;
+  size_t calls;
+  JitFn native;
+  size_t size;
+  // The body uses something the templates don't handle, it stays interpreted
+  bool rejected;
+};
+
+struct JitTable {
+  struct JitEntry* xs;
+  size_t count;
+  size_t capacity;
+};
+
+static struct JitTable table = {0};
+
+// Static type of a compiled expression or local, booleans are held as 0.0 and 1.0
+enum JitType {
+  JIT_INVALID,
+  JIT_DOUBLE,
+  JIT_BOOL,
+  // The callee slot, only usable to call the function recursively
+  JIT_CALLEE,
+};
+
+struct JitLocal {
+  enum JitType type;
+  int32_t disp;
+};
+
+struct JitLocals {
+  struct JitLocal* xs;
+  size_t count;
+  size_t capacity;
+};
+
+// Mirrors the scopes the interpreter would create for the body,
+// the call scope comes first and maps every declared slot to a stack location
+struct JitScopes {
+  struct JitLocals* xs;
+  size_t count;
+  size_t capacity;
+};
+
+struct JitCompiler {
+  X64Code code;
+  struct JitScopes scopes;
+  size_t num_params;
+  size_t num_locals;
+  // Offset of the body, after the params are loaded, tail calls jump back to it
+  size_t body_start;
+};
+
+static enum JitType compile_expression(struct JitCompiler* c, Expression* expr);
+static bool compile_statement(struct JitCompiler* c, Statement* stmt);
+
+static void scope_push(struct JitCompiler* c) {
+  struct JitLocals locals;
+  vector_new(locals, 8);
+  vector_push(c->scopes, locals);
+}
+
+static void scope_pop(struct JitCompiler* c) {
+  vector_free(c->scopes.xs[c->scopes.count - 1]);
+  vector_pop(c->scopes);
+}
+
+static const struct JitLocal* lookup(struct JitCompiler* c, VarSlot var) {
+  if (var.depth == UPVALUE_DEPTH || var.depth >= c->scopes.count) return NULL;
+
+  struct JitLocals* locals = c->scopes.xs + c->scopes.count - 1 - var.depth;
+  if (var.slot >= locals->count || locals->xs[var.slot].type == JIT_INVALID) return NULL;
+
+  return locals->xs + var.slot;
+}
+
+static const struct JitLocal* define(struct JitCompiler* c, uint16_t slot, enum JitType type) {
+  struct JitLocals* locals = c->scopes.xs + c->scopes.count - 1;
+  while (locals->count <= slot) {
+    vector_push(*locals, ((struct JitLocal){JIT_INVALID, 0}));
+  }
+
+  c->num_locals += 1;
+  locals->xs[slot] = (struct JitLocal){type, -8 * (int32_t)c->num_locals};
+  return locals->xs + slot;
+}
+
+static enum JitType compile_literal(struct JitCompiler* c, Expression* expr) {
+  Token* literal = &expr->literal;
+
+  switch (literal->type) {
+    case TOKEN_TYPE_NUMBER:
+      x64_load_double(&c->code, value_as_double(parser_constants()[expr->constant]));
+      return JIT_DOUBLE;
+    case TOKEN_TYPE_IDENTIFIER: {
+      const struct JitLocal* local = lookup(c, expr->var);
+      if (!local || local->type == JIT_CALLEE) return JIT_INVALID;
+
+      x64_load_local(&c->code, local->disp);
+      return local->type;
+    }
+    default:
+      return JIT_INVALID;
+  }
+}
+
+// true and false are parsed as static expressions, the optimizer folds numbers into them
+static enum JitType compile_static(struct JitCompiler* c, Expression* expr) {
+  switch (value_type(expr->evaluated)) {
+    case EVAL_TYPE_DOUBLE:
+      x64_load_double(&c->code, value_as_double(expr->evaluated));
+      return JIT_DOUBLE;
+    case EVAL_TYPE_BOOL:
+      x64_load_double(&c->code, value_as_bool(expr->evaluated) ? 1.0 : 0.0);
+      return JIT_BOOL;
+    default:
+      return JIT_INVALID;
+  }
+}
+
+static enum JitType compile_unary(struct JitCompiler* c, Expression* expr) {
+  enum JitType child = compile_expression(c, expr->unary.child);
+
+  switch (expr->unary.operator.type) {
+    case TOKEN_TYPE_MINUS:
+      if (child != JIT_DOUBLE) return JIT_INVALID;
+      x64_negate(&c->code);
+      return JIT_DOUBLE;
+    case TOKEN_TYPE_BANG:
+      if (child != JIT_BOOL) return JIT_INVALID;
+      x64_not(&c->code);
+      return JIT_BOOL;
+    default:
+      return JIT_INVALID;
+  }
+}
+
+static enum JitType compile_logical(struct JitCompiler* c, Expression* expr) {
+  bool is_or = expr->binary.operator.keyword == RESERVED_KEYWORD_OR;
+
+  if (compile_expression(c, expr->binary.left) != JIT_BOOL) return JIT_INVALID;
+
+  // The left operand is the result when it short circuits
+  x64_test_bool(&c->code);
+  size_t short_circuit = x64_jump(&c->code, is_or ? X64_JUMP_IF_NOT_ZERO : X64_JUMP_IF_ZERO);
+  if (compile_expression(c, expr->binary.right) != JIT_BOOL) return JIT_INVALID;
+  x64_patch_jump(&c->code, short_circuit);
+
+  return JIT_BOOL;
+}
+
+static enum JitType compile_binary(struct JitCompiler* c, Expression* expr) {
+  Token* op = &expr->binary.operator;
+  if (op->type == TOKEN_TYPE_KEYWORD) {
+    return compile_logical(c, expr);
+  }
+
+  if (compile_expression(c, expr->binary.left) != JIT_DOUBLE) return JIT_INVALID;
+  x64_push(&c->code);
+  if (compile_expression(c, expr->binary.right) != JIT_DOUBLE) return JIT_INVALID;
+  x64_pop_left(&c->code);
+
+  switch (op->type) {
+    case TOKEN_TYPE_PLUS: x64_arith(&c->code, X64_ADD); return JIT_DOUBLE;
+    case TOKEN_TYPE_MINUS: x64_arith(&c->code, X64_SUB); return JIT_DOUBLE;
+    case TOKEN_TYPE_STAR: x64_arith(&c->code, X64_MUL); return JIT_DOUBLE;
+    case TOKEN_TYPE_SLASH: x64_arith(&c->code, X64_DIV); return JIT_DOUBLE;
+    case TOKEN_TYPE_LESS: x64_compare(&c->code, X64_LESS); return JIT_BOOL;
+    case TOKEN_TYPE_LESS_EQUAL: x64_compare(&c->code, X64_LESS_EQUAL); return JIT_BOOL;
+    case TOKEN_TYPE_GREATER: x64_compare(&c->code, X64_GREATER); return JIT_BOOL;
+    case TOKEN_TYPE_GREATER_EQUAL: x64_compare(&c->code, X64_GREATER_EQUAL); return JIT_BOOL;
+    case TOKEN_TYPE_EQUAL_EQUAL: x64_compare(&c->code, X64_EQUAL); return JIT_BOOL;
+    case TOKEN_TYPE_BANG_EQUAL: x64_compare(&c->code, X64_NOT_EQUAL); return JIT_BOOL;
+    default: return JIT_INVALID;
+  }
+}
+
+static enum JitType compile_assignment(struct JitCompiler* c, Expression* expr) {
+  const struct JitLocal* local = lookup(c, expr->var);
+  if (!local || local->type == JIT_CALLEE) return JIT_INVALID;
+
+  // Locals keep the type they were declared with
+  if (compile_expression(c, expr->assignment.right) != local->type) return JIT_INVALID;
+  x64_store_local(&c->code, local->disp);
+
+  return local->type;
+}
+
+// Only recursive calls are compiled, their args are left pushed
+static bool compile_call_args(struct JitCompiler* c, Expression* expr) {
+  Expression* callee = expr->call.callee;
+  if (callee->type != EXPRESSION_LITERAL || callee->literal.type != TOKEN_TYPE_IDENTIFIER) return false;
+
+  const struct JitLocal* local = lookup(c, callee->var);
+  if (!local || local->type != JIT_CALLEE) return false;
+  if (expr->call.args.count != c->num_params) return false;
+
+  for (size_t i = 0; i < expr->call.args.count; ++i) {
+    if (compile_expression(c, expr->call.args.xs[i]) != JIT_DOUBLE) return false;
+    x64_push(&c->code);
+  }
+  return true;
+}
+
+static enum JitType compile_call(struct JitCompiler* c, Expression* expr) {
+  if (!compile_call_args(c, expr)) return JIT_INVALID;
+
+  x64_call(&c->code, 0, expr->call.args.count);
+  return JIT_DOUBLE;
+}
+
+// Recursive calls in tail position overwrite the params and jump back to the body
+static bool compile_tail_call(struct JitCompiler* c, Expression* expr) {
+  if (!compile_call_args(c, expr)) return false;
+
+  for (size_t i = c->num_params; i > 0; --i) {
+    x64_pop(&c->code);
+    x64_store_local(&c->code, c->scopes.xs[0].xs[CALLEE_SLOT + i].disp);
+  }
+  x64_jump_back(&c->code, c->body_start);
+  return true;
+}
+
+static enum JitType compile_expression(struct JitCompiler* c, Expression* expr) {
+  switch (expr->type) {
+    case EXPRESSION_LITERAL:
+      return compile_literal(c, expr);
+    case EXPRESSION_STATIC:
+      return compile_static(c, expr);
+    case EXPRESSION_GROUP:
+      return compile_expression(c, expr->group.child);
+    case EXPRESSION_UNARY:
+      return compile_unary(c, expr);
+    case EXPRESSION_BINARY:
+      return compile_binary(c, expr);
+    case EXPRESSION_ASSIGNMENT:
+      return compile_assignment(c, expr);
+    case EXPRESSION_CALL:
+      return compile_call(c, expr);
+    default:
+      return JIT_INVALID;
+  }
+}
+
+// A declaration as the direct branch of an if or while may be skipped at runtime
+static bool compile_branch(struct JitCompiler* c, Statement* branch) {
+  if (branch->type == STATEMENT_VAR_DECL) return false;
+  return compile_statement(c, branch);
+}
+
+static bool compile_conditional(struct JitCompiler* c, Statement* stmt) {
+  struct {
+    size_t* xs;
+    size_t count;
+    size_t capacity;
+  } exits;
+  vector_new(exits, stmt->cond.count);
+
+  bool ok = true;
+  for (size_t i = 0; ok && i < stmt->cond.count; ++i) {
+    struct ConditionalBlock* b = stmt->cond.xs + i;
+
+    if (b->condition == NULL) {
+      ok = compile_branch(c, b->branch);
+      break;
+    }
+
+    if (compile_expression(c, b->condition) != JIT_BOOL) {
+      ok = false;
+      break;
+    }
+    x64_test_bool(&c->code);
+    size_t next = x64_jump(&c->code, X64_JUMP_IF_ZERO);
+    ok = compile_branch(c, b->branch);
+    vector_push(exits, x64_jump(&c->code, X64_JUMP));
+    x64_patch_jump(&c->code, next);
+  }
+
+  for (size_t i = 0; i < exits.count; ++i) {
+    x64_patch_jump(&c->code, exits.xs[i]);
+  }
+  vector_free(exits);
+
+  return ok;
+}
+
+static bool compile_while(struct JitCompiler* c, Statement* stmt) {
+  size_t top = c->code.count;
+  if (compile_expression(c, stmt->while_loop.condition) != JIT_BOOL) return false;
+
+  x64_test_bool(&c->code);
+  size_t exit = x64_jump(&c->code, X64_JUMP_IF_ZERO);
+  if (!compile_branch(c, stmt->while_loop.body)) return false;
+  x64_jump_back(&c->code, top);
+  x64_patch_jump(&c->code, exit);
+
+  return true;
+}
+
+static bool compile_statements(struct JitCompiler* c, StatementBlock* block) {
+  for (size_t i = 0; i < block->count; ++i) {
+    if (!compile_statement(c, block->xs + i)) return false;
+  }
+  return true;
+}
+
+static bool compile_statement(struct JitCompiler* c, Statement* stmt) {
+  switch (stmt->type) {
+    case STATEMENT_EXPR:
+      return compile_expression(c, stmt->expr) != JIT_INVALID;
+    case STATEMENT_VAR_DECL: {
+      enum JitType type = compile_expression(c, stmt->var_decl.expr);
+      if (type != JIT_DOUBLE && type != JIT_BOOL) return false;
+
+      const struct JitLocal* local = define(c, stmt->var_decl.slot, type);
+      x64_store_local(&c->code, local->disp);
+      return true;
+    }
+    case STATEMENT_BLOCK: {
+      scope_push(c);
+      bool ok = compile_statements(c, &stmt->block);
+      scope_pop(c);
+      return ok;
+    }
+    case STATEMENT_CONDITIONAL:
+      return compile_conditional(c, stmt);
+    case STATEMENT_WHILE:
+      return compile_while(c, stmt);
+    case STATEMENT_RETURN:
+      if (stmt->ret->type == EXPRESSION_CALL && stmt->ret->call.is_tail) {
+        return compile_tail_call(c, stmt->ret);
+      }
+      if (compile_expression(c, stmt->ret) != JIT_DOUBLE) return false;
+      x64_return(&c->code);
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Falling off the end of a body returns nil, compiled bodies must always return a double
+static bool always_returns(Statement* stmt) {
+  switch (stmt->type) {
+    case STATEMENT_RETURN:
+      return true;
+    case STATEMENT_BLOCK:
+      for (size_t i = 0; i < stmt->block.count; ++i) {
+        if (always_returns(stmt->block.xs + i)) return true;
+      }
+      return false;
+    case STATEMENT_CONDITIONAL: {
+      struct ConditionalBlock* last = stmt->cond.xs + stmt->cond.count - 1;
+      if (last->condition != NULL) return false;
+
+      for (size_t i = 0; i < stmt->cond.count; ++i) {
+        if (!always_returns(stmt->cond.xs[i].branch)) return false;
+      }
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+static bool compile(struct JitEntry* entry, size_t num_params) {
+  if (num_params > JIT_MAX_PARAMS || !always_returns(entry->body)) return false;
+
+  struct JitCompiler c = {
+    .num_params = num_params,
+    .num_locals = 0,
+  };
+  x64_new(&c.code);
+  vector_new(c.scopes, 8);
+
+  // The body shares the call scope holding the callee and params.
+  // Args are passed in reverse order, the last one first in memory
+  scope_push(&c);
+  size_t frame_size = x64_prologue(&c.code);
+  define(&c, CALLEE_SLOT, JIT_CALLEE);
+  for (size_t i = 0; i < num_params; ++i) {
+    x64_load_slot(&c.code, 8 * (int32_t)(num_params - 1 - i));
+    const struct JitLocal* param = define(&c, CALLEE_SLOT + 1 + i, JIT_DOUBLE);
+    x64_store_local(&c.code, param->disp);
+  }
+  c.body_start = c.code.count;
+
+  bool ok = compile_statements(&c, &entry->body->block);
+  x64_patch_frame_size(&c.code, frame_size, 8 * (uint32_t)c.num_locals);
+
+  while (c.scopes.count > 0) {
+    scope_pop(&c);
+  }
+  vector_free(c.scopes);
+
+  if (ok) {
+    entry->native = (JitFn)x64_finalize(&c.code);
+    entry->size = c.code.count;
+    ok = entry->native != NULL;
+  }
+
+  x64_free(&c.code);
+  return ok;
+}
+
+static size_t table_hash(const Statement* body, size_t capacity) {
+  uintptr_t h = (uintptr_t)body;
+  h ^= h >> 17;
+  h *= 0x9E3779B97F4A7C15ull;
+  return (size_t)(h >> 7) & (capacity - 1);
+}
+
+static struct JitEntry* table_slot(struct JitTable* t, Statement* body) {
+  size_t idx = table_hash(body, t->capacity);
+  while (t->xs[idx].body && t->xs[idx].body != body) idx = (idx + 1) & (t->capacity - 1);
+  return t->xs + idx;
+}
+
+static struct JitEntry* table_find(Statement* body) {
+  if (table.capacity == 0) {
+    table.capacity = 64;
+    table.xs = calloc(table.capacity, sizeof(struct JitEntry));
+  }
+
+  struct JitEntry* entry = table_slot(&table, body);
+  if (entry->body) return entry;
+
+  // Keep the table at most half full
+  if ((table.count + 1) * 2 > table.capacity) {
+    struct JitTable grown = {
+      .count = table.count,
+      .capacity = table.capacity * 2,
+    };
+    grown.xs = calloc(grown.capacity, sizeof(struct JitEntry));
+
+    for (size_t i = 0; i < table.capacity; ++i) {
+      if (table.xs[i].body) *table_slot(&grown, table.xs[i].body) = table.xs[i];
+    }
+
+    free(table.xs);
+    table = grown;
+    entry = table_slot(&table, body);
+  }
+
+  entry->body = body;
+  table.count += 1;
+  return entry;
+}
+
+bool jit_call(const FunctionValue* fn, const Value* args, size_t argc, Value* ret) {
+  if (!JIT_SUPPORTED || !launch_ctx_get()->jit || argc != fn->proto->params.count) return false;
+  // Pure functions are memoized, their native recursive calls would bypass the cache
+  if (fn->proto->pure) return false;
+
+  struct JitEntry* entry = table_find(fn->proto->body);
+  if (entry->rejected) return false;
+
+  if (!entry->native) {
+    entry->calls += 1;
+    if (entry->calls < JIT_CALL_THRESHOLD) return false;
+
+    if (!compile(entry, argc)) {
+      entry->rejected = true;
+      return false;
+    }
+  }
+
+  // Guard the parameter types, anything but doubles runs in the interpreter
+  double native_args[JIT_MAX_PARAMS];
+  for (size_t i = 0; i < argc; ++i) {
+    if (value_type(args[i]) != EVAL_TYPE_DOUBLE) return false;
+    native_args[argc - 1 - i] = value_as_double(args[i]);
+  }
+
+  *ret = value_new_double(entry->native(native_args));
+  return true;
+}
+
+void jit_free() {
+  for (size_t i = 0; i < table.capacity; ++i) {
+    if (table.xs[i].native) x64_release((void*)table.xs[i].native, table.xs[i].size);
+  }
+
+  free(table.xs);
+  table = (struct JitTable){0};
+}
@@ -0,0 +1,22 @@
+#ifndef _JIT_H
+#define _JIT_H
+
+#include "types/value.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+// Calls to a function before its body gets compiled to machine code
+#define JIT_CALL_THRESHOLD 100
+#define JIT_MAX_PARAMS 16
+
+// Runs the call natively once the function is hot and its body only deals with doubles and booleans.
+// Returns false when the interpreter must run the call itself, args are left untouched
+bool jit_call(const FunctionValue* fn, const Value* args, size_t argc, Value* ret);
+// Releases the compiled code
+void jit_free();
+
+#endif
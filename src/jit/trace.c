@@ -0,0 +1,598 @@
+#include "trace.h"
+#include "x64.h"
+#include "../jit.h"
+#include "../parser.h"
+#include "../launch_context.h"
+#include "../interpreter/scope.h"
+#include "../types/expressions.h"
+#include "../types/token.h"
+#include "../types/vector.h"
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct TraceTable {
+  Trace** xs;
+  size_t count;
+  size_t capacity;
+};
+
+static struct TraceTable table = {0};
+
+struct RecordedBranch {
+  Statement* cond;
+  size_t taken;
+};
+
+static struct {
+  Trace* trace;
+  struct {
+    struct RecordedBranch* xs;
+    size_t count;
+    size_t capacity;
+  } branches;
+} recording = {0};
+
+struct TraceSlot {
+  bool defined;
+  enum ValueType type;
+  size_t index;
+  StringView name;
+};
+
+struct TraceScope {
+  struct TraceSlot* xs;
+  size_t count;
+  size_t capacity;
+};
+
+struct TraceCompiler {
+  X64Code code;
+  Trace* trace;
+  // Scopes of the blocks entered by the trace, innermost last
+  struct {
+    struct TraceScope* xs;
+    size_t count;
+    size_t capacity;
+  } scopes;
+  // Statements being compiled, snapshotted by every guard
+  struct {
+    struct TraceFrame* xs;
+    size_t count;
+    size_t capacity;
+  } frames;
+  // Guard jumps to patch with their exit stub, parallel to the trace exits
+  struct {
+    size_t* xs;
+    size_t count;
+    size_t capacity;
+  } exit_jumps;
+};
+
+// To stderr, the dumps don't mix with the program's output
+static void dump(const char* fmt, ...) {
+  if (!launch_ctx_get()->dump_traces) return;
+
+  va_list args;
+  va_start(args, fmt);
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+}
+
+static enum ValueType compile_expression(struct TraceCompiler* c, Expression* expr);
+static bool compile_statement(struct TraceCompiler* c, Statement* stmt);
+
+static const char* type_name(enum ValueType type) {
+  return type == EVAL_TYPE_BOOL ? "bool" : "double";
+}
+
+// Finds the slot of a variable, those declared outside of the body are registered on first use
+static bool resolve_var(struct TraceCompiler* c, VarSlot var, StringView name, struct TraceSlot* out) {
+  if (var.depth != UPVALUE_DEPTH && var.depth < c->scopes.count) {
+    struct TraceScope* scope = c->scopes.xs + c->scopes.count - 1 - var.depth;
+    if (var.slot >= scope->count || !scope->xs[var.slot].defined) return false;
+
+    *out = scope->xs[var.slot];
+    return true;
+  }
+
+  VarSlot outer = var;
+  if (outer.depth != UPVALUE_DEPTH) outer.depth -= c->scopes.count;
+
+  Trace* t = c->trace;
+  for (size_t i = 0; i < t->vars.count; ++i) {
+    if (t->vars.xs[i].var.depth == outer.depth && t->vars.xs[i].var.slot == outer.slot) {
+      *out = (struct TraceSlot){true, t->vars.xs[i].type, t->vars.xs[i].index, {0}};
+      return true;
+    }
+  }
+
+  // The walker stands at the loop head, the current value gives the type to specialize on
+  ValueRef current = scope_get_val_ref(outer);
+  if (!current || (value_type(*current) != EVAL_TYPE_DOUBLE && value_type(*current) != EVAL_TYPE_BOOL)) return false;
+
+  struct TraceVar tv = {outer, value_type(*current), t->num_slots++};
+  vector_push(t->vars, tv);
+  dump("  outer  [%zu] "SV_Fmt" %s\n", tv.index, SV_Fmt_arg(name), type_name(tv.type));
+
+  *out = (struct TraceSlot){true, tv.type, tv.index, {0}};
+  return true;
+}
+
+static struct TraceSlot define(struct TraceCompiler* c, uint16_t slot, StringView name, enum ValueType type) {
+  struct TraceScope* scope = c->scopes.xs + c->scopes.count - 1;
+  while (scope->count <= slot) {
+    vector_push(*scope, ((struct TraceSlot){0}));
+  }
+
+  scope->xs[slot] = (struct TraceSlot){true, type, c->trace->num_slots++, name};
+  return scope->xs[slot];
+}
+
+// Conditions may be evaluated again by the walker after a side exit
+static bool is_pure(Expression* expr) {
+  switch (expr->type) {
+    case EXPRESSION_LITERAL:
+    case EXPRESSION_STATIC:
+      return true;
+    case EXPRESSION_GROUP:
+      return is_pure(expr->group.child);
+    case EXPRESSION_UNARY:
+      return is_pure(expr->unary.child);
+    case EXPRESSION_BINARY:
+      return is_pure(expr->binary.left) && is_pure(expr->binary.right);
+    default:
+      return false;
+  }
+}
+
+static enum ValueType compile_literal(struct TraceCompiler* c, Expression* expr) {
+  Token* literal = &expr->literal;
+
+  switch (literal->type) {
+    case TOKEN_TYPE_NUMBER: {
+      double value = value_as_double(parser_constants()[expr->constant]);
+      x64_load_double(&c->code, value);
+      dump("  const  %g\n", value);
+      return EVAL_TYPE_DOUBLE;
+    }
+    case TOKEN_TYPE_IDENTIFIER: {
+      struct TraceSlot slot;
+      if (!resolve_var(c, expr->var, literal->lexeme, &slot)) return EVAL_TYPE_ERR;
+
+      x64_load_slot(&c->code, 8 * (int32_t)slot.index);
+      dump("  load   [%zu] "SV_Fmt"\n", slot.index, SV_Fmt_arg(literal->lexeme));
+      return slot.type;
+    }
+    default:
+      return EVAL_TYPE_ERR;
+  }
+}
+
+// true and false are parsed as static expressions, the optimizer folds numbers into them
+static enum ValueType compile_static(struct TraceCompiler* c, Expression* expr) {
+  switch (value_type(expr->evaluated)) {
+    case EVAL_TYPE_DOUBLE:
+      x64_load_double(&c->code, value_as_double(expr->evaluated));
+      dump("  const  %g\n", value_as_double(expr->evaluated));
+      return EVAL_TYPE_DOUBLE;
+    case EVAL_TYPE_BOOL:
+      x64_load_double(&c->code, value_as_bool(expr->evaluated) ? 1.0 : 0.0);
+      dump("  const  %s\n", value_as_bool(expr->evaluated) ? "true" : "false");
+      return EVAL_TYPE_BOOL;
+    default:
+      return EVAL_TYPE_ERR;
+  }
+}
+
+static enum ValueType compile_unary(struct TraceCompiler* c, Expression* expr) {
+  enum ValueType child = compile_expression(c, expr->unary.child);
+
+  switch (expr->unary.operator.type) {
+    case TOKEN_TYPE_MINUS:
+      if (child != EVAL_TYPE_DOUBLE) return EVAL_TYPE_ERR;
+      x64_negate(&c->code);
+      dump("  neg\n");
+      return EVAL_TYPE_DOUBLE;
+    case TOKEN_TYPE_BANG:
+      if (child != EVAL_TYPE_BOOL) return EVAL_TYPE_ERR;
+      x64_not(&c->code);
+      dump("  not\n");
+      return EVAL_TYPE_BOOL;
+    default:
+      return EVAL_TYPE_ERR;
+  }
+}
+
+static enum ValueType compile_logical(struct TraceCompiler* c, Expression* expr) {
+  bool is_or = expr->binary.operator.keyword == RESERVED_KEYWORD_OR;
+
+  if (compile_expression(c, expr->binary.left) != EVAL_TYPE_BOOL) return EVAL_TYPE_ERR;
+
+  // The left operand is the result when it short circuits
+  x64_test_bool(&c->code);
+  size_t short_circuit = x64_jump(&c->code, is_or ? X64_JUMP_IF_NOT_ZERO : X64_JUMP_IF_ZERO);
+  dump("  %s\n", is_or ? "or" : "and");
+  if (compile_expression(c, expr->binary.right) != EVAL_TYPE_BOOL) return EVAL_TYPE_ERR;
+  x64_patch_jump(&c->code, short_circuit);
+
+  return EVAL_TYPE_BOOL;
+}
+
+static enum ValueType compile_binary(struct TraceCompiler* c, Expression* expr) {
+  Token* op = &expr->binary.operator;
+  if (op->type == TOKEN_TYPE_KEYWORD) {
+    return compile_logical(c, expr);
+  }
+
+  if (compile_expression(c, expr->binary.left) != EVAL_TYPE_DOUBLE) return EVAL_TYPE_ERR;
+  x64_push(&c->code);
+  if (compile_expression(c, expr->binary.right) != EVAL_TYPE_DOUBLE) return EVAL_TYPE_ERR;
+  x64_pop_left(&c->code);
+  dump("  "SV_Fmt"\n", SV_Fmt_arg(op->lexeme));
+
+  switch (op->type) {
+    case TOKEN_TYPE_PLUS: x64_arith(&c->code, X64_ADD); return EVAL_TYPE_DOUBLE;
+    case TOKEN_TYPE_MINUS: x64_arith(&c->code, X64_SUB); return EVAL_TYPE_DOUBLE;
+    case TOKEN_TYPE_STAR: x64_arith(&c->code, X64_MUL); return EVAL_TYPE_DOUBLE;
+    case TOKEN_TYPE_SLASH: x64_arith(&c->code, X64_DIV); return EVAL_TYPE_DOUBLE;
+    case TOKEN_TYPE_LESS: x64_compare(&c->code, X64_LESS); return EVAL_TYPE_BOOL;
+    case TOKEN_TYPE_LESS_EQUAL: x64_compare(&c->code, X64_LESS_EQUAL); return EVAL_TYPE_BOOL;
+    case TOKEN_TYPE_GREATER: x64_compare(&c->code, X64_GREATER); return EVAL_TYPE_BOOL;
+    case TOKEN_TYPE_GREATER_EQUAL: x64_compare(&c->code, X64_GREATER_EQUAL); return EVAL_TYPE_BOOL;
+    case TOKEN_TYPE_EQUAL_EQUAL: x64_compare(&c->code, X64_EQUAL); return EVAL_TYPE_BOOL;
+    case TOKEN_TYPE_BANG_EQUAL: x64_compare(&c->code, X64_NOT_EQUAL); return EVAL_TYPE_BOOL;
+    default: return EVAL_TYPE_ERR;
+  }
+}
+
+static enum ValueType compile_assignment(struct TraceCompiler* c, Expression* expr) {
+  struct TraceSlot slot;
+  if (!resolve_var(c, expr->var, expr->assignment.name.lexeme, &slot)) return EVAL_TYPE_ERR;
+
+  // Slots keep the type they were specialized on
+  if (compile_expression(c, expr->assignment.right) != slot.type) return EVAL_TYPE_ERR;
+  x64_store_slot(&c->code, 8 * (int32_t)slot.index);
+  dump("  store  [%zu] "SV_Fmt"\n", slot.index, SV_Fmt_arg(expr->assignment.name.lexeme));
+
+  return slot.type;
+}
+
+static enum ValueType compile_expression(struct TraceCompiler* c, Expression* expr) {
+  switch (expr->type) {
+    case EXPRESSION_LITERAL:
+      return compile_literal(c, expr);
+    case EXPRESSION_STATIC:
+      return compile_static(c, expr);
+    case EXPRESSION_GROUP:
+      return compile_expression(c, expr->group.child);
+    case EXPRESSION_UNARY:
+      return compile_unary(c, expr);
+    case EXPRESSION_BINARY:
+      return compile_binary(c, expr);
+    case EXPRESSION_ASSIGNMENT:
+      return compile_assignment(c, expr);
+    default:
+      return EVAL_TYPE_ERR;
+  }
+}
+
+// Snapshots the frames and the locals declared so far for the walker to resume from
+static void add_exit(struct TraceCompiler* c, size_t jump) {
+  struct TraceExit exit;
+  vector_new(exit, c->frames.count);
+
+  size_t scope = 0;
+  for (size_t i = 0; i < c->frames.count; ++i) {
+    struct TraceFrame frame = c->frames.xs[i];
+    vector_new(frame.locals, 4);
+
+    if (frame.new_scope) {
+      struct TraceScope* s = c->scopes.xs + scope++;
+      for (size_t slot = 0; slot < s->count; ++slot) {
+        if (!s->xs[slot].defined) continue;
+        struct TraceLocal local = {slot, s->xs[slot].name, s->xs[slot].type, s->xs[slot].index};
+        vector_push(frame.locals, local);
+      }
+    }
+
+    vector_push(exit, frame);
+  }
+
+  vector_push(c->trace->exits, exit);
+  vector_push(c->exit_jumps, jump);
+}
+
+// Leaves the trace when the condition doesn't evaluate as recorded
+static bool compile_guard(struct TraceCompiler* c, Expression* condition, bool expected) {
+  if (!is_pure(condition) || compile_expression(c, condition) != EVAL_TYPE_BOOL) return false;
+
+  x64_test_bool(&c->code);
+  size_t jump = x64_jump(&c->code, expected ? X64_JUMP_IF_ZERO : X64_JUMP_IF_NOT_ZERO);
+  add_exit(c, jump);
+  dump("  guard  %s -> exit %zu\n", expected ? "true" : "false", c->trace->exits.count);
+
+  return true;
+}
+
+static bool compile_statements(struct TraceCompiler* c, Statement* stmts, size_t count, bool new_scope) {
+  struct TraceFrame frame = {stmts, count, 0, new_scope, {0}};
+  vector_push(c->frames, frame);
+  if (new_scope) {
+    struct TraceScope scope;
+    vector_new(scope, 8);
+    vector_push(c->scopes, scope);
+  }
+
+  bool ok = true;
+  for (size_t i = 0; ok && i < count; ++i) {
+    c->frames.xs[c->frames.count - 1].index = i;
+    ok = compile_statement(c, stmts + i);
+  }
+
+  if (new_scope) {
+    vector_free(c->scopes.xs[c->scopes.count - 1]);
+    vector_pop(c->scopes);
+  }
+  vector_pop(c->frames);
+
+  return ok;
+}
+
+static bool compile_branch(struct TraceCompiler* c, Statement* branch) {
+  if (branch->type == STATEMENT_BLOCK) {
+    return compile_statements(c, branch->block.xs, branch->block.count, true);
+  }
+  return compile_statements(c, branch, 1, false);
+}
+
+// Only the recorded branch is compiled, the conditions before it are guarded to stay false
+static bool compile_conditional(struct TraceCompiler* c, Statement* stmt) {
+  size_t taken = SIZE_MAX;
+  for (size_t i = 0; i < recording.branches.count; ++i) {
+    if (recording.branches.xs[i].cond == stmt) {
+      taken = recording.branches.xs[i].taken;
+      break;
+    }
+  }
+  if (taken == SIZE_MAX) return false;
+
+  for (size_t i = 0; i < stmt->cond.count; ++i) {
+    struct ConditionalBlock* b = stmt->cond.xs + i;
+
+    if (i == taken) {
+      if (b->condition && !compile_guard(c, b->condition, true)) return false;
+      return compile_branch(c, b->branch);
+    }
+
+    if (!compile_guard(c, b->condition, false)) return false;
+  }
+
+  return true;
+}
+
+static bool compile_statement(struct TraceCompiler* c, Statement* stmt) {
+  switch (stmt->type) {
+    case STATEMENT_EXPR:
+      return compile_expression(c, stmt->expr) != EVAL_TYPE_ERR;
+    case STATEMENT_VAR_DECL: {
+      enum ValueType type = compile_expression(c, stmt->var_decl.expr);
+      if (type != EVAL_TYPE_DOUBLE && type != EVAL_TYPE_BOOL) return false;
+
+      struct TraceSlot slot = define(c, stmt->var_decl.slot, stmt->var_decl.identifier, type);
+      x64_store_slot(&c->code, 8 * (int32_t)slot.index);
+      dump("  local  [%zu] "SV_Fmt" %s\n", slot.index, SV_Fmt_arg(stmt->var_decl.identifier), type_name(type));
+      return true;
+    }
+    case STATEMENT_BLOCK:
+      return compile_statements(c, stmt->block.xs, stmt->block.count, true);
+    case STATEMENT_CONDITIONAL:
+      return compile_conditional(c, stmt);
+    default:
+      return false;
+  }
+}
+
+static bool compile_trace(struct TraceCompiler* c) {
+  Statement* loop = c->trace->loop;
+  Statement* body = loop->while_loop.body;
+  if (body->type != STATEMENT_BLOCK) return false;
+
+  size_t frame_size = x64_prologue(&c->code);
+  x64_patch_frame_size(&c->code, frame_size, 0);
+
+  size_t top = c->code.count;
+  if (!compile_statements(c, body->block.xs, body->block.count, true)) return false;
+
+  // The condition is evaluated in the scope of the loop
+  dump("  loop   condition\n");
+  if (compile_expression(c, loop->while_loop.condition) != EVAL_TYPE_BOOL) return false;
+  x64_test_bool(&c->code);
+  size_t done = x64_jump(&c->code, X64_JUMP_IF_ZERO);
+  x64_jump_back(&c->code, top);
+  x64_patch_jump(&c->code, done);
+  x64_exit(&c->code, 0);
+
+  for (size_t i = 0; i < c->exit_jumps.count; ++i) {
+    x64_patch_jump(&c->code, c->exit_jumps.xs[i]);
+    x64_exit(&c->code, (uint32_t)(i + 1));
+  }
+
+  return true;
+}
+
+static void free_exits(Trace* trace) {
+  for (size_t i = 0; i < trace->exits.count; ++i) {
+    struct TraceExit* exit = trace->exits.xs + i;
+    for (size_t j = 0; j < exit->count; ++j) {
+      vector_free(exit->xs[j].locals);
+    }
+    vector_free(*exit);
+  }
+  trace->exits.count = 0;
+}
+
+static size_t table_hash(const Statement* loop, size_t capacity) {
+  uintptr_t h = (uintptr_t)loop;
+  h ^= h >> 17;
+  h *= 0x9E3779B97F4A7C15ull;
+  return (size_t)(h >> 7) & (capacity - 1);
+}
+
+static Trace** table_slot(struct TraceTable* t, const Statement* loop) {
+  size_t idx = table_hash(loop, t->capacity);
+  while (t->xs[idx] && t->xs[idx]->loop != loop) idx = (idx + 1) & (t->capacity - 1);
+  return t->xs + idx;
+}
+
+Trace* trace_find(Statement* loop) {
+  if (!JIT_SUPPORTED || !launch_ctx_get()->jit) return NULL;
+
+  if (table.capacity == 0) {
+    table.capacity = 16;
+    table.xs = calloc(table.capacity, sizeof(Trace*));
+  }
+
+  Trace** slot = table_slot(&table, loop);
+  if (*slot) return *slot;
+
+  // Keep the table at most half full
+  if ((table.count + 1) * 2 > table.capacity) {
+    struct TraceTable grown = {
+      .count = table.count,
+      .capacity = table.capacity * 2,
+    };
+    grown.xs = calloc(grown.capacity, sizeof(Trace*));
+
+    for (size_t i = 0; i < table.capacity; ++i) {
+      if (table.xs[i]) *table_slot(&grown, table.xs[i]->loop) = table.xs[i];
+    }
+
+    free(table.xs);
+    table = grown;
+    slot = table_slot(&table, loop);
+  }
+
+  Trace* trace = calloc(1, sizeof(Trace));
+  trace->loop = loop;
+  vector_new(trace->vars, 4);
+  vector_new(trace->exits, 4);
+
+  *slot = trace;
+  table.count += 1;
+  return trace;
+}
+
+bool trace_count_iteration(Trace* trace) {
+  if (trace->rejected || trace->native) return false;
+
+  trace->iterations += 1;
+  return trace->iterations >= TRACE_HOT_ITERATIONS && !trace_recording();
+}
+
+void trace_record_begin(Trace* trace) {
+  assert(!trace_recording() && "Only one loop can be recorded at a time");
+  recording.trace = trace;
+  vector_new(recording.branches, 8);
+}
+
+bool trace_recording() {
+  return recording.trace != NULL;
+}
+
+void trace_record_branch(Statement* cond, size_t taken) {
+  for (size_t i = 0; i < recording.branches.count; ++i) {
+    if (recording.branches.xs[i].cond == cond) return;
+  }
+
+  struct RecordedBranch branch = {cond, taken};
+  vector_push(recording.branches, branch);
+}
+
+void trace_record_end(Trace* trace) {
+  assert(recording.trace == trace && "Recording ended for another loop");
+
+  struct TraceCompiler c = {.trace = trace};
+  x64_new(&c.code);
+  vector_new(c.scopes, 4);
+  vector_new(c.frames, 4);
+  vector_new(c.exit_jumps, 4);
+
+  Token* at = find_token(trace->loop->while_loop.condition);
+  dump("== Trace: while loop line %zu ==\n", at ? at->line : 0);
+
+  bool ok = compile_trace(&c);
+  if (ok) {
+    trace->native = (TraceFn)x64_finalize(&c.code);
+    trace->size = c.code.count;
+    ok = trace->native != NULL;
+  }
+
+  if (ok) {
+    trace->slots = calloc(trace->num_slots, sizeof(double));
+    trace->refs = calloc(trace->vars.count, sizeof(ValueRef));
+    dump("== %zu slots, %zu exits, %zu bytes ==\n", trace->num_slots, trace->exits.count, trace->size);
+  } else {
+    trace->rejected = true;
+    free_exits(trace);
+    dump("== Rejected ==\n");
+  }
+
+  vector_free(c.exit_jumps);
+  vector_free(c.frames);
+  vector_free(c.scopes);
+  x64_free(&c.code);
+
+  vector_free(recording.branches);
+  recording.trace = NULL;
+}
+
+enum TraceResult trace_run(Trace* trace, const struct TraceExit** exit) {
+  // Guard the types the trace was specialized on
+  for (size_t i = 0; i < trace->vars.count; ++i) {
+    struct TraceVar* tv = trace->vars.xs + i;
+    ValueRef v = scope_get_val_ref(tv->var);
+    if (!v || value_type(*v) != tv->type) return TRACE_GUARD_FAILED;
+
+    trace->refs[i] = v;
+    trace->slots[tv->index] = (value_type(*v) == EVAL_TYPE_DOUBLE) ? value_as_double(*v) : (value_as_bool(*v) ? 1.0 : 0.0);
+  }
+
+  uint32_t id = trace->native(trace->slots);
+
+  for (size_t i = 0; i < trace->vars.count; ++i) {
+    struct TraceVar* tv = trace->vars.xs + i;
+    double slot = trace->slots[tv->index];
+    *trace->refs[i] = (tv->type == EVAL_TYPE_DOUBLE) ? value_new_double(slot) : value_new_bool(slot != 0.0);
+  }
+
+  if (id == 0) return TRACE_LOOP_EXIT;
+
+  *exit = trace->exits.xs + id - 1;
+  return TRACE_SIDE_EXIT;
+}
+
+Value trace_local_value(const Trace* trace, const struct TraceLocal* local) {
+  double slot = trace->slots[local->index];
+  return (local->type == EVAL_TYPE_DOUBLE) ? value_new_double(slot) : value_new_bool(slot != 0.0);
+}
+
+void trace_free() {
+  for (size_t i = 0; i < table.capacity; ++i) {
+    Trace* trace = table.xs[i];
+    if (!trace) continue;
+
+    if (trace->native) x64_release((void*)trace->native, trace->size);
+    free_exits(trace);
+    vector_free(trace->exits);
+    vector_free(trace->vars);
+    free(trace->slots);
+    free(trace->refs);
+    free(trace);
+  }
+
+  free(table.xs);
+  table = (struct TraceTable){0};
+}
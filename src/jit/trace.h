@@ -0,0 +1,101 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+
+#include "../types/value.h"
+#include "../types/statements.h"
+
+// Iterations of a while loop before one of its iterations gets recorded
+#define TRACE_HOT_ITERATIONS 50
+
+// Local declared by the trace, materialized in its scope when resuming after a side exit
+struct TraceLocal {
+  uint16_t slot;
+  StringView name;
+  enum ValueType type;
+  size_t index;
+};
+
+struct TraceLocals {
+  struct TraceLocal* xs;
+  size_t count;
+  size_t capacity;
+};
+
+// Statements being executed when a guard failed, new_scope is set for blocks.
+// The innermost frame resumes at index, the outer ones after it
+struct TraceFrame {
+  Statement* stmts;
+  size_t count;
+  size_t index;
+  bool new_scope;
+  struct TraceLocals locals;
+};
+
+// Frames from the loop body down to the failed guard
+struct TraceExit {
+  struct TraceFrame* xs;
+  size_t count;
+  size_t capacity;
+};
+
+// Variable living outside of the loop body, loaded in a slot on entry and written back on exit
+struct TraceVar {
+  VarSlot var;
+  enum ValueType type;
+  size_t index;
+};
+
+typedef uint32_t (*TraceFn)(double* slots);
+
+typedef struct {
+  Statement* loop;
+  size_t iterations;
+  bool rejected;
+  TraceFn native;
+  size_t size;
+  struct {
+    struct TraceVar* xs;
+    size_t count;
+    size_t capacity;
+  } vars;
+  struct {
+    struct TraceExit* xs;
+    size_t count;
+    size_t capacity;
+  } exits;
+  // Outer variables and locals of the body, numbered in order of first use
+  double* slots;
+  size_t num_slots;
+  ValueRef* refs;
+} Trace;
+
+enum TraceResult {
+  // Outer variables don't have the recorded types, the iteration must be interpreted
+  TRACE_GUARD_FAILED,
+  // The loop condition became false
+  TRACE_LOOP_EXIT,
+  // A guard failed inside the body, the iteration must be resumed from the exit
+  TRACE_SIDE_EXIT,
+};
+
+// Trace of a while loop, NULL when the JIT is disabled
+Trace* trace_find(Statement* loop);
+// Counts an interpreted iteration, true when the next one should be recorded
+bool trace_count_iteration(Trace* trace);
+
+// Recording notes the branches taken by conditionals while the walker runs one iteration
+void trace_record_begin(Trace* trace);
+bool trace_recording();
+void trace_record_branch(Statement* cond, size_t taken);
+// Compiles the recorded iteration, must be called at the head of the loop
+void trace_record_end(Trace* trace);
+
+// Runs iterations natively starting with the body, the condition was already checked by the walker
+enum TraceResult trace_run(Trace* trace, const struct TraceExit** exit);
+Value trace_local_value(const Trace* trace, const struct TraceLocal* local);
+
+void trace_free();
+
+#endif
@@ -0,0 +1,246 @@
+#include "x64.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "../types/vector.h"
+
+#define emit(code, ...) emit_bytes(code, (const uint8_t[]){__VA_ARGS__}, sizeof((const uint8_t[]){__VA_ARGS__}))
+
+static void emit_bytes(X64Code* code, const uint8_t* bytes, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    vector_push(*code, bytes[i]);
+  }
+}
+
+static void emit_u32(X64Code* code, uint32_t x) {
+  for (int i = 0; i < 4; ++i) {
+    vector_push(*code, (uint8_t)(x >> (i * 8)));
+  }
+}
+
+static void emit_u64(X64Code* code, uint64_t x) {
+  for (int i = 0; i < 8; ++i) {
+    vector_push(*code, (uint8_t)(x >> (i * 8)));
+  }
+}
+
+static void write_u32(X64Code* code, size_t at, uint32_t x) {
+  for (int i = 0; i < 4; ++i) {
+    code->xs[at + i] = (uint8_t)(x >> (i * 8));
+  }
+}
+
+void x64_new(X64Code* code) {
+  vector_new(*code, 256);
+}
+
+void x64_free(X64Code* code) {
+  vector_free(*code);
+}
+
+size_t x64_prologue(X64Code* code) {
+  // push rbp; mov rbp, rsp; sub rsp, imm32
+  emit(code, 0x55, 0x48, 0x89, 0xE5, 0x48, 0x81, 0xEC);
+  size_t at = code->count;
+  emit_u32(code, 0);
+  return at;
+}
+
+void x64_patch_frame_size(X64Code* code, size_t at, uint32_t frame_sz) {
+  // Keep rsp 16 bytes aligned
+  write_u32(code, at, (frame_sz + 15) & ~15u);
+}
+
+void x64_return(X64Code* code) {
+  // mov rsp, rbp; pop rbp; ret
+  emit(code, 0x48, 0x89, 0xEC, 0x5D, 0xC3);
+}
+
+void x64_exit(X64Code* code, uint32_t id) {
+  // mov eax, imm32
+  emit(code, 0xB8);
+  emit_u32(code, id);
+  x64_return(code);
+}
+
+void x64_load_local(X64Code* code, int32_t disp) {
+  // movsd xmm0, [rbp + disp32]
+  emit(code, 0xF2, 0x0F, 0x10, 0x85);
+  emit_u32(code, (uint32_t)disp);
+}
+
+void x64_store_local(X64Code* code, int32_t disp) {
+  // movsd [rbp + disp32], xmm0
+  emit(code, 0xF2, 0x0F, 0x11, 0x85);
+  emit_u32(code, (uint32_t)disp);
+}
+
+void x64_load_slot(X64Code* code, int32_t disp) {
+  // movsd xmm0, [rdi + disp32]
+  emit(code, 0xF2, 0x0F, 0x10, 0x87);
+  emit_u32(code, (uint32_t)disp);
+}
+
+void x64_store_slot(X64Code* code, int32_t disp) {
+  // movsd [rdi + disp32], xmm0
+  emit(code, 0xF2, 0x0F, 0x11, 0x87);
+  emit_u32(code, (uint32_t)disp);
+}
+
+static void load_bits(X64Code* code, uint64_t bits, uint8_t xmm) {
+  // mov rax, imm64; movq xmm, rax
+  emit(code, 0x48, 0xB8);
+  emit_u64(code, bits);
+  emit(code, 0x66, 0x48, 0x0F, 0x6E, 0xC0 | (xmm << 3));
+}
+
+void x64_load_double(X64Code* code, double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  load_bits(code, bits, 0);
+}
+
+void x64_push(X64Code* code) {
+  // sub rsp, 8; movsd [rsp], xmm0
+  emit(code, 0x48, 0x83, 0xEC, 0x08, 0xF2, 0x0F, 0x11, 0x04, 0x24);
+}
+
+void x64_pop(X64Code* code) {
+  // movsd xmm0, [rsp]; add rsp, 8
+  emit(code, 0xF2, 0x0F, 0x10, 0x04, 0x24, 0x48, 0x83, 0xC4, 0x08);
+}
+
+void x64_pop_left(X64Code* code) {
+  // movapd xmm1, xmm0; movsd xmm0, [rsp]; add rsp, 8
+  emit(code, 0x66, 0x0F, 0x28, 0xC8, 0xF2, 0x0F, 0x10, 0x04, 0x24, 0x48, 0x83, 0xC4, 0x08);
+}
+
+void x64_arith(X64Code* code, enum X64Arith op) {
+  switch (op) {
+    case X64_ADD:
+      emit(code, 0xF2, 0x0F, 0x58, 0xC1);
+      break;
+    case X64_SUB:
+      emit(code, 0xF2, 0x0F, 0x5C, 0xC1);
+      break;
+    case X64_MUL:
+      emit(code, 0xF2, 0x0F, 0x59, 0xC1);
+      break;
+    case X64_DIV: {
+      // Division by zero yields NAN like the interpreter does
+      // xorpd xmm2, xmm2; ucomisd xmm1, xmm2; jp divide; jne divide
+      emit(code, 0x66, 0x0F, 0x57, 0xD2, 0x66, 0x0F, 0x2E, 0xCA, 0x7A, 0x13, 0x75, 0x11);
+      // mov rax, NAN; movq xmm0, rax; jmp done
+      load_bits(code, 0x7FF8000000000000ull, 0);
+      emit(code, 0xEB, 0x04);
+      // divide: divsd xmm0, xmm1
+      emit(code, 0xF2, 0x0F, 0x5E, 0xC1);
+      break;
+    }
+  }
+}
+
+void x64_compare(X64Code* code, enum X64Compare op) {
+  // Operands are swapped for less than so that NAN compares false through the carry flag
+  switch (op) {
+    case X64_LESS:
+      // ucomisd xmm1, xmm0; seta al
+      emit(code, 0x66, 0x0F, 0x2E, 0xC8, 0x0F, 0x97, 0xC0);
+      break;
+    case X64_LESS_EQUAL:
+      // ucomisd xmm1, xmm0; setae al
+      emit(code, 0x66, 0x0F, 0x2E, 0xC8, 0x0F, 0x93, 0xC0);
+      break;
+    case X64_GREATER:
+      // ucomisd xmm0, xmm1; seta al
+      emit(code, 0x66, 0x0F, 0x2E, 0xC1, 0x0F, 0x97, 0xC0);
+      break;
+    case X64_GREATER_EQUAL:
+      // ucomisd xmm0, xmm1; setae al
+      emit(code, 0x66, 0x0F, 0x2E, 0xC1, 0x0F, 0x93, 0xC0);
+      break;
+    case X64_EQUAL:
+      // ucomisd xmm0, xmm1; sete al; setnp cl; and al, cl
+      emit(code, 0x66, 0x0F, 0x2E, 0xC1, 0x0F, 0x94, 0xC0, 0x0F, 0x9B, 0xC1, 0x20, 0xC8);
+      break;
+    case X64_NOT_EQUAL:
+      // ucomisd xmm0, xmm1; setne al; setp cl; or al, cl
+      emit(code, 0x66, 0x0F, 0x2E, 0xC1, 0x0F, 0x95, 0xC0, 0x0F, 0x9A, 0xC1, 0x08, 0xC8);
+      break;
+  }
+
+  // movzx eax, al; cvtsi2sd xmm0, eax
+  emit(code, 0x0F, 0xB6, 0xC0, 0xF2, 0x0F, 0x2A, 0xC0);
+}
+
+void x64_negate(X64Code* code) {
+  // Flip the sign bit: xorpd xmm0, xmm1
+  load_bits(code, 0x8000000000000000ull, 1);
+  emit(code, 0x66, 0x0F, 0x57, 0xC1);
+}
+
+void x64_not(X64Code* code) {
+  // xmm0 = 1.0 - xmm0
+  emit(code, 0x66, 0x0F, 0x28, 0xC8);
+  x64_load_double(code, 1.0);
+  x64_arith(code, X64_SUB);
+}
+
+void x64_test_bool(X64Code* code) {
+  // xorpd xmm1, xmm1; ucomisd xmm0, xmm1
+  emit(code, 0x66, 0x0F, 0x57, 0xC9, 0x66, 0x0F, 0x2E, 0xC1);
+}
+
+size_t x64_jump(X64Code* code, enum X64Jump kind) {
+  switch (kind) {
+    case X64_JUMP:
+      emit(code, 0xE9);
+      break;
+    case X64_JUMP_IF_ZERO:
+      emit(code, 0x0F, 0x84);
+      break;
+    case X64_JUMP_IF_NOT_ZERO:
+      emit(code, 0x0F, 0x85);
+      break;
+  }
+
+  size_t at = code->count;
+  emit_u32(code, 0);
+  return at;
+}
+
+void x64_patch_jump(X64Code* code, size_t at) {
+  write_u32(code, at, (uint32_t)(code->count - (at + 4)));
+}
+
+void x64_jump_back(X64Code* code, size_t target) {
+  emit(code, 0xE9);
+  emit_u32(code, (uint32_t)(target - (code->count + 4)));
+}
+
+void x64_call(X64Code* code, size_t target, size_t argc) {
+  // mov rdi, rsp; call rel32; add rsp, imm32
+  emit(code, 0x48, 0x89, 0xE7, 0xE8);
+  emit_u32(code, (uint32_t)(target - (code->count + 4)));
+  emit(code, 0x48, 0x81, 0xC4);
+  emit_u32(code, (uint32_t)(argc * 8));
+}
+
+void* x64_finalize(const X64Code* code) {
+  void* exec = mmap(NULL, code->count, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (exec == MAP_FAILED) return NULL;
+
+  memcpy(exec, code->xs, code->count);
+  if (mprotect(exec, code->count, PROT_READ | PROT_EXEC) != 0) {
+    munmap(exec, code->count);
+    return NULL;
+  }
+
+  return exec;
+}
+
+void x64_release(void* exec, size_t size) {
+  munmap(exec, size);
+}
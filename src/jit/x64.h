@@ -0,0 +1,81 @@
+#ifndef _X64_H
+#define _X64_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Minimal x86-64 assembler for the JIT templates.
+// Values are doubles held in xmm0 (result) and xmm1 (right operand),
+// temporaries live on the machine stack and locals at negative offsets from rbp
+
+typedef struct {
+  uint8_t* xs;
+  size_t count;
+  size_t capacity;
+} X64Code;
+
+enum X64Arith {
+  X64_ADD,
+  X64_SUB,
+  X64_MUL,
+  X64_DIV,
+};
+
+enum X64Compare {
+  X64_LESS,
+  X64_LESS_EQUAL,
+  X64_GREATER,
+  X64_GREATER_EQUAL,
+  X64_EQUAL,
+  X64_NOT_EQUAL,
+};
+
+enum X64Jump {
+  X64_JUMP,
+  X64_JUMP_IF_ZERO,
+  X64_JUMP_IF_NOT_ZERO,
+};
+
+void x64_new(X64Code* code);
+void x64_free(X64Code* code);
+
+// Returns the offset of the frame size operand, to be patched once all locals are known
+size_t x64_prologue(X64Code* code);
+void x64_patch_frame_size(X64Code* code, size_t at, uint32_t frame_sz);
+void x64_return(X64Code* code);
+// Returns id in eax
+void x64_exit(X64Code* code, uint32_t id);
+
+void x64_load_local(X64Code* code, int32_t disp);
+void x64_store_local(X64Code* code, int32_t disp);
+// Slots are addressed from the pointer passed as first argument
+void x64_load_slot(X64Code* code, int32_t disp);
+void x64_store_slot(X64Code* code, int32_t disp);
+void x64_load_double(X64Code* code, double value);
+
+void x64_push(X64Code* code);
+// Pops into xmm0
+void x64_pop(X64Code* code);
+// Pops the left operand into xmm0 and moves the right one into xmm1
+void x64_pop_left(X64Code* code);
+
+void x64_arith(X64Code* code, enum X64Arith op);
+void x64_compare(X64Code* code, enum X64Compare op);
+void x64_negate(X64Code* code);
+void x64_not(X64Code* code);
+// Sets the zero flag when the boolean in xmm0 is false
+void x64_test_bool(X64Code* code);
+
+// Returns the offset of the jump operand, to be patched with x64_patch_jump
+size_t x64_jump(X64Code* code, enum X64Jump kind);
+void x64_patch_jump(X64Code* code, size_t at);
+void x64_jump_back(X64Code* code, size_t target);
+
+// Calls the code at target with the pushed arguments then pops them
+void x64_call(X64Code* code, size_t target, size_t argc);
+
+// Copies the code to executable memory
+void* x64_finalize(const X64Code* code);
+void x64_release(void* exec, size_t size);
+
+#endif
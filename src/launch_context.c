@@ -1,8 +1,14 @@
 #include "launch_context.h"
+#include "jit.h"
+#include "optimizer.h"
+#include <stdio.h>
 #include <string.h>
 #include <stdint.h>
 
-LaunchContext g_launch_ctx = {0};
+LaunchContext g_launch_ctx = {
+  .jit = JIT_SUPPORTED,
+  .opt_level = OPTIMIZER_DEFAULT_LEVEL,
+};
 
 LaunchContext* launch_ctx_new(char* opts[], int optsc) {
   for (size_t i = 0; i < (size_t)optsc; ++i) {
@@ -12,6 +18,37 @@ LaunchContext* launch_ctx_new(char* opts[], int optsc) {
     else if (strcmp(opt, "--report-scopes") == 0) {
       g_launch_ctx.print_scopes = true;
     }
+    else if (strcmp(opt, "--dump-bytecode") == 0) {
+      g_launch_ctx.dump_bytecode = true;
+    }
+    else if (strcmp(opt, "--closures") == 0) {
+      g_launch_ctx.closure_compile = true;
+    }
+    else if (strcmp(opt, "--jit") == 0) {
+      g_launch_ctx.jit = true;
+    }
+    else if (strcmp(opt, "--no-jit") == 0) {
+      g_launch_ctx.jit = false;
+    }
+    else if (strcmp(opt, "--dump-traces") == 0) {
+      g_launch_ctx.dump_traces = true;
+    }
+    else if (strcmp(opt, "--optimized") == 0) {
+      g_launch_ctx.parse_optimized = true;
+    }
+    else if (strcmp(opt, "--report-inlining") == 0) {
+      g_launch_ctx.report_inlining = true;
+    }
+    else if (strcmp(opt, "--report-memo") == 0) {
+      g_launch_ctx.report_memo = true;
+    }
+    else if (strncmp(opt, "-O", 2) == 0) {
+      if (opt[2] >= '0' && opt[2] <= '0' + OPTIMIZER_MAX_LEVEL && opt[3] == '\0') {
+        g_launch_ctx.opt_level = opt[2] - '0';
+      } else {
+        fprintf(stderr, "Unknown optimization level %s, expected -O0 to -O%d\n", opt, OPTIMIZER_MAX_LEVEL);
+      }
+    }
   }
 
   return &g_launch_ctx;
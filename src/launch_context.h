@@ -3,6 +3,16 @@
 
 typedef struct {
   bool print_scopes;
+  bool dump_bytecode;
+  bool closure_compile;
+  bool jit;
+  bool dump_traces;
+  // -O level of the AST optimizer, see optimizer.h
+  int opt_level;
+  bool report_inlining;
+  // hits and misses of the pure functions, printed at exit
+  bool report_memo;
+  bool parse_optimized;
 } LaunchContext;
 
 extern LaunchContext g_launch_ctx;
@@ -5,7 +5,14 @@
 #include "launch_context.h"
 #include "lexer.h"
 #include "parser.h"
+#include "resolver.h"
+#include "optimizer.h"
 #include "interpreter.h"
+#include "closure.h"
+#include "vm.h"
+#include "vm/compiler.h"
+#include "aot.h"
+#include "interpreter/memo.h"
 #include "types/token.h"
 
 const char* read_file_contents(const char* filename, size_t* byte_sz);
@@ -69,7 +76,10 @@ int main(int argc, char *argv[]) {
     parser_init();
 
     Statements stmts;
-    parse(tokens, num_tokens, &stmts);
+    // The optimizer reads the slots filled by the resolver
+    if (parse(tokens, num_tokens, &stmts) && launch_ctx_get()->parse_optimized && resolve(stmts)) {
+      optimize(&stmts, launch_ctx_get()->opt_level);
+    }
     for (size_t i = 0; i < stmts.count; ++i) {
       statement_pretty_print(stmts.xs + i);
     }
@@ -97,7 +107,101 @@ int main(int argc, char *argv[]) {
       goto cleanup;
     }
 
-    interpret(stmts);
+    if (!resolve(stmts)) {
+      return_code = 65;
+      parser_free(&stmts);
+      goto cleanup;
+    }
+    optimize(&stmts, launch_ctx_get()->opt_level);
+
+    if (launch_ctx_get()->closure_compile) {
+      closure_run(stmts);
+    } else {
+      interpret(stmts);
+    }
+
+    if (launch_ctx_get()->report_memo) memo_report();
+    memo_free();
+
+    parser_free(&stmts);
+    free(tokens);
+  } else if (strcmp(command, "run") == 0) {
+    Tokenizer t = tokenizer_new(file_contents, file_sz);
+
+    Token* tokens;
+    size_t num_tokens;
+    int tokenize_result = tokenizer_scan_file(&t, &tokens, &num_tokens);
+
+    if (tokenize_result > 0) {
+      return_code = tokenize_result;
+      free(tokens);
+      goto cleanup;
+    }
+
+    parser_init();
+    Statements stmts;
+    if (!parse(tokens, num_tokens, &stmts)) {
+      return_code = 66;
+      parser_free(&stmts);
+      goto cleanup;
+    }
+
+    if (!resolve(stmts)) {
+      return_code = 65;
+      parser_free(&stmts);
+      goto cleanup;
+    }
+    optimize(&stmts, launch_ctx_get()->opt_level);
+
+    Program program;
+    if (!compile(stmts, &program)) {
+      return_code = 65;
+      program_free(&program);
+      parser_free(&stmts);
+      goto cleanup;
+    }
+
+    if (launch_ctx_get()->dump_bytecode) {
+      program_disassemble(&program);
+    }
+
+    vm_run(&program);
+
+    if (launch_ctx_get()->report_memo) memo_report();
+    memo_free();
+
+    program_free(&program);
+    parser_free(&stmts);
+    free(tokens);
+  } else if (strcmp(command, "compile") == 0) {
+    Tokenizer t = tokenizer_new(file_contents, file_sz);
+
+    Token* tokens;
+    size_t num_tokens;
+    int tokenize_result = tokenizer_scan_file(&t, &tokens, &num_tokens);
+
+    if (tokenize_result > 0) {
+      return_code = tokenize_result;
+      free(tokens);
+      goto cleanup;
+    }
+
+    parser_init();
+    Statements stmts;
+    if (!parse(tokens, num_tokens, &stmts)) {
+      return_code = 66;
+      parser_free(&stmts);
+      goto cleanup;
+    }
+
+    if (!resolve(stmts)) {
+      return_code = 65;
+      parser_free(&stmts);
+      goto cleanup;
+    }
+    optimize(&stmts, launch_ctx_get()->opt_level);
+
+    aot_compile(stmts, stdout);
 
     parser_free(&stmts);
     free(tokens);
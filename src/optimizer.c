@@ -0,0 +1,934 @@
+#include "optimizer.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include "launch_context.h"
+#include "parser.h"
+#include "resolver.h"
+#include "types/token.h"
+#include "types/vector.h"
+
+// Every pass is a walk over the whole tree, calling its hooks bottom up:
+// an expression's operands are already rewritten when the expression is visited
+struct Pass {
+  // lowest -O level running the pass
+  int level;
+  void (*expression)(Expression* expr);
+  void (*statement)(Statement* stmt);
+};
+
+static void walk_statement(Statement* stmt, const struct Pass* pass);
+
+static void walk_expression(Expression* expr, const struct Pass* pass) {
+  switch (expr->type) {
+    case EXPRESSION_STATIC:
+    case EXPRESSION_LITERAL:
+    break;
+    case EXPRESSION_GROUP:
+      walk_expression(expr->group.child, pass);
+    break;
+    case EXPRESSION_UNARY:
+      walk_expression(expr->unary.child, pass);
+    break;
+    case EXPRESSION_BINARY:
+      walk_expression(expr->binary.left, pass);
+      walk_expression(expr->binary.right, pass);
+    break;
+    case EXPRESSION_CALL:
+      walk_expression(expr->call.callee, pass);
+      for (size_t i = 0; i < expr->call.args.count; ++i) {
+        walk_expression(expr->call.args.xs[i], pass);
+      }
+    break;
+    case EXPRESSION_GET:
+      walk_expression(expr->get.object, pass);
+    break;
+    case EXPRESSION_SET:
+      walk_expression(expr->set.object, pass);
+      walk_expression(expr->set.right, pass);
+    break;
+    case EXPRESSION_ASSIGNMENT:
+      walk_expression(expr->assignment.right, pass);
+    break;
+    case EXPRESSION_ANON_FUN:
+      walk_statement(expr->anon_fun.proto.body, pass);
+    break;
+  }
+
+  if (pass->expression) pass->expression(expr);
+}
+
+static void walk_statement(Statement* stmt, const struct Pass* pass) {
+  switch (stmt->type) {
+    case STATEMENT_EXPR:
+    case STATEMENT_PRINT_EXPR:
+      walk_expression(stmt->expr, pass);
+    break;
+    case STATEMENT_VAR_DECL:
+      walk_expression(stmt->var_decl.expr, pass);
+    break;
+    case STATEMENT_FUN_DECL:
+      walk_statement(stmt->fun_decl.proto.body, pass);
+    break;
+    case STATEMENT_CLASS_DECL:
+      for (size_t i = 0; i < stmt->class_decl.methods_decl.count; ++i) {
+        walk_statement(stmt->class_decl.methods_decl.xs[i].proto.body, pass);
+      }
+    break;
+    case STATEMENT_BLOCK:
+      for (size_t i = 0; i < stmt->block.count; ++i) {
+        walk_statement(stmt->block.xs + i, pass);
+      }
+    break;
+    case STATEMENT_CONDITIONAL:
+      for (size_t i = 0; i < stmt->cond.count; ++i) {
+        struct ConditionalBlock* block = stmt->cond.xs + i;
+        if (block->condition) walk_expression(block->condition, pass);
+        walk_statement(block->branch, pass);
+      }
+    break;
+    case STATEMENT_WHILE:
+      walk_expression(stmt->while_loop.condition, pass);
+      walk_statement(stmt->while_loop.body, pass);
+    break;
+    case STATEMENT_RETURN:
+      walk_expression(stmt->ret, pass);
+    break;
+  }
+
+  if (pass->statement) pass->statement(stmt);
+}
+
+// -- Constants --
+
+// Doubles, booleans and nil are known before running, strings are left to the runtime
+static bool constant_value(const Expression* expr, Value* out) {
+  if (expr->type == EXPRESSION_STATIC) {
+    *out = expr->evaluated;
+    return true;
+  }
+
+  if (expr->type == EXPRESSION_LITERAL && expr->literal.type == TOKEN_TYPE_NUMBER) {
+    *out = parser_constants()[expr->constant];
+    return true;
+  }
+
+  return false;
+}
+
+// Operands which wouldn't convert are left to the runtime, it reports the error
+static bool constant_as(const Expression* expr, enum ValueType type, Value* out) {
+  return constant_value(expr, out) && convert_to(out, type);
+}
+
+static void make_static(Expression* expr, Value value) {
+  expr->origin = find_token(expr);
+  expr->type = EXPRESSION_STATIC;
+  expr->evaluated = value;
+}
+
+// -- Passes --
+
+// Groups only matter to the parser, 'super' must stay the direct object of its gets
+static void collapse_group(Expression* expr) {
+  if (expr->type != EXPRESSION_GROUP || expression_is_super(expr->group.child)) return;
+  *expr = *expr->group.child;
+}
+
+static void fold_unary(Expression* expr) {
+  Value v;
+  switch (expr->unary.operator.type) {
+    case TOKEN_TYPE_MINUS:
+      if (constant_as(expr->unary.child, EVAL_TYPE_DOUBLE, &v)) {
+        make_static(expr, value_new_double(-value_as_double(v)));
+      }
+    break;
+    case TOKEN_TYPE_BANG:
+      if (constant_as(expr->unary.child, EVAL_TYPE_BOOL, &v)) {
+        make_static(expr, value_new_bool(!value_as_bool(v)));
+      }
+    break;
+    default:
+    break;
+  }
+}
+
+static void fold_logic(Expression* expr) {
+  bool is_or = expr->binary.operator.keyword == RESERVED_KEYWORD_OR;
+  Value l, r;
+  if (!constant_as(expr->binary.left, EVAL_TYPE_BOOL, &l)) return;
+
+  // The left operand decides, the right one is never evaluated
+  if (value_as_bool(l) == is_or) {
+    make_static(expr, value_new_bool(is_or));
+  } else if (constant_as(expr->binary.right, EVAL_TYPE_BOOL, &r)) {
+    make_static(expr, value_new_bool(value_as_bool(r)));
+  }
+}
+
+static void fold_binary(Expression* expr) {
+  if (expr->binary.operator.type == TOKEN_TYPE_KEYWORD) {
+    fold_logic(expr);
+    return;
+  }
+
+  Value l, r;
+  if (!constant_as(expr->binary.left, EVAL_TYPE_DOUBLE, &l) || !constant_as(expr->binary.right, EVAL_TYPE_DOUBLE, &r)) return;
+
+  double a = value_as_double(l);
+  double b = value_as_double(r);
+  switch (expr->binary.operator.type) {
+    case TOKEN_TYPE_PLUS: make_static(expr, value_new_double(a + b)); break;
+    case TOKEN_TYPE_MINUS: make_static(expr, value_new_double(a - b)); break;
+    case TOKEN_TYPE_STAR: make_static(expr, value_new_double(a * b)); break;
+    case TOKEN_TYPE_SLASH: make_static(expr, value_new_double(b == 0.0 ? NAN : a / b)); break;
+    case TOKEN_TYPE_LESS: make_static(expr, value_new_bool(a < b)); break;
+    case TOKEN_TYPE_LESS_EQUAL: make_static(expr, value_new_bool(a <= b)); break;
+    case TOKEN_TYPE_GREATER: make_static(expr, value_new_bool(a > b)); break;
+    case TOKEN_TYPE_GREATER_EQUAL: make_static(expr, value_new_bool(a >= b)); break;
+    case TOKEN_TYPE_EQUAL_EQUAL: make_static(expr, value_new_bool(a == b)); break;
+    case TOKEN_TYPE_BANG_EQUAL: make_static(expr, value_new_bool(a != b)); break;
+    default: break;
+  }
+}
+
+static void fold_constants(Expression* expr) {
+  if (expr->type == EXPRESSION_UNARY) fold_unary(expr);
+  else if (expr->type == EXPRESSION_BINARY) fold_binary(expr);
+}
+
+static bool is_empty_block(const Statement* stmt) {
+  return stmt->type == STATEMENT_BLOCK && stmt->block.count == 0;
+}
+
+static void remove_empty_blocks(Statements* stmts) {
+  size_t kept = 0;
+  for (size_t i = 0; i < stmts->count; ++i) {
+    if (is_empty_block(stmts->xs + i)) {
+      vector_free(stmts->xs[i].block);
+    } else {
+      stmts->xs[kept++] = stmts->xs[i];
+    }
+  }
+  stmts->count = kept;
+}
+
+// Branches are never declarations, dropping one doesn't change the slots of its scope.
+// A conditional left without branches becomes an empty block, removed by its enclosing block
+static void prune_conditional(Statement* stmt) {
+  struct StatementConditional* cond = &stmt->cond;
+  size_t kept = 0;
+  for (size_t i = 0; i < cond->count; ++i) {
+    struct ConditionalBlock block = cond->xs[i];
+    Value v;
+    if (block.condition && constant_as(block.condition, EVAL_TYPE_BOOL, &v)) {
+      if (!value_as_bool(v)) continue;
+      // Always taken, the branches after it are dead
+      block.condition = NULL;
+    }
+
+    cond->xs[kept++] = block;
+    if (block.condition == NULL) break;
+  }
+  cond->count = kept;
+
+  if (kept == 0) {
+    vector_free(*cond);
+    stmt->type = STATEMENT_BLOCK;
+    stmt->block = (Statements){0};
+    stmt->scope = (ScopeLayout){0};
+  } else if (cond->xs[0].condition == NULL) {
+    Statement* branch = cond->xs[0].branch;
+    vector_free(*cond);
+    *stmt = *branch;
+  }
+}
+
+static void prune_loop(Statement* stmt) {
+  Value v;
+  if (constant_as(stmt->while_loop.condition, EVAL_TYPE_BOOL, &v) && !value_as_bool(v)) {
+    stmt->type = STATEMENT_BLOCK;
+    stmt->block = (Statements){0};
+    stmt->scope = (ScopeLayout){0};
+  }
+}
+
+static void prune_branches(Statement* stmt) {
+  if (stmt->type == STATEMENT_CONDITIONAL) prune_conditional(stmt);
+  else if (stmt->type == STATEMENT_WHILE) prune_loop(stmt);
+  else if (stmt->type == STATEMENT_BLOCK) remove_empty_blocks(&stmt->block);
+}
+
+// -- Inlining --
+
+// Calls to a top-level function never reassigned, whose body only returns an expression
+// of its parameters, are replaced by that expression. The parameters are substituted by
+// the arguments, which must be free of side effects: evaluating them any number of times is
+// the same as binding them once. Runs before the other passes, which fold the result
+#define INLINE_BUDGET 16
+
+struct Inlinable {
+  uint16_t slot;
+  const struct StatementFunDecl* decl;
+  // nodes of the returned expression
+  size_t size;
+};
+
+// Function being walked, its upvalues lead back to the global scope
+struct InlineFunction {
+  const struct UpvalueDescs* upvalues;
+  // scopes between its call scope and the global scope
+  size_t base;
+};
+
+struct Inliner {
+  // the first walk only collects the global slots assigned to, the second one inlines
+  bool rewrite;
+  // scopes between the current one and the global scope
+  size_t depth;
+  struct {
+    struct InlineFunction* xs;
+    size_t count;
+    size_t capacity;
+  } functions;
+  struct {
+    struct Inlinable* xs;
+    size_t count;
+    size_t capacity;
+  } candidates;
+  struct {
+    uint16_t* xs;
+    size_t count;
+    size_t capacity;
+  } assigned;
+  size_t inlined;
+};
+
+// Slot of the global variable the resolved variable refers to, false for any other variable
+static bool global_slot(const struct Inliner* in, VarSlot var, uint16_t* out) {
+  if (var.depth != UPVALUE_DEPTH) {
+    if (in->functions.count > 0 || var.depth != in->depth) return false;
+    *out = var.slot;
+    return true;
+  }
+
+  for (size_t level = in->functions.count; level > 0; --level) {
+    const struct InlineFunction* fn = in->functions.xs + level - 1;
+    UpvalueDesc desc = fn->upvalues->xs[var.slot];
+    if (desc.kind == UPVALUE_ENCLOSING) {
+      var.slot = desc.from.slot;
+      continue;
+    }
+
+    // Local depths start from the scope creating the closure, right above its call scope
+    if (desc.from.depth != fn->base - 1) return false;
+    *out = desc.from.slot;
+    return true;
+  }
+
+  return false;
+}
+
+// Node count of an expression reading only its parameters, constants and properties, 0 otherwise
+static size_t inlinable_size(const Expression* expr, size_t arity) {
+  size_t l, r;
+  switch (expr->type) {
+    case EXPRESSION_STATIC:
+      return 1;
+    case EXPRESSION_LITERAL:
+      if (expr->literal.type == TOKEN_TYPE_IDENTIFIER) {
+        return expr->var.depth == 0 && expr->var.slot > CALLEE_SLOT && expr->var.slot <= arity;
+      }
+      return expr->literal.type != TOKEN_TYPE_KEYWORD || (
+        expr->literal.keyword != RESERVED_KEYWORD_THIS &&
+        expr->literal.keyword != RESERVED_KEYWORD_SUPER
+      );
+    case EXPRESSION_GROUP:
+      l = inlinable_size(expr->group.child, arity);
+      return l ? l + 1 : 0;
+    case EXPRESSION_UNARY:
+      l = inlinable_size(expr->unary.child, arity);
+      return l ? l + 1 : 0;
+    case EXPRESSION_GET:
+      l = inlinable_size(expr->get.object, arity);
+      return l ? l + 1 : 0;
+    case EXPRESSION_BINARY:
+      l = inlinable_size(expr->binary.left, arity);
+      r = inlinable_size(expr->binary.right, arity);
+      return l && r ? l + r + 1 : 0;
+    default:
+      return 0;
+  }
+}
+
+static void register_candidate(struct Inliner* in, const struct StatementFunDecl* decl) {
+  // Calls of pure functions go through their cache, inlined ones wouldn't be memoized
+  if (decl->proto.pure) return;
+
+  for (size_t i = 0; i < in->assigned.count; ++i) {
+    if (in->assigned.xs[i] == decl->slot) return;
+  }
+
+  const Statements* body = &decl->proto.body->block;
+  if (body->count != 1 || body->xs[0].type != STATEMENT_RETURN) return;
+
+  size_t size = inlinable_size(body->xs[0].ret, decl->proto.params.count);
+  if (size == 0 || size > INLINE_BUDGET) return;
+
+  struct Inlinable candidate = {decl->slot, decl, size};
+  vector_push(in->candidates, candidate);
+}
+
+// Literals, variables and static doubles, reading them has no effect.
+// Strings and other statics would be reported differently by the errors they raise
+static bool is_trivial_argument(const Expression* expr) {
+  if (expr->type == EXPRESSION_STATIC) return value_type(expr->evaluated) == EVAL_TYPE_DOUBLE;
+  return expr->type == EXPRESSION_LITERAL && expr->literal.type != TOKEN_TYPE_STRING && !expression_is_super(expr);
+}
+
+// Copies src into dst, taking the child nodes from nodes. Parameters become copies of the arguments
+static void inline_copy(Expression* dst, const Expression* src, const struct CallArguments* args, Expression** nodes) {
+  if (src->type == EXPRESSION_LITERAL && src->literal.type == TOKEN_TYPE_IDENTIFIER) {
+    *dst = *args->xs[src->var.slot - CALLEE_SLOT - 1];
+    // Errors keep pointing at the parameter, the value is never read from the lexeme
+    if (dst->type == EXPRESSION_LITERAL) {
+      dst->literal.lexeme = src->literal.lexeme;
+      dst->literal.line = src->literal.line;
+    }
+    return;
+  }
+
+  *dst = *src;
+  switch (src->type) {
+    case EXPRESSION_GROUP:
+      dst->group.child = (*nodes)++;
+      inline_copy(dst->group.child, src->group.child, args, nodes);
+    break;
+    case EXPRESSION_UNARY:
+      dst->unary.child = (*nodes)++;
+      inline_copy(dst->unary.child, src->unary.child, args, nodes);
+    break;
+    case EXPRESSION_GET:
+      dst->get.object = (*nodes)++;
+      inline_copy(dst->get.object, src->get.object, args, nodes);
+    break;
+    case EXPRESSION_BINARY:
+      dst->binary.left = (*nodes)++;
+      inline_copy(dst->binary.left, src->binary.left, args, nodes);
+      dst->binary.right = (*nodes)++;
+      inline_copy(dst->binary.right, src->binary.right, args, nodes);
+    break;
+    default:
+    break;
+  }
+}
+
+static void inline_call(struct Inliner* in, Expression* expr) {
+  uint16_t slot;
+  const Expression* callee = expr->call.callee;
+  if (callee->type != EXPRESSION_LITERAL || callee->literal.type != TOKEN_TYPE_IDENTIFIER) return;
+  if (!global_slot(in, callee->var, &slot)) return;
+
+  const struct Inlinable* candidate = NULL;
+  for (size_t i = 0; i < in->candidates.count && !candidate; ++i) {
+    if (in->candidates.xs[i].slot == slot) candidate = in->candidates.xs + i;
+  }
+  if (!candidate) return;
+
+  // Wrong arities are left to the runtime, it reports the error
+  struct CallArguments args = expr->call.args;
+  if (args.count != candidate->decl->proto.params.count) return;
+  for (size_t i = 0; i < args.count; ++i) {
+    if (!is_trivial_argument(args.xs[i])) return;
+  }
+
+  // The call node becomes the root of the copy
+  Expression* nodes = NULL;
+  if (candidate->size > 1 && !(nodes = parser_new_expressions(candidate->size - 1))) return;
+
+  size_t line = expr->call.open_paren.line;
+  inline_copy(expr, candidate->decl->proto.body->block.xs[0].ret, &args, &nodes);
+  // The parser leaves the arguments of calls without any unallocated
+  if (args.count > 0) vector_free(args);
+
+  in->inlined += 1;
+  if (launch_ctx_get()->report_inlining) {
+    fprintf(stderr, "[inline] line %zu: " SV_Fmt " (%zu nodes)\n", line, SV_Fmt_arg(candidate->decl->identifier), candidate->size);
+  }
+}
+
+static void inline_statement(struct Inliner* in, Statement* stmt);
+
+static void inline_function(struct Inliner* in, FunctionProto* proto) {
+  struct InlineFunction fn = {&proto->upvalues, ++in->depth};
+  vector_push(in->functions, fn);
+
+  // The body block shares the call scope
+  for (size_t i = 0; i < proto->body->block.count; ++i) {
+    inline_statement(in, proto->body->block.xs + i);
+  }
+
+  vector_pop(in->functions);
+  --in->depth;
+}
+
+static void inline_expression(struct Inliner* in, Expression* expr) {
+  uint16_t slot;
+  switch (expr->type) {
+    case EXPRESSION_STATIC:
+    case EXPRESSION_LITERAL:
+    break;
+    case EXPRESSION_GROUP:
+      inline_expression(in, expr->group.child);
+    break;
+    case EXPRESSION_UNARY:
+      inline_expression(in, expr->unary.child);
+    break;
+    case EXPRESSION_BINARY:
+      inline_expression(in, expr->binary.left);
+      inline_expression(in, expr->binary.right);
+    break;
+    case EXPRESSION_CALL:
+      inline_expression(in, expr->call.callee);
+      for (size_t i = 0; i < expr->call.args.count; ++i) {
+        inline_expression(in, expr->call.args.xs[i]);
+      }
+      if (in->rewrite) inline_call(in, expr);
+    break;
+    case EXPRESSION_GET:
+      inline_expression(in, expr->get.object);
+    break;
+    case EXPRESSION_SET:
+      inline_expression(in, expr->set.object);
+      inline_expression(in, expr->set.right);
+    break;
+    case EXPRESSION_ASSIGNMENT:
+      inline_expression(in, expr->assignment.right);
+      if (!in->rewrite && global_slot(in, expr->var, &slot)) vector_push(in->assigned, slot);
+    break;
+    case EXPRESSION_ANON_FUN:
+      inline_function(in, &expr->anon_fun.proto);
+    break;
+  }
+}
+
+static void inline_statement(struct Inliner* in, Statement* stmt) {
+  switch (stmt->type) {
+    case STATEMENT_EXPR:
+    case STATEMENT_PRINT_EXPR:
+      inline_expression(in, stmt->expr);
+    break;
+    case STATEMENT_VAR_DECL:
+      inline_expression(in, stmt->var_decl.expr);
+    break;
+    case STATEMENT_FUN_DECL:
+      inline_function(in, &stmt->fun_decl.proto);
+      // Calls to it come after its declaration, once its own calls are inlined
+      if (in->rewrite && in->depth == 0) register_candidate(in, &stmt->fun_decl);
+    break;
+    case STATEMENT_CLASS_DECL:
+      // Subclasses' methods are created in a scope holding 'super'
+      if (stmt->class_decl.super) ++in->depth;
+      for (size_t i = 0; i < stmt->class_decl.methods_decl.count; ++i) {
+        inline_function(in, &stmt->class_decl.methods_decl.xs[i].proto);
+      }
+      if (stmt->class_decl.super) --in->depth;
+    break;
+    case STATEMENT_BLOCK:
+      ++in->depth;
+      for (size_t i = 0; i < stmt->block.count; ++i) {
+        inline_statement(in, stmt->block.xs + i);
+      }
+      --in->depth;
+    break;
+    case STATEMENT_CONDITIONAL:
+      for (size_t i = 0; i < stmt->cond.count; ++i) {
+        struct ConditionalBlock* block = stmt->cond.xs + i;
+        if (block->condition) inline_expression(in, block->condition);
+        inline_statement(in, block->branch);
+      }
+    break;
+    case STATEMENT_WHILE:
+      inline_expression(in, stmt->while_loop.condition);
+      inline_statement(in, stmt->while_loop.body);
+    break;
+    case STATEMENT_RETURN:
+      inline_expression(in, stmt->ret);
+    break;
+  }
+}
+
+static void inline_calls(Statements* stmts) {
+  struct Inliner in = {0};
+  vector_new(in.functions, 4);
+  vector_new(in.candidates, 8);
+  vector_new(in.assigned, 8);
+
+  for (int walk = 0; walk < 2; ++walk) {
+    in.rewrite = walk == 1;
+    for (size_t i = 0; i < stmts->count; ++i) {
+      inline_statement(&in, stmts->xs + i);
+    }
+  }
+
+  if (launch_ctx_get()->report_inlining) {
+    fprintf(stderr, "[inline] %zu candidates, %zu calls inlined\n", in.candidates.count, in.inlined);
+  }
+
+  vector_free(in.assigned);
+  vector_free(in.candidates);
+  vector_free(in.functions);
+}
+
+// -- Loops --
+
+// Variable as seen from a loop: scopes below the loop's scope, negative for the enclosing ones
+struct LoopVar {
+  bool upvalue;
+  int level;
+  uint16_t slot;
+};
+
+struct LoopAnalysis {
+  // scopes entered inside the loop
+  int depth;
+  // calls and closures may assign any variable they reach
+  bool has_calls;
+  bool creates_functions;
+  struct {
+    struct LoopVar* xs;
+    size_t count;
+    size_t capacity;
+  } assigned;
+};
+
+static struct LoopVar loop_var(const struct LoopAnalysis* a, VarSlot var) {
+  if (var.depth == UPVALUE_DEPTH) return (struct LoopVar){true, 0, var.slot};
+  return (struct LoopVar){false, a->depth - (int)var.depth, var.slot};
+}
+
+static bool loop_assigns(const struct LoopAnalysis* a, struct LoopVar v) {
+  for (size_t i = 0; i < a->assigned.count; ++i) {
+    const struct LoopVar* x = a->assigned.xs + i;
+    if (x->upvalue == v.upvalue && x->level == v.level && x->slot == v.slot) return true;
+  }
+  return false;
+}
+
+static bool is_variable(const Expression* expr) {
+  return expr->type == EXPRESSION_LITERAL && (
+    expr->literal.type == TOKEN_TYPE_IDENTIFIER ||
+    (expr->literal.type == TOKEN_TYPE_KEYWORD && expr->literal.keyword == RESERVED_KEYWORD_THIS)
+  );
+}
+
+static void scan_statement(struct LoopAnalysis* a, const Statement* stmt);
+
+static void scan_expression(struct LoopAnalysis* a, const Expression* expr) {
+  switch (expr->type) {
+    case EXPRESSION_STATIC:
+    case EXPRESSION_LITERAL:
+    break;
+    case EXPRESSION_GROUP:
+      scan_expression(a, expr->group.child);
+    break;
+    case EXPRESSION_UNARY:
+      scan_expression(a, expr->unary.child);
+    break;
+    case EXPRESSION_BINARY:
+      scan_expression(a, expr->binary.left);
+      scan_expression(a, expr->binary.right);
+    break;
+    case EXPRESSION_CALL:
+      a->has_calls = true;
+      scan_expression(a, expr->call.callee);
+      for (size_t i = 0; i < expr->call.args.count; ++i) {
+        scan_expression(a, expr->call.args.xs[i]);
+      }
+    break;
+    case EXPRESSION_GET:
+      scan_expression(a, expr->get.object);
+    break;
+    case EXPRESSION_SET:
+      scan_expression(a, expr->set.object);
+      scan_expression(a, expr->set.right);
+    break;
+    case EXPRESSION_ASSIGNMENT: {
+      scan_expression(a, expr->assignment.right);
+      struct LoopVar v = loop_var(a, expr->var);
+      vector_push(a->assigned, v);
+    }
+    break;
+    case EXPRESSION_ANON_FUN:
+      a->creates_functions = true;
+    break;
+  }
+}
+
+static void scan_statement(struct LoopAnalysis* a, const Statement* stmt) {
+  switch (stmt->type) {
+    case STATEMENT_EXPR:
+    case STATEMENT_PRINT_EXPR:
+      scan_expression(a, stmt->expr);
+    break;
+    case STATEMENT_VAR_DECL: {
+      // A declaration outside of a block is made again by every iteration
+      scan_expression(a, stmt->var_decl.expr);
+      struct LoopVar v = {false, a->depth, stmt->var_decl.slot};
+      vector_push(a->assigned, v);
+    }
+    break;
+    case STATEMENT_FUN_DECL:
+    case STATEMENT_CLASS_DECL:
+      a->creates_functions = true;
+    break;
+    case STATEMENT_BLOCK:
+      ++a->depth;
+      for (size_t i = 0; i < stmt->block.count; ++i) {
+        scan_statement(a, stmt->block.xs + i);
+      }
+      --a->depth;
+    break;
+    case STATEMENT_CONDITIONAL:
+      for (size_t i = 0; i < stmt->cond.count; ++i) {
+        const struct ConditionalBlock* block = stmt->cond.xs + i;
+        if (block->condition) scan_expression(a, block->condition);
+        scan_statement(a, block->branch);
+      }
+    break;
+    case STATEMENT_WHILE:
+      scan_expression(a, stmt->while_loop.condition);
+      scan_statement(a, stmt->while_loop.body);
+    break;
+    case STATEMENT_RETURN:
+      scan_expression(a, stmt->ret);
+    break;
+  }
+}
+
+// Reads only constants and the variables declared outside of the loop which it never assigns
+static bool is_invariant(const struct LoopAnalysis* a, const Expression* expr) {
+  switch (expr->type) {
+    case EXPRESSION_STATIC:
+      return true;
+    case EXPRESSION_LITERAL:
+      if (is_variable(expr)) {
+        struct LoopVar v = loop_var(a, expr->var);
+        return (v.upvalue || v.level <= 0) && !loop_assigns(a, v);
+      }
+      return !expression_is_super(expr);
+    case EXPRESSION_GROUP:
+      return is_invariant(a, expr->group.child);
+    case EXPRESSION_UNARY:
+      return is_invariant(a, expr->unary.child);
+    case EXPRESSION_BINARY:
+      return is_invariant(a, expr->binary.left) && is_invariant(a, expr->binary.right);
+    default:
+      return false;
+  }
+}
+
+// Operations on constants only are folded, not hoisted
+static bool reads_variable(const Expression* expr) {
+  switch (expr->type) {
+    case EXPRESSION_LITERAL:
+      return is_variable(expr);
+    case EXPRESSION_GROUP:
+      return reads_variable(expr->group.child);
+    case EXPRESSION_UNARY:
+      return reads_variable(expr->unary.child);
+    case EXPRESSION_BINARY:
+      return reads_variable(expr->binary.left) || reads_variable(expr->binary.right);
+    default:
+      return false;
+  }
+}
+
+// Wraps the expression in an invariant group in place, its parent is left untouched
+static void hoist(Expression* expr, struct LoopInfo* info) {
+  if (expr->type != EXPRESSION_GROUP || !expr->group.invariant) {
+    Expression* child = parser_new_expressions(1);
+    if (!child) return;
+
+    *child = *expr;
+    expr->type = EXPRESSION_GROUP;
+    expr->group = (struct Group){child, true, false, value_new_nil()};
+  }
+
+  if (info->invariants.capacity == 0) vector_new(info->invariants, 4);
+  vector_push(info->invariants, expr);
+}
+
+static void hoist_statement(struct LoopAnalysis* a, Statement* stmt, struct LoopInfo* info);
+
+static void hoist_expression(struct LoopAnalysis* a, Expression* expr, struct LoopInfo* info) {
+  bool operation = expr->type == EXPRESSION_UNARY || expr->type == EXPRESSION_BINARY ||
+    (expr->type == EXPRESSION_GROUP && expr->group.invariant);
+  if (operation && reads_variable(expr) && is_invariant(a, expr)) {
+    hoist(expr, info);
+    return;
+  }
+
+  switch (expr->type) {
+    case EXPRESSION_GROUP:
+      hoist_expression(a, expr->group.child, info);
+    break;
+    case EXPRESSION_UNARY:
+      hoist_expression(a, expr->unary.child, info);
+    break;
+    case EXPRESSION_BINARY:
+      hoist_expression(a, expr->binary.left, info);
+      hoist_expression(a, expr->binary.right, info);
+    break;
+    case EXPRESSION_GET:
+      hoist_expression(a, expr->get.object, info);
+    break;
+    case EXPRESSION_SET:
+      hoist_expression(a, expr->set.object, info);
+      hoist_expression(a, expr->set.right, info);
+    break;
+    case EXPRESSION_ASSIGNMENT:
+      hoist_expression(a, expr->assignment.right, info);
+    break;
+    default:
+    break;
+  }
+}
+
+static void hoist_statement(struct LoopAnalysis* a, Statement* stmt, struct LoopInfo* info) {
+  switch (stmt->type) {
+    case STATEMENT_EXPR:
+    case STATEMENT_PRINT_EXPR:
+      hoist_expression(a, stmt->expr, info);
+    break;
+    case STATEMENT_VAR_DECL:
+      hoist_expression(a, stmt->var_decl.expr, info);
+    break;
+    case STATEMENT_BLOCK:
+      ++a->depth;
+      for (size_t i = 0; i < stmt->block.count; ++i) {
+        hoist_statement(a, stmt->block.xs + i, info);
+      }
+      --a->depth;
+    break;
+    case STATEMENT_CONDITIONAL:
+      for (size_t i = 0; i < stmt->cond.count; ++i) {
+        struct ConditionalBlock* block = stmt->cond.xs + i;
+        if (block->condition) hoist_expression(a, block->condition, info);
+        hoist_statement(a, block->branch, info);
+      }
+    break;
+    case STATEMENT_WHILE:
+      hoist_expression(a, stmt->while_loop.condition, info);
+      hoist_statement(a, stmt->while_loop.body, info);
+    break;
+    case STATEMENT_RETURN:
+      hoist_expression(a, stmt->ret, info);
+    break;
+    default:
+    break;
+  }
+}
+
+// Loops without calls nor closures only change the variables they assign. Their invariant
+// expressions are computed by the first iteration reaching them, so errors are still raised in order
+static void hoist_invariants(Statement* stmt) {
+  struct LoopAnalysis a = {0};
+  vector_new(a.assigned, 8);
+  scan_statement(&a, stmt);
+
+  if (!a.has_calls && !a.creates_functions) {
+    hoist_expression(&a, stmt->while_loop.condition, &stmt->while_loop.info);
+    hoist_statement(&a, stmt->while_loop.body, &stmt->while_loop.info);
+  }
+
+  vector_free(a.assigned);
+}
+
+static bool is_local(const Expression* expr, uint16_t depth, uint16_t slot) {
+  return expr->type == EXPRESSION_LITERAL && expr->literal.type == TOKEN_TYPE_IDENTIFIER &&
+    expr->var.depth == depth && expr->var.slot == slot;
+}
+
+// Matches the block a 'for' with a declared counter, a '<' or '<=' condition and a constant
+// increment is desugared into. The counter lives in the block, the loop body one scope below it
+static void recognize_counted_loop(Statement* stmt) {
+  Statements* block = &stmt->block;
+  if (block->count != 2 || block->xs[0].type != STATEMENT_VAR_DECL || block->xs[1].type != STATEMENT_WHILE) return;
+
+  uint16_t counter = block->xs[0].var_decl.slot;
+  struct StatementWhile* loop = &block->xs[1].while_loop;
+
+  const Expression* cond = loop->condition;
+  if (cond->type != EXPRESSION_BINARY || !is_local(cond->binary.left, 0, counter)) return;
+  enum TokenType op = cond->binary.operator.type;
+  if (op != TOKEN_TYPE_LESS && op != TOKEN_TYPE_LESS_EQUAL) return;
+
+  if (loop->body->type != STATEMENT_BLOCK || loop->body->block.count == 0) return;
+  Statements* body = &loop->body->block;
+  const Statement* last = body->xs + body->count - 1;
+  if (last->type != STATEMENT_EXPR || last->expr->type != EXPRESSION_ASSIGNMENT) return;
+
+  const Expression* increment = last->expr;
+  const Expression* sum = increment->assignment.right;
+  Value step;
+  if (
+    increment->var.depth != 1 || increment->var.slot != counter ||
+    sum->type != EXPRESSION_BINARY || sum->binary.operator.type != TOKEN_TYPE_PLUS ||
+    !is_local(sum->binary.left, 1, counter) || !constant_as(sum->binary.right, EVAL_TYPE_DOUBLE, &step)
+  ) return;
+
+  // Read again by every iteration, its evaluation must not have effects
+  const Expression* bound = cond->binary.right;
+  Value v;
+  bool constant = constant_as(bound, EVAL_TYPE_DOUBLE, &v);
+  if (!constant && !is_variable(bound) && !(bound->type == EXPRESSION_GROUP && bound->group.invariant)) return;
+
+  struct LoopAnalysis a = {0};
+  vector_new(a.assigned, 8);
+  scan_expression(&a, cond);
+  a.depth = 1;
+  for (size_t i = 0; i + 1 < body->count; ++i) {
+    scan_statement(&a, body->xs + i);
+  }
+  a.depth = 0;
+
+  struct LoopVar counter_var = {false, 0, counter};
+  if (!loop_assigns(&a, counter_var) && !a.creates_functions) {
+    loop->info.counted = true;
+    loop->info.counter = (VarSlot){0, counter};
+    loop->info.bound = cond->binary.right;
+    loop->info.bound_invariant = constant || bound->type == EXPRESSION_GROUP || (!a.has_calls && is_invariant(&a, bound));
+    loop->info.inclusive = op == TOKEN_TYPE_LESS_EQUAL;
+    loop->info.step = value_as_double(step);
+  }
+
+  vector_free(a.assigned);
+}
+
+static void optimize_loops(Statement* stmt) {
+  if (stmt->type == STATEMENT_WHILE) hoist_invariants(stmt);
+  else if (stmt->type == STATEMENT_BLOCK) recognize_counted_loop(stmt);
+}
+
+static const struct Pass passes[] = {
+  {1, collapse_group, NULL},
+  {1, fold_constants, NULL},
+  {2, NULL, prune_branches},
+  {2, NULL, optimize_loops},
+};
+
+void optimize(Statements* stmts, int level) {
+  if (level >= 2) inline_calls(stmts);
+
+  for (size_t p = 0; p < sizeof(passes) / sizeof(*passes); ++p) {
+    if (passes[p].level > level) continue;
+
+    for (size_t i = 0; i < stmts->count; ++i) {
+      walk_statement(stmts->xs + i, passes + p);
+    }
+  }
+
+  if (level >= 2) remove_empty_blocks(stmts);
+}
@@ -0,0 +1,19 @@
+#ifndef _OPTIMIZER_H
+#define _OPTIMIZER_H
+
+#include "types/statements.h"
+#include "types/expressions.h"
+
+#define OPTIMIZER_DEFAULT_LEVEL 1
+#define OPTIMIZER_MAX_LEVEL 2
+
+// Rewrites the statements in place with the passes enabled at the given -O level:
+// - 0: nothing
+// - 1: collapses groups and folds operations on constants into static expressions
+// - 2: also inlines calls to small leaf functions, removes the branches of conditionals
+//   and the loops whose condition is constant, hoists loop invariant expressions and
+//   recognizes counted for loops
+// Runs after resolve, removed code is still checked for static errors
+void optimize(Statements* stmts, int level);
+
+#endif
@@ -17,7 +17,7 @@ static struct Parser parser;
 Token* find_token(Expression* expr) {
   switch (expr->type) {
     case EXPRESSION_STATIC:
-      return NULL;
+      return expr->origin;
     case EXPRESSION_LITERAL:
       return &expr->literal;
     case EXPRESSION_GROUP:
@@ -44,6 +44,64 @@ void parser_init() {
   Arena areana = arena_init(sizeof(Expression) * MAX_EXPR, alignof(Expression));
   parser.alloc = areana;
   parser.panic = false;
+
+  vector_new(parser.constants, 16);
+  parser.constants.index_capacity = 32;
+  parser.constants.index = calloc(parser.constants.index_capacity, sizeof(uint32_t));
+}
+
+const Value* parser_constants() {
+  return parser.constants.xs;
+}
+
+Expression* parser_new_expressions(size_t count) {
+  // Checked up front, the arena reports failed allocations
+  if (parser.alloc.offset + parser.alloc.align + count * sizeof(Expression) > parser.alloc.buf_sz) return NULL;
+  return arena_alloc(&parser.alloc, count * sizeof(Expression));
+}
+
+static size_t constant_hash(Value v, size_t capacity) {
+  uint64_t h = v.bits;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h & (capacity - 1);
+}
+
+static void constant_index_insert(struct ConstantPool* pool, uint32_t idx) {
+  size_t bucket = constant_hash(pool->xs[idx], pool->index_capacity);
+  while (pool->index[bucket]) {
+    bucket = (bucket + 1) & (pool->index_capacity - 1);
+  }
+  pool->index[bucket] = idx + 1;
+}
+
+// Strings are interned, identical literals are the same value
+static uint32_t add_constant(Value v) {
+  struct ConstantPool* pool = &parser.constants;
+
+  size_t bucket = constant_hash(v, pool->index_capacity);
+  while (pool->index[bucket]) {
+    uint32_t idx = pool->index[bucket] - 1;
+    if (pool->xs[idx].bits == v.bits) return idx;
+    bucket = (bucket + 1) & (pool->index_capacity - 1);
+  }
+
+  vector_push(*pool, v);
+  uint32_t idx = (uint32_t)(pool->count - 1);
+
+  if (pool->count * 2 > pool->index_capacity) {
+    free(pool->index);
+    pool->index_capacity *= 2;
+    pool->index = calloc(pool->index_capacity, sizeof(uint32_t));
+    for (uint32_t i = 0; i < pool->count; ++i) {
+      constant_index_insert(pool, i);
+    }
+  } else {
+    pool->index[bucket] = idx + 1;
+  }
+
+  return idx;
 }
 
 // Deallocates all statements
@@ -58,6 +116,8 @@ void parser_free(Statements* stmts) {
   vector_free(*stmts);
 
   arena_free(&parser.alloc);
+  vector_free(parser.constants);
+  free(parser.constants.index);
 }
 
 static bool is_factor_op(Token* token) {
@@ -172,6 +232,7 @@ static void recover(struct TokensCursor* cursor) {
       switch (t->keyword) {
         case RESERVED_KEYWORD_CLASS:
         case RESERVED_KEYWORD_FUN:
+        case RESERVED_KEYWORD_PURE:
         case RESERVED_KEYWORD_IF:
         case RESERVED_KEYWORD_ELSE:
         case RESERVED_KEYWORD_FOR:
@@ -199,6 +260,7 @@ static bool is_decl_statement(struct TokensCursor* cursor) {
     t->type == TOKEN_TYPE_KEYWORD && (
       t->keyword == RESERVED_KEYWORD_VAR ||
       t->keyword == RESERVED_KEYWORD_FUN ||
+      t->keyword == RESERVED_KEYWORD_PURE ||
       t->keyword == RESERVED_KEYWORD_CLASS
     );
 }
@@ -207,6 +269,7 @@ static bool is_decl_statement(struct TokensCursor* cursor) {
 Expression* static_expr_bool(bool value) {
   Expression* e = arena_alloc(&parser.alloc, sizeof(Expression));
   e->type = EXPRESSION_STATIC;
+  e->origin = NULL;
   e->evaluated = value_new_bool(value);
   return e;
 }
@@ -257,20 +320,22 @@ static Expression* parse_primary(struct TokensCursor* cursor) {
         case RESERVED_KEYWORD_FUN:
           expr->type = EXPRESSION_ANON_FUN;
           expr->anon_fun.fun_kw = token;
+          expr->anon_fun.proto.pure = false;
+          expr->anon_fun.proto.name = (StringView){0};
 
           advance(cursor);
           consume(cursor, TOKEN_TYPE_LEFT_PAREN, "Expected opening parentheses after 'fun' keyword");
 
           if (token_at(cursor)->type == TOKEN_TYPE_RIGHT_PAREN) {
-            vector_empty(expr->anon_fun.params);
+            vector_empty(expr->anon_fun.proto.params);
           } else {
-            vector_new(expr->anon_fun.params, 1);
+            vector_new(expr->anon_fun.proto.params, 1);
 
             // Parse params
             Token* t = token_at(cursor);
             while (!is_at_end(cursor)) {
               Token* param = consume(cursor, TOKEN_TYPE_IDENTIFIER, "Expected identifier as function parameter");
-              vector_push(expr->anon_fun.params, param->lexeme);
+              vector_push(expr->anon_fun.proto.params, param->lexeme);
               if (is_at_end(cursor) || token_at(cursor)->type == TOKEN_TYPE_RIGHT_PAREN) break;
               else {
                 consume(cursor, TOKEN_TYPE_COMMA, "Expected ',' separator between function parameters");
@@ -287,21 +352,24 @@ static Expression* parse_primary(struct TokensCursor* cursor) {
             set_panic(cursor);
             return NULL;
           }
-          expr->anon_fun.body = parse_statement_block(advance(cursor));
+          expr->anon_fun.proto.body = parse_statement_block(advance(cursor));
 
           break;
         case RESERVED_KEYWORD_TRUE:
           expr->type = EXPRESSION_STATIC;
+          expr->origin = NULL;
           expr->evaluated = value_new_bool(true);
           advance(cursor);
           break;
         case RESERVED_KEYWORD_FALSE:
           expr->type = EXPRESSION_STATIC;
+          expr->origin = NULL;
           expr->evaluated = value_new_bool(false);
           advance(cursor);
           break;
         case RESERVED_KEYWORD_NIL:
           expr->type = EXPRESSION_STATIC;
+          expr->origin = NULL;
           expr->evaluated = value_new_nil();
           advance(cursor);
           break;
@@ -323,16 +391,25 @@ static Expression* parse_primary(struct TokensCursor* cursor) {
       if (strncmp(token->lexeme.str, "fn", 2) == 0) {
         syntax_warning(token, "'fn' is not a valid keyword, perhaps you meant to use 'fun' ?");
       }
-      // Do not break here !! We want to leak to TOKEN_TYPE_NUMBER case
+      expr->type = EXPRESSION_LITERAL;
+      expr->literal = *token;
+      advance(cursor);
+    break;
     case TOKEN_TYPE_STRING:
+      expr->type = EXPRESSION_LITERAL;
+      expr->literal = *token;
+      expr->constant = add_constant(value_new_stringview(token->content));
+      advance(cursor);
+    break;
     case TOKEN_TYPE_NUMBER:
       expr->type = EXPRESSION_LITERAL;
       expr->literal = *token;
+      expr->constant = add_constant(value_new_double(number_to_double(token->value)));
       advance(cursor);
     break;
     case TOKEN_TYPE_LEFT_PAREN:
       expr->type = EXPRESSION_GROUP;
-      expr->group.child = parse_expression(advance(cursor)); 
+      expr->group = (struct Group){ parse_expression(advance(cursor)), false, false, value_new_nil() };
       consume(cursor, TOKEN_TYPE_RIGHT_PAREN, "Missing closing parentheses");
     break;
 
@@ -378,6 +455,7 @@ static Expression* parse_call(struct TokensCursor* cursor) {
       expr->type = EXPRESSION_CALL;
       expr->call.open_paren = *token_at(cursor);
       expr->call.callee = callee;
+      expr->call.is_tail = false;
       parse_arguments(cursor, &expr->call.args);
       if (expr->call.args.count > MAX_CALL_ARGS) {
         static_error(token_at(cursor), "Function call exceeds number of arguments: %d", MAX_CALL_ARGS);
@@ -390,6 +468,7 @@ static Expression* parse_call(struct TokensCursor* cursor) {
       expr->type = EXPRESSION_GET;
       expr->get.object = object;
       expr->get.name = *consume(cursor, TOKEN_TYPE_IDENTIFIER, "Expected identifier after '.'");
+      expr->get.cache = (PropertyCache){0};
     } else {
       break;
     }
@@ -418,6 +497,7 @@ static Expression* parse_factor(struct TokensCursor* cursor) {
     bin->type = EXPRESSION_BINARY;
     bin->binary.operator = *token_at(cursor);
     bin->binary.left = expr;
+    bin->binary.specialization = BINARY_UNINITIALIZED;
     bin->binary.right = parse_unary(advance(cursor));
 
     expr = bin;
@@ -434,6 +514,7 @@ static Expression* parse_term(struct TokensCursor* cursor) {
     bin->type = EXPRESSION_BINARY;
     bin->binary.operator = *token_at(cursor);
     bin->binary.left = expr;
+    bin->binary.specialization = BINARY_UNINITIALIZED;
     bin->binary.right = parse_factor(advance(cursor));
 
     expr = bin;
@@ -450,6 +531,7 @@ static Expression* parse_comparison(struct TokensCursor* cursor) {
     bin->type = EXPRESSION_BINARY;
     bin->binary.operator = *token_at(cursor);
     bin->binary.left = expr;
+    bin->binary.specialization = BINARY_UNINITIALIZED;
     bin->binary.right = parse_term(advance(cursor));
 
     expr = bin;
@@ -466,6 +548,7 @@ static Expression* parse_equality(struct TokensCursor* cursor) {
     bin->type = EXPRESSION_BINARY;
     bin->binary.operator = *token_at(cursor);
     bin->binary.left = expr;
+    bin->binary.specialization = BINARY_UNINITIALIZED;
     bin->binary.right = parse_comparison(advance(cursor));
 
     expr = bin;
@@ -482,6 +565,7 @@ static Expression* parse_logical_and(struct TokensCursor* cursor) {
     bin->type = EXPRESSION_BINARY;
     bin->binary.operator = *token_at(cursor);
     bin->binary.left = expr;
+    bin->binary.specialization = BINARY_UNINITIALIZED;
     bin->binary.right = parse_equality(advance(cursor));
 
     expr = bin;
@@ -498,6 +582,7 @@ static Expression* parse_logical_or(struct TokensCursor* cursor) {
     bin->type = EXPRESSION_BINARY;
     bin->binary.operator = *token_at(cursor);
     bin->binary.left = expr;
+    bin->binary.specialization = BINARY_UNINITIALIZED;
     bin->binary.right = parse_logical_and(advance(cursor));
 
     expr = bin;
@@ -518,6 +603,7 @@ static Expression* parse_assignment(struct TokensCursor* cursor) {
       // No-ops
       expr->set.object  =  expr->get.object;
       expr->set.name    =  expr->get.name;
+      expr->set.cache   =  expr->get.cache;
 
       expr->set.right = parse_assignment(advance(cursor));
     } else if (expr->type == EXPRESSION_LITERAL) {
@@ -570,24 +656,26 @@ static Statement* parse_statement_var_decl(struct TokensCursor* cursor) {
   return stmt;
 }
 
-static Statement* parse_statement_fun_decl(struct TokensCursor* cursor) {
+// pure is set for 'pure fun' declarations, the cursor is on the identifier
+static Statement* parse_statement_fun_decl(struct TokensCursor* cursor, bool pure) {
   Token* identifier = consume(cursor, TOKEN_TYPE_IDENTIFIER, "Expected function identifier");
 
   Statement* stmt = arena_alloc(&parser.alloc, sizeof(Statement));
   stmt->type = STATEMENT_FUN_DECL;
   stmt->fun_decl.identifier = identifier->lexeme;
-
+  stmt->fun_decl.proto.pure = pure;
+  stmt->fun_decl.proto.name = identifier->lexeme;
 
   consume(cursor, TOKEN_TYPE_LEFT_PAREN, "Missing opening parentheses after function identifier");
   if (token_at(cursor)->type == TOKEN_TYPE_RIGHT_PAREN) {
-    vector_empty(stmt->fun_decl.params);
+    vector_empty(stmt->fun_decl.proto.params);
   } else {
-    vector_new(stmt->fun_decl.params, 1);
+    vector_new(stmt->fun_decl.proto.params, 1);
     // parse params
     Token* t = token_at(cursor);
     while (!is_at_end(cursor)) {
       Token* param = consume(cursor, TOKEN_TYPE_IDENTIFIER, "Expected identifier as function parameter");
-      vector_push(stmt->fun_decl.params, param->lexeme);
+      vector_push(stmt->fun_decl.proto.params, param->lexeme);
 
       if (token_at(cursor)->type == TOKEN_TYPE_RIGHT_PAREN) break;
       else {
@@ -605,7 +693,7 @@ static Statement* parse_statement_fun_decl(struct TokensCursor* cursor) {
     return NULL;
   }
 
-  stmt->fun_decl.body = parse_statement_block(advance(cursor));
+  stmt->fun_decl.proto.body = parse_statement_block(advance(cursor));
 
   return stmt;
 }
@@ -617,7 +705,17 @@ static Statement* parse_statement_method_decl(struct TokensCursor* cursor) {
     return NULL;
   }
 
-  return parse_statement_fun_decl(cursor);
+  return parse_statement_fun_decl(cursor, false);
+}
+
+static Statement* parse_statement_pure_fun_decl(struct TokensCursor* cursor) {
+  if (!is_keyword(cursor, RESERVED_KEYWORD_FUN)) {
+    syntax_error(token_at(cursor), "Expected 'fun' keyword after 'pure'");
+    set_panic(cursor);
+    return NULL;
+  }
+
+  return parse_statement_fun_decl(advance(cursor), true);
 }
 
 static Statement* parse_statement_class_decl(struct TokensCursor* cursor) {
@@ -655,7 +753,9 @@ static Statement* parse_statement_decl(struct TokensCursor* cursor) {
       case RESERVED_KEYWORD_VAR:
         return parse_statement_var_decl(advance(cursor));
       case RESERVED_KEYWORD_FUN:
-        return parse_statement_fun_decl(advance(cursor));
+        return parse_statement_fun_decl(advance(cursor), false);
+      case RESERVED_KEYWORD_PURE:
+        return parse_statement_pure_fun_decl(advance(cursor));
       case RESERVED_KEYWORD_CLASS:
         return parse_statement_class_decl(advance(cursor));
       default:
@@ -725,6 +825,7 @@ static Statement* parse_statement_while(struct TokensCursor* cursor) {
   s->type = STATEMENT_WHILE;
   s->while_loop.condition = parse_expression(cursor);
   s->while_loop.body = parse_statement(cursor);
+  s->while_loop.info = (struct LoopInfo){0};
   return s;
 }
 
@@ -741,6 +842,7 @@ static Statement* parse_statement_for(struct TokensCursor* cursor) {
 
   Statement* wheel = arena_alloc(&parser.alloc, sizeof(Statement));
   wheel->type = STATEMENT_WHILE;
+  wheel->while_loop.info = (struct LoopInfo){0};
 
   if (token_at(cursor)->type != TOKEN_TYPE_SEMICOLON) {
     Expression* condition = parse_expression(cursor);
@@ -931,15 +1033,17 @@ void expression_pretty_print(Expression* expr) {
     break;
     case EXPRESSION_ANON_FUN:
       printf("(Anonymous function(");
-      for (size_t i = 0; i < expr->anon_fun.params.count; ++i) {
-        printf(SV_Fmt, SV_Fmt_arg(expr->anon_fun.params.xs[i]));
-        if (i < expr->anon_fun.params.count-1)
+      for (size_t i = 0; i < expr->anon_fun.proto.params.count; ++i) {
+        printf(SV_Fmt, SV_Fmt_arg(expr->anon_fun.proto.params.xs[i]));
+        if (i < expr->anon_fun.proto.params.count-1)
           printf(", ");
       }
       printf("))");
     break;
     case EXPRESSION_STATIC:
-     printf("(Static expression)");
+      printf("(Static ");
+      value_pretty_print(&expr->evaluated);
+      printf(")");
     break;
     default:
       break;
@@ -973,15 +1077,15 @@ void statement_pretty_print(Statement* stmt) {
       printf(")\n");
     break;
     case STATEMENT_FUN_DECL:
-      printf("STATEMENT FUN DECLARATION: ");
+      printf(stmt->fun_decl.proto.pure ? "STATEMENT PURE FUN DECLARATION: " : "STATEMENT FUN DECLARATION: ");
       printf("(Identifier => "SV_Fmt" ; Params => ", SV_Fmt_arg(stmt->fun_decl.identifier));
-      for (size_t i = 0; i < stmt->fun_decl.params.count; ++i) {
-        printf(SV_Fmt, SV_Fmt_arg(stmt->fun_decl.params.xs[i]));
-        if (i < stmt->fun_decl.params.count - 1)
+      for (size_t i = 0; i < stmt->fun_decl.proto.params.count; ++i) {
+        printf(SV_Fmt, SV_Fmt_arg(stmt->fun_decl.proto.params.xs[i]));
+        if (i < stmt->fun_decl.proto.params.count - 1)
           printf(", ");
       }
       printf(")\n\t");
-      statement_pretty_print(stmt->fun_decl.body);
+      statement_pretty_print(stmt->fun_decl.proto.body);
     break;
     case STATEMENT_CLASS_DECL:
       printf("STATEMENT CLASS \""SV_Fmt"\" DECLARATION:\n", SV_Fmt_arg(stmt->class_decl.identifier));
@@ -991,9 +1095,9 @@ void statement_pretty_print(Statement* stmt) {
       for (size_t i = 0; i < stmt->class_decl.methods_decl.count; ++i) {
         StatementMethodDecl* method = stmt->class_decl.methods_decl.xs + i;
         printf("\t(Identifier => "SV_Fmt" ; Params => ", SV_Fmt_arg(method->identifier));
-        for (size_t p = 0; p < method->params.count; ++p) {
-          printf(SV_Fmt, SV_Fmt_arg(method->params.xs[i]));
-          if (i < method->params.count - 1)
+        for (size_t p = 0; p < method->proto.params.count; ++p) {
+          printf(SV_Fmt, SV_Fmt_arg(method->proto.params.xs[p]));
+          if (p < method->proto.params.count - 1)
             printf(", ");
         }
         printf(")\n");
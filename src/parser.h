@@ -8,9 +8,20 @@
 #include "types/statements.h"
 #include "types/expressions.h"
 
+// Literals decoded once while parsing, identical ones share an entry
+struct ConstantPool {
+  Value* xs;
+  size_t count;
+  size_t capacity;
+  // Open addressing table of indices in xs plus one, 0 for free buckets. Kept at most half full
+  uint32_t* index;
+  size_t index_capacity;
+};
+
 struct Parser {
   Arena alloc;
   bool panic;
+  struct ConstantPool constants;
 };
 
 bool is_non_declarative_statement(Statement* stmt);
@@ -23,6 +34,10 @@ void parser_init();
 void parser_free(Statements* stmts);
 bool parse(Token* tokens, size_t num_tokens, Statements* stmts);
 void expression_pretty_print(Expression* expr);
+// Constants of the parsed program, literal expressions hold their index. Valid until parser_free
+const Value* parser_constants();
+// Room for count expressions created by passes rewriting the tree, NULL when the arena is full. Valid until parser_free
+Expression* parser_new_expressions(size_t count);
 void statement_pretty_print(Statement* stmt);
 
 #endif
@@ -0,0 +1,488 @@
+#include "resolver.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "parser.h"
+#include "types/vector.h"
+#include "types/token.h"
+#include "error/analysis.h"
+
+// The resolver mirrors the scopes created at runtime:
+// - the global scope
+// - a scope per block
+// - a call scope holding the callee, the parameters and the function body's declarations
+// A function only walks up its own scopes, anything declared outside of it is an upvalue.
+// Methods declare 'this' in their call scope, after the parameters. The methods of a subclass
+// are wrapped in a scope declaring 'super', they capture it like any other variable
+
+struct Binding {
+  StringView name;
+  uint16_t slot;
+};
+
+struct ResolverScope {
+  struct Binding* xs;
+  size_t count;
+  size_t capacity;
+  // a closure captures one of the bindings
+  bool captured;
+  // of the block or function creating the scope, NULL for the global and 'super' scopes
+  ScopeLayout* layout;
+};
+
+struct FunctionContext {
+  // index of the function's call scope in the resolver scopes
+  size_t base;
+  bool is_method;
+  struct UpvalueDescs* upvalues;
+  // slot of 'this' in a method's call scope
+  uint16_t receiver;
+  // captures a variable that isn't a global
+  bool captures_locals;
+};
+
+// Upvalues of a function between the global scope and a global it uses before its declaration
+struct GlobalCapture {
+  struct UpvalueDescs* upvalues;
+  // of the function's call scope in the resolver scopes
+  size_t base;
+};
+
+// Identifier used in a function before the global it refers to is declared, resolved once the
+// whole script is: the function may only be called after the declaration
+struct PendingGlobal {
+  Token* at;
+  bool assignment;
+  VarSlot* out;
+  // Outermost function first
+  struct {
+    struct GlobalCapture* xs;
+    size_t count;
+    size_t capacity;
+  } captures;
+};
+
+enum ClassKind {
+  CLASS_KIND_NONE,
+  CLASS_KIND_CLASS,
+  CLASS_KIND_SUBCLASS,
+};
+
+struct Resolver {
+  struct {
+    struct ResolverScope* xs;
+    size_t count;
+    size_t capacity;
+  } scopes;
+  struct {
+    struct FunctionContext* xs;
+    size_t count;
+    size_t capacity;
+  } functions;
+  struct {
+    struct PendingGlobal* xs;
+    size_t count;
+    size_t capacity;
+  } pending_globals;
+  enum ClassKind class_kind;
+  bool had_error;
+};
+
+// Never matches an identifier, used for slots that can't be referenced by name
+static const StringView HIDDEN_NAME = {"", 0};
+
+static void resolve_expression(struct Resolver* r, Expression* expr);
+static void resolve_statement(struct Resolver* r, Statement* stmt);
+
+static void begin_scope(struct Resolver* r, ScopeLayout* layout) {
+  struct ResolverScope scope;
+  vector_new(scope, 8);
+  scope.captured = false;
+  scope.layout = layout;
+  vector_push(r->scopes, scope);
+}
+
+static void end_scope(struct Resolver* r) {
+  struct ResolverScope* scope = r->scopes.xs + r->scopes.count - 1;
+  if (scope->layout) {
+    *scope->layout = (ScopeLayout){(uint16_t)scope->count, scope->captured};
+  }
+
+  vector_free(*scope);
+  vector_pop(r->scopes);
+}
+
+// Every declaration takes a new slot, a redeclared name shadows the previous one
+static uint16_t declare(struct Resolver* r, StringView name, Token* at) {
+  struct ResolverScope* scope = r->scopes.xs + r->scopes.count - 1;
+  if (scope->count >= UINT16_MAX) {
+    static_error(at, "Too many declarations in one scope");
+    r->had_error = true;
+    return 0;
+  }
+
+  struct Binding binding = {name, (uint16_t)scope->count};
+  vector_push(*scope, binding);
+  return binding.slot;
+}
+
+static uint16_t add_upvalue(struct Resolver* r, struct UpvalueDescs* upvalues, UpvalueDesc desc) {
+  for (size_t i = 0; i < upvalues->count; ++i) {
+    UpvalueDesc* u = upvalues->xs + i;
+    if (u->kind == desc.kind && u->from.depth == desc.from.depth && u->from.slot == desc.from.slot) {
+      return (uint16_t)i;
+    }
+  }
+
+  if (upvalues->count >= UINT16_MAX) {
+    static_error(NULL, "Too many captured variables in one function");
+    r->had_error = true;
+    return 0;
+  }
+
+  vector_push(*upvalues, desc);
+  return (uint16_t)(upvalues->count - 1);
+}
+
+// Captures the value at slot of the resolver scope scope_idx, declared outside of the function at fn_level
+static uint16_t resolve_upvalue(struct Resolver* r, size_t fn_level, size_t scope_idx, uint16_t slot) {
+  struct FunctionContext* fn = r->functions.xs + fn_level;
+  struct FunctionContext* enclosing = fn - 1;
+  if (scope_idx > 0) fn->captures_locals = true;
+
+  UpvalueDesc desc;
+  if (scope_idx >= enclosing->base) {
+    // The closure is created in the scope right below its call scope
+    desc = (UpvalueDesc){UPVALUE_LOCAL, {(uint16_t)(fn->base - 1 - scope_idx), slot}};
+    r->scopes.xs[scope_idx].captured = true;
+  } else {
+    desc = (UpvalueDesc){UPVALUE_ENCLOSING, {0, resolve_upvalue(r, fn_level - 1, scope_idx, slot)}};
+  }
+
+  return add_upvalue(r, fn->upvalues, desc);
+}
+
+static bool lookup(struct Resolver* r, StringView name, VarSlot* out) {
+  size_t fn_level = r->functions.count - 1;
+
+  for (size_t depth = 0; depth < r->scopes.count; ++depth) {
+    size_t scope_idx = r->scopes.count - 1 - depth;
+    struct ResolverScope* scope = r->scopes.xs + scope_idx;
+
+    for (size_t i = scope->count; i > 0; --i) {
+      struct Binding* b = scope->xs + i - 1;
+      if (!sv_eq(b->name, name)) continue;
+
+      if (scope_idx >= r->functions.xs[fn_level].base) {
+        *out = (VarSlot){(uint16_t)depth, b->slot};
+      } else {
+        *out = (VarSlot){UPVALUE_DEPTH, resolve_upvalue(r, fn_level, scope_idx, b->slot)};
+      }
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Functions can use the globals declared after them, which lets top-level functions call each other
+static bool lookup_or_defer(struct Resolver* r, Token* at, bool assignment, VarSlot* out) {
+  if (lookup(r, at->lexeme, out)) return true;
+  if (r->functions.count == 1) return false;
+
+  struct PendingGlobal pending = {at, assignment, out};
+  vector_new(pending.captures, r->functions.count - 1);
+  for (size_t i = 1; i < r->functions.count; ++i) {
+    struct GlobalCapture capture = {r->functions.xs[i].upvalues, r->functions.xs[i].base};
+    vector_push(pending.captures, capture);
+  }
+  vector_push(r->pending_globals, pending);
+  return true;
+}
+
+// The last declaration of the name is the one visible once the script has run up to the call
+static void resolve_pending_globals(struct Resolver* r) {
+  const struct ResolverScope* globals = r->scopes.xs;
+
+  for (size_t i = 0; i < r->pending_globals.count; ++i) {
+    struct PendingGlobal* pending = r->pending_globals.xs + i;
+
+    const struct Binding* binding = NULL;
+    for (size_t k = globals->count; k > 0 && !binding; --k) {
+      if (sv_eq(globals->xs[k - 1].name, pending->at->lexeme)) binding = globals->xs + k - 1;
+    }
+
+    if (!binding) {
+      static_error(pending->at, pending->assignment
+        ? "Assignement failed. Variable must be declared with the 'var' keyword first"
+        : "Unresolved identifier");
+      r->had_error = true;
+    } else {
+      const struct GlobalCapture* outermost = pending->captures.xs;
+      UpvalueDesc desc = {UPVALUE_LOCAL, {(uint16_t)(outermost->base - 1), binding->slot}};
+      uint16_t upvalue = add_upvalue(r, outermost->upvalues, desc);
+      for (size_t k = 1; k < pending->captures.count; ++k) {
+        desc = (UpvalueDesc){UPVALUE_ENCLOSING, {0, upvalue}};
+        upvalue = add_upvalue(r, pending->captures.xs[k].upvalues, desc);
+      }
+      *pending->out = (VarSlot){UPVALUE_DEPTH, upvalue};
+    }
+
+    vector_free(pending->captures);
+  }
+}
+
+static void resolve_function(struct Resolver* r, StringView callee_name, FunctionProto* proto, bool is_method) {
+  vector_new(proto->upvalues, 1);
+
+  begin_scope(r, &proto->scope);
+  struct FunctionContext fn = {r->scopes.count - 1, is_method, &proto->upvalues, 0, false};
+  vector_push(r->functions, fn);
+
+  uint16_t callee_slot = declare(r, callee_name, NULL);
+  assert(callee_slot == CALLEE_SLOT && "Callee must be the first value of a call scope");
+
+  for (size_t i = 0; i < proto->params.count; ++i) {
+    declare(r, proto->params.xs[i], NULL);
+  }
+
+  if (is_method) {
+    uint16_t receiver = declare(r, HIDDEN_NAME, NULL);
+    assert(receiver == RECEIVER_SLOT(proto->params.count) && "Receiver must follow the parameters");
+    r->functions.xs[r->functions.count - 1].receiver = receiver;
+  }
+
+  // The body block shares the call scope
+  for (size_t i = 0; i < proto->body->block.count; ++i) {
+    resolve_statement(r, proto->body->block.xs + i);
+  }
+
+  bool captures_locals = r->functions.xs[r->functions.count - 1].captures_locals;
+  vector_pop(r->functions);
+  end_scope(r);
+
+  // Results are cached on the arguments alone, the variables of an enclosing function differ
+  // between the closures created from the declaration. Globals are left to the programmer
+  if (proto->pure && captures_locals) {
+    static_error(NULL, "Pure function '" SV_Fmt "' can't capture variables", SV_Fmt_arg(proto->name));
+    r->had_error = true;
+  }
+
+  // A plain function invoked on an instance still gets the receiver bound after its parameters
+  uint16_t receiver_size = RECEIVER_SLOT(proto->params.count) + 1;
+  if (proto->scope.size < receiver_size) proto->scope.size = receiver_size;
+  // The body runs in the call scope
+  proto->body->scope = proto->scope;
+}
+
+bool expression_is_super(const Expression* expr) {
+  return expr->type == EXPRESSION_LITERAL && expr->literal.type == TOKEN_TYPE_KEYWORD && expr->literal.keyword == RESERVED_KEYWORD_SUPER;
+}
+
+// 'this' is declared by the closest method, captured like any other variable by the functions inside it
+static void resolve_this(struct Resolver* r, VarSlot* out) {
+  size_t fn_level = r->functions.count - 1;
+  size_t method_level = fn_level;
+  while (!r->functions.xs[method_level].is_method) --method_level;
+
+  const struct FunctionContext* method = r->functions.xs + method_level;
+  if (method_level == fn_level) {
+    *out = (VarSlot){(uint16_t)(r->scopes.count - 1 - method->base), method->receiver};
+  } else {
+    *out = (VarSlot){UPVALUE_DEPTH, resolve_upvalue(r, fn_level, method->base, method->receiver)};
+  }
+}
+
+static void resolve_identifier(struct Resolver* r, Expression* expr) {
+  Token* token = &expr->literal;
+
+  if (token->type == TOKEN_TYPE_KEYWORD) {
+    if (token->keyword == RESERVED_KEYWORD_THIS && r->class_kind == CLASS_KIND_NONE) {
+      static_error(token, "Can't use 'this' outside of a class");
+      r->had_error = true;
+      return;
+    }
+
+    if (token->keyword == RESERVED_KEYWORD_SUPER && r->class_kind != CLASS_KIND_SUBCLASS) {
+      static_error(token, "Can't use 'super' in a class with no superclass");
+      r->had_error = true;
+      return;
+    }
+
+    if (token->keyword == RESERVED_KEYWORD_THIS) {
+      resolve_this(r, &expr->var);
+      return;
+    }
+  }
+
+  if (!lookup_or_defer(r, token, false, &expr->var)) {
+    static_error(token, "Unresolved identifier");
+    r->had_error = true;
+  }
+}
+
+static void resolve_expression(struct Resolver* r, Expression* expr) {
+  switch (expr->type) {
+    case EXPRESSION_STATIC:
+    break;
+    case EXPRESSION_LITERAL:
+      if (
+        expr->literal.type == TOKEN_TYPE_IDENTIFIER ||
+        (expr->literal.type == TOKEN_TYPE_KEYWORD && (
+          expr->literal.keyword == RESERVED_KEYWORD_THIS ||
+          expr->literal.keyword == RESERVED_KEYWORD_SUPER
+        ))
+      ) {
+        resolve_identifier(r, expr);
+      }
+    break;
+    case EXPRESSION_GROUP:
+      resolve_expression(r, expr->group.child);
+    break;
+    case EXPRESSION_UNARY:
+      resolve_expression(r, expr->unary.child);
+    break;
+    case EXPRESSION_BINARY:
+      resolve_expression(r, expr->binary.left);
+      resolve_expression(r, expr->binary.right);
+    break;
+    case EXPRESSION_CALL:
+      resolve_expression(r, expr->call.callee);
+      for (size_t i = 0; i < expr->call.args.count; ++i) {
+        resolve_expression(r, expr->call.args.xs[i]);
+      }
+    break;
+    case EXPRESSION_GET:
+      resolve_expression(r, expr->get.object);
+      // Gets through 'super' run the superclass' method on 'this'
+      if (expression_is_super(expr->get.object) && r->class_kind == CLASS_KIND_SUBCLASS) {
+        resolve_this(r, &expr->var);
+      }
+    break;
+    case EXPRESSION_SET:
+      resolve_expression(r, expr->set.object);
+      resolve_expression(r, expr->set.right);
+    break;
+    case EXPRESSION_ASSIGNMENT:
+      resolve_expression(r, expr->assignment.right);
+      if (!lookup_or_defer(r, &expr->assignment.name, true, &expr->var)) {
+        static_error(&expr->assignment.name, "Assignement failed. Variable must be declared with the 'var' keyword first");
+        r->had_error = true;
+      }
+    break;
+    case EXPRESSION_ANON_FUN:
+      resolve_function(r, HIDDEN_NAME, &expr->anon_fun.proto, false);
+    break;
+  }
+}
+
+static void resolve_statement_class_decl(struct Resolver* r, Statement* stmt) {
+  struct StatementClassDecl* decl = &stmt->class_decl;
+  enum ClassKind enclosing = r->class_kind;
+  r->class_kind = CLASS_KIND_CLASS;
+
+  if (decl->super) {
+    Token* super_token = &decl->super->literal;
+    if (sv_eq(decl->identifier, super_token->lexeme)) {
+      static_error(super_token, "A class can't inherit from itself");
+      r->had_error = true;
+    } else {
+      resolve_identifier(r, decl->super);
+    }
+
+    r->class_kind = CLASS_KIND_SUBCLASS;
+  }
+
+  if (decl->super) {
+    begin_scope(r, NULL);
+    declare(r, sv_new("super"), NULL);
+  }
+
+  // Methods are created before the class itself is declared
+  for (size_t i = 0; i < decl->methods_decl.count; ++i) {
+    StatementMethodDecl* method = decl->methods_decl.xs + i;
+    resolve_function(r, HIDDEN_NAME, &method->proto, true);
+  }
+
+  if (decl->super) {
+    end_scope(r);
+  }
+
+  r->class_kind = enclosing;
+  decl->slot = declare(r, decl->identifier, NULL);
+}
+
+static void resolve_statement(struct Resolver* r, Statement* stmt) {
+  switch (stmt->type) {
+    case STATEMENT_EXPR:
+    case STATEMENT_PRINT_EXPR:
+      resolve_expression(r, stmt->expr);
+    break;
+    case STATEMENT_VAR_DECL:
+      resolve_expression(r, stmt->var_decl.expr);
+      stmt->var_decl.slot = declare(r, stmt->var_decl.identifier, NULL);
+    break;
+    case STATEMENT_FUN_DECL:
+      // The function sees itself through the callee slot of its call scope,
+      // its name is only visible to the enclosing scope after the declaration
+      resolve_function(r, stmt->fun_decl.identifier, &stmt->fun_decl.proto, false);
+      stmt->fun_decl.slot = declare(r, stmt->fun_decl.identifier, NULL);
+    break;
+    case STATEMENT_CLASS_DECL:
+      resolve_statement_class_decl(r, stmt);
+    break;
+    case STATEMENT_BLOCK:
+      begin_scope(r, &stmt->scope);
+      for (size_t i = 0; i < stmt->block.count; ++i) {
+        resolve_statement(r, stmt->block.xs + i);
+      }
+      end_scope(r);
+    break;
+    case STATEMENT_CONDITIONAL:
+      for (size_t i = 0; i < stmt->cond.count; ++i) {
+        struct ConditionalBlock* b = stmt->cond.xs + i;
+        if (b->condition) resolve_expression(r, b->condition);
+        resolve_statement(r, b->branch);
+      }
+    break;
+    case STATEMENT_WHILE:
+      resolve_expression(r, stmt->while_loop.condition);
+      resolve_statement(r, stmt->while_loop.body);
+    break;
+    case STATEMENT_RETURN:
+      resolve_expression(r, stmt->ret);
+      // Nothing runs after the call, the callee may take over the caller's frame
+      if (stmt->ret->type == EXPRESSION_CALL && r->functions.count > 1) {
+        stmt->ret->call.is_tail = true;
+      }
+    break;
+  }
+}
+
+bool resolve(Statements stmts) {
+  struct Resolver r = {
+    .class_kind = CLASS_KIND_NONE,
+    .had_error = false,
+  };
+  vector_new(r.scopes, 8);
+  vector_new(r.functions, 4);
+  vector_new(r.pending_globals, 4);
+
+  // global scope, the script itself never captures anything
+  begin_scope(&r, NULL);
+  struct FunctionContext script = {0, false, NULL, 0, false};
+  vector_push(r.functions, script);
+
+  for (size_t i = 0; i < stmts.count; ++i) {
+    resolve_statement(&r, stmts.xs + i);
+  }
+  resolve_pending_globals(&r);
+  end_scope(&r);
+
+  vector_free(r.pending_globals);
+  vector_free(r.functions);
+  vector_free(r.scopes);
+  return !r.had_error;
+}
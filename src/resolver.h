@@ -0,0 +1,19 @@
+#ifndef _RESOLVER_H
+#define _RESOLVER_H
+
+#include "types/statements.h"
+#include "types/expressions.h"
+
+// Slot reserved in every call scope for the function being called
+#define CALLEE_SLOT 0
+// Methods keep the instance they run on right after their parameters
+#define RECEIVER_SLOT(num_params) (CALLEE_SLOT + 1 + (num_params))
+
+// Annotates every variable access and declaration with its VarSlot.
+// Returns false and reports static errors if some identifiers can't be resolved
+bool resolve(Statements stmts);
+
+// True for the 'super' keyword, gets on it look up the superclass' methods
+bool expression_is_super(const Expression* expr);
+
+#endif
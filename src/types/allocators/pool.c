@@ -29,9 +29,9 @@ void _pool_new_impl(Pool* p, size_t chunk_sz, uint64_t num_chunks) {
   void* data = POOL_MALLOC(total_sz);
   FATAL_ERR(data == NULL, "Initial memory allocation failed !");
 
-  for (size_t i = 0; i < num_chunks-1; ++i) {
+  for (size_t i = 0; i < num_chunks; ++i) {
     struct BlockHeader* node_start = data + (i * total_chunk_sz);
-    struct BlockHeader* node_next = (node_start + total_chunk_sz);
+    struct BlockHeader* node_next = i < num_chunks-1 ? data + ((i+1) * total_chunk_sz) : NULL;
 
     *node_start = (struct BlockHeader){GUARD_BYTE, node_next};
   }
@@ -19,10 +19,25 @@ enum ExpressionType {
 
 typedef struct Expression Expression;
 
+// Operand types the tree walker specialized a binary node on. The node is rewritten
+// on its first execution and goes back to the generic path when a guard fails
+enum BinarySpecialization {
+  BINARY_UNINITIALIZED,
+  // Both operands are doubles, used by arithmetic and comparisons
+  BINARY_DOUBLES,
+  // Both operands are booleans, used by logic operators
+  BINARY_BOOLS,
+  // Operands go through the conversion table
+  BINARY_GENERIC,
+};
+
 struct Binary {
   Expression* left;
   Expression* right;
   Token operator;
+  enum BinarySpecialization specialization;
+  // Operator on the operand types of the specialization, for BINARY_DOUBLES
+  BinaryOperatorFn operation;
 };
 
 struct Unary {
@@ -32,6 +47,11 @@ struct Unary {
 
 struct Group {
   Expression* child;
+  // Set by the optimizer on the groups it wraps around loop invariant expressions:
+  // the tree walker keeps the value of the child until the loop starts again
+  bool invariant;
+  bool cached;
+  Value value;
 };
 
 struct CallArguments {
@@ -44,16 +64,21 @@ struct Call {
   Expression* callee;
   Token open_paren;
   struct CallArguments args;
+  // Filled by the resolver, the call is the value of a return statement inside a function
+  bool is_tail;
 };
 
 struct Get {
   Expression* object;
   Token name;
+  PropertyCache cache;
 };
 
+// Shares its layout with Get, the parser turns gets into sets
 struct Set {
   Expression* object;
   Token name;
+  PropertyCache cache;
   Expression* right;
 };
 
@@ -62,20 +87,23 @@ struct Assignment {
   Expression* right;
 };
 
-struct AnonFunParams {
-  size_t capacity;
-  size_t count;
-  StringView* xs;
-};
-
 struct AnonFun {
-  struct AnonFunParams params;
-  struct Statement* body; 
+  FunctionProto proto;
   Token* fun_kw;
 };
 
 struct Expression {
   enum ExpressionType type;
+  union {
+    // Filled by the resolver for identifier literals and assignments,
+    // gets through 'super' hold the slot of 'this'
+    VarSlot var;
+    // Filled by the parser for number and string literals, index in the constant pool
+    uint32_t constant;
+    // Static expressions folded by the optimizer keep the token of the expression they replace
+    // for runtime errors, NULL for the literals the parser makes static
+    Token* origin;
+  };
   union {
     struct Binary binary;
     struct Unary unary;
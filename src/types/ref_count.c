@@ -4,6 +4,7 @@
 #endif
 
 struct RcBlockAlloc rc_blocks[MAX_RC_BLOCKS];
+static struct RcBlockAlloc* free_blocks = NULL;
 static uint64_t block_id_gen = 0;
 
 RcBlock* _rc_new_impl(void* held_rsc, void (*free_fn)(void*)) {
@@ -12,24 +13,22 @@ RcBlock* _rc_new_impl(void* held_rsc, void (*free_fn)(void*)) {
     for (size_t i = 0; i < MAX_RC_BLOCKS; ++i) {
       rc_blocks[i].block = (RcBlock){block_id_gen++, 0, NULL, NULL};
       rc_blocks[i].in_use = false;
+      rc_blocks[i].next_free = i < MAX_RC_BLOCKS - 1 ? &rc_blocks[i + 1] : NULL;
     }
+    free_blocks = &rc_blocks[0];
     rc_blocks_init = true;
   }
 
-  RcBlock* block = NULL;
-  for (size_t i = 0; i < MAX_RC_BLOCKS; ++i) {
-    if (!rc_blocks[i].in_use) {
-      rc_blocks[i].in_use = true;
-      block = &rc_blocks[i].block;
-      block->id = block_id_gen++;
-      break;
-    }
-  }
-
 #ifdef _DEBUG
-  assert(block && "Max ref count blocks allocated");
+  assert(free_blocks && "Max ref count blocks allocated");
 #endif
 
+  struct RcBlockAlloc* alloc = free_blocks;
+  free_blocks = alloc->next_free;
+  alloc->in_use = true;
+
+  RcBlock* block = &alloc->block;
+  block->id = block_id_gen++;
   block->held_rsc = held_rsc;
   block->free_fn = free_fn;
   block->count = 1;
@@ -55,12 +54,10 @@ bool _rc_release_impl(void* rsc, RcBlock* rc) {
   if (rc->count == 0) {
     rc->free_fn(rsc);
     ret = true;
-    for (size_t i = 0; i < MAX_RC_BLOCKS; ++i) {
-      if (&rc_blocks[i].block == rc) {
-        rc_blocks[i].in_use = false;
-        break;
-      }
-    }
+    struct RcBlockAlloc* alloc = (struct RcBlockAlloc*)rc;
+    alloc->in_use = false;
+    alloc->next_free = free_blocks;
+    free_blocks = alloc;
   }
 
   return ret;
@@ -1,7 +1,8 @@
 #ifndef _REF_COUNT_H
 #define _REF_COUNT_H
 
-#define MAX_RC_BLOCKS 20
+// Enough for every pooled scope to be alive at once
+#define MAX_RC_BLOCKS 1024
 
 #include <stdlib.h>
 
@@ -12,9 +13,11 @@ typedef struct {
   void (*free_fn)(void*);
 } RcBlock;
 
+// block must stay the first member, released blocks are cast back to their RcBlockAlloc
 struct RcBlockAlloc {
   RcBlock block;
   bool in_use;
+  struct RcBlockAlloc* next_free;
 };
 
 extern struct RcBlockAlloc rc_blocks[MAX_RC_BLOCKS];
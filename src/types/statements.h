@@ -1,8 +1,38 @@
 #ifndef _STATEMENTS_H
 #define _STATEMENTS_H
 
+#include <stdint.h>
 #include "string_view.h"
 
+// Statically resolved location of a variable:
+// number of scopes to walk up from the current one and index of the value in that scope
+typedef struct {
+  uint16_t depth;
+  uint16_t slot;
+} VarSlot;
+
+// VarSlot depth of variables captured by the current function, slot is then an index in its upvalues
+#define UPVALUE_DEPTH UINT16_MAX
+
+enum UpvalueKind {
+  // variable of the scope chain creating the closure, at the given depth and slot
+  UPVALUE_LOCAL,
+  // upvalue of the enclosing function, at the given slot
+  UPVALUE_ENCLOSING,
+};
+
+typedef struct {
+  enum UpvalueKind kind;
+  VarSlot from;
+} UpvalueDesc;
+
+// Filled by the resolver, tells how a closure builds its upvalues when it's created
+struct UpvalueDescs {
+  size_t capacity;
+  size_t count;
+  UpvalueDesc* xs;
+};
+
 enum StatementType {
   STATEMENT_EXPR,
   STATEMENT_PRINT_EXPR,
@@ -30,6 +60,7 @@ typedef Expression* StatementExpression;
 struct StatementVarDecl {
   Expression* expr;
   StringView identifier;
+  uint16_t slot;
 };
 
 struct StatementFunParameters  {
@@ -38,10 +69,32 @@ struct StatementFunParameters  {
   StringView* xs;
 };
 
-struct StatementFunDecl {
-  StringView identifier;
+// Filled by the resolver for the scope a block or a call creates
+typedef struct {
+  // slots declared in the scope
+  uint16_t size;
+  // a closure captures one of its variables, the scope is kept in the refcounted pool
+  bool captured;
+} ScopeLayout;
+
+// Immutable part of a function, shared by every function value created from its declaration.
+// It lives in the AST: the parser fills params and body, the resolver the upvalues
+typedef struct {
   struct StatementFunParameters params;
   Statement* body;
+  struct UpvalueDescs upvalues;
+  // of its call scope
+  ScopeLayout scope;
+  // Declared with 'pure fun', its results are memoized on the arguments
+  bool pure;
+  // of the declaration, empty for anonymous functions
+  StringView name;
+} FunctionProto;
+
+struct StatementFunDecl {
+  StringView identifier;
+  FunctionProto proto;
+  uint16_t slot;
 };
 
 typedef struct StatementFunDecl StatementMethodDecl;
@@ -56,6 +109,7 @@ struct StatementClassDecl {
   StringView identifier;
   Expression* super;
   struct ClassMethodsDecl methods_decl;
+  uint16_t slot;
 };
 
 typedef Statements StatementBlock;
@@ -71,15 +125,38 @@ struct StatementConditional {
   struct ConditionalBlock* xs;
 };
 
+// Filled by the optimizer at -O2, loops it couldn't analyse are left zeroed
+struct LoopInfo {
+  // Groups of loop invariant expressions, their values are dropped every time the loop starts
+  struct {
+    Expression** xs;
+    size_t count;
+    size_t capacity;
+  } invariants;
+  // Desugared 'for (var i = a; i < b; i = i + step)' whose body never assigns the counter.
+  // The counter is a local of the loop's scope, the body block ends with the increment
+  bool counted;
+  VarSlot counter;
+  Expression* bound;
+  // the bound is a constant or a variable the loop never assigns
+  bool bound_invariant;
+  // '<=' instead of '<'
+  bool inclusive;
+  double step;
+};
+
 struct StatementWhile {
   Expression* condition;
   Statement* body;
+  struct LoopInfo info;
 };
 
 typedef Expression* StatementReturn;
 
 struct Statement {
   enum StatementType type;
+  // Filled by the resolver for blocks
+  ScopeLayout scope;
   union {
     StatementExpression expr;
     struct StatementVarDecl var_decl;
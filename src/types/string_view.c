@@ -8,3 +8,7 @@ StringView sv_newn(const char* str, size_t n) {
 StringView sv_new(const char* str) {
   return sv_newn(str, strlen(str));
 }
+
+bool sv_eq(StringView a, StringView b) {
+  return a.len == b.len && strncmp(a.str, b.str, a.len) == 0;
+}
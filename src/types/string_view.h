@@ -13,5 +13,6 @@ typedef struct {
 
 StringView sv_new(const char* str);
 StringView sv_newn(const char* str, size_t n);
+bool sv_eq(StringView a, StringView b);
 
 #endif
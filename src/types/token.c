@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <math.h>
 
 const TokenLexeme token_lexemes[] = {
   {TOKEN_TYPE_EQUAL_EQUAL,  LEXEME_CODE('=','='),  2},
@@ -39,6 +40,7 @@ const Keyword keywords[] = {
   {RESERVED_KEYWORD_NIL,    "nil",    3},
   {RESERVED_KEYWORD_OR,     "or",     2},
   {RESERVED_KEYWORD_PRINT,  "print",  5},
+  {RESERVED_KEYWORD_PURE,   "pure",   4},
   {RESERVED_KEYWORD_RETURN, "return", 6},
   {RESERVED_KEYWORD_SUPER,  "super",  5},
   {RESERVED_KEYWORD_THIS,   "this",   4},
@@ -171,3 +173,18 @@ void token_pretty_print(Token token) {
     break;
   }
 }
+
+double number_to_double(Number num) {
+  if (num.decimal == 0) {
+    return (double)num.whole;
+  }
+
+  long temp = num.decimal;
+  int numdigits = 0;
+  while (temp > 0) {
+    temp /= 10;
+    ++numdigits;
+  }
+
+  return num.whole + num.decimal / pow(10, numdigits);
+}
@@ -49,6 +49,7 @@ enum ReservedKeywordType {
   RESERVED_KEYWORD_NIL,
   RESERVED_KEYWORD_OR,
   RESERVED_KEYWORD_PRINT,
+  RESERVED_KEYWORD_PURE,
   RESERVED_KEYWORD_RETURN,
   RESERVED_KEYWORD_SUPER,
   RESERVED_KEYWORD_THIS,
@@ -93,5 +94,6 @@ const char* token_type_to_string(enum TokenType tt);
 bool keyword_from_string(const char* start, size_t len, enum ReservedKeywordType* kw);
 const char* keyword_to_string(enum ReservedKeywordType type);
 void token_pretty_print(Token token); 
+double number_to_double(Number num);
 
 #endif
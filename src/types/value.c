@@ -1,108 +1,81 @@
 #include "value.h"
-#include "ref_count.h"
 #include "allocators/pool.h"
 #include "statements.h"
 #include "../error/runtime.h"
 #include "../interpreter/scope.h"
 
-// All of this complex machinery allows us to define type conversions rather easily
+#include <math.h>
 
-// This macro is used
-#define DEFINE_CONVERT_FN(NAME, OUT_TYPE) \
-const static struct ConvertionFunction CONVERT_##NAME = {EVAL_TYPE_##OUT_TYPE, NAME##_fn};
+// Conversions between value types, indexed [from][to]. Adding one is a single entry:
+//   [EVAL_TYPE_BOOL][EVAL_TYPE_DOUBLE] = bool_to_double,
+// None is defined for now, values only convert to their own type
+const ConversionFn conversions[EVAL_TYPE_COUNT][EVAL_TYPE_COUNT] = {{NULL}};
 
-struct ConvertionFunction {
-  enum ValueType out_type;
-  void (*fn)(Value* e);
-};
-
-struct ConvertionTableField {
-  enum ValueType in_type;
-  struct ConvertionFunction convertible_to[10];
-};
-
-// CONVERTION FUNCTIONS //
-// To define a conversion function do the following:
-// 1. Write a function with capitalized name INTYPE_TO_OUTTYPE(Value* e)
-// 2. Then call the DEFINE_CONVERT_FN macro to generate a 'struct ConvertionFunction' object automatically
-// 3. In the convertion_table below, you can use the CONVERT_INTYPE_TO_OUTTYPE generated struct as a convertion function
-
-void DOUBLE_TO_BOOL_fn(Value *e) {
-  double val = e->dvalue;
-  e->type = EVAL_TYPE_BOOL;
-  e->bvalue = val == 0.0;
+#define DOUBLE_OPERATOR(NAME, RESULT_CTOR, OPERATION) \
+static Value NAME##_doubles(Value l, Value r) { \
+  double a = value_as_double(l); \
+  double b = value_as_double(r); \
+  return RESULT_CTOR(OPERATION); \
 }
-DEFINE_CONVERT_FN(DOUBLE_TO_BOOL, BOOL);
-
-void BOOL_TO_DOUBLE_fn(Value* e) {
-  bool val = e->bvalue;
-  e->type = EVAL_TYPE_DOUBLE;
-  e->dvalue = (val) ? 1.0 : 0.0;
-}
-DEFINE_CONVERT_FN(BOOL_TO_DOUBLE, DOUBLE);
-
-void NIL_TO_BOOL_fn(Value* e) {
-  e->type = EVAL_TYPE_BOOL;
-  e->bvalue = false;
-}
-DEFINE_CONVERT_FN(NIL_TO_BOOL, BOOL);
-
-static const struct ConvertionFunction CONVERT_STOP = {0, NULL};
 
-// END CONVERTION FUNCTIONS //
-
-static const struct ConvertionTableField convertion_table[] = {
-  {EVAL_TYPE_DOUBLE,  {CONVERT_DOUBLE_TO_BOOL, CONVERT_STOP}},
-  {EVAL_TYPE_BOOL,    {CONVERT_BOOL_TO_DOUBLE, CONVERT_STOP}},
-  {EVAL_TYPE_NIL,     {CONVERT_NIL_TO_BOOL, CONVERT_STOP}},
-  {0, {CONVERT_STOP}},
+DOUBLE_OPERATOR(add, value_new_double, a + b)
+DOUBLE_OPERATOR(subtract, value_new_double, a - b)
+DOUBLE_OPERATOR(multiply, value_new_double, a * b)
+DOUBLE_OPERATOR(divide, value_new_double, (b == 0.0) ? NAN : a / b)
+DOUBLE_OPERATOR(less, value_new_bool, a < b)
+DOUBLE_OPERATOR(less_equal, value_new_bool, a <= b)
+DOUBLE_OPERATOR(greater, value_new_bool, a > b)
+DOUBLE_OPERATOR(greater_equal, value_new_bool, a >= b)
+DOUBLE_OPERATOR(equal, value_new_bool, a == b)
+DOUBLE_OPERATOR(not_equal, value_new_bool, a != b)
+
+#undef DOUBLE_OPERATOR
+
+// Indexed [operator][left type][right type], an operator on strings would be
+//   [BINARY_OP_ADD][EVAL_TYPE_STRING_VIEW][EVAL_TYPE_STRING_VIEW] = add_strings,
+const BinaryOperatorFn binary_operators[BINARY_OP_COUNT][EVAL_TYPE_COUNT][EVAL_TYPE_COUNT] = {
+  [BINARY_OP_ADD][EVAL_TYPE_DOUBLE][EVAL_TYPE_DOUBLE] = add_doubles,
+  [BINARY_OP_SUBTRACT][EVAL_TYPE_DOUBLE][EVAL_TYPE_DOUBLE] = subtract_doubles,
+  [BINARY_OP_MULTIPLY][EVAL_TYPE_DOUBLE][EVAL_TYPE_DOUBLE] = multiply_doubles,
+  [BINARY_OP_DIVIDE][EVAL_TYPE_DOUBLE][EVAL_TYPE_DOUBLE] = divide_doubles,
+  [BINARY_OP_LESS][EVAL_TYPE_DOUBLE][EVAL_TYPE_DOUBLE] = less_doubles,
+  [BINARY_OP_LESS_EQUAL][EVAL_TYPE_DOUBLE][EVAL_TYPE_DOUBLE] = less_equal_doubles,
+  [BINARY_OP_GREATER][EVAL_TYPE_DOUBLE][EVAL_TYPE_DOUBLE] = greater_doubles,
+  [BINARY_OP_GREATER_EQUAL][EVAL_TYPE_DOUBLE][EVAL_TYPE_DOUBLE] = greater_equal_doubles,
+  [BINARY_OP_EQUAL][EVAL_TYPE_DOUBLE][EVAL_TYPE_DOUBLE] = equal_doubles,
+  [BINARY_OP_NOT_EQUAL][EVAL_TYPE_DOUBLE][EVAL_TYPE_DOUBLE] = not_equal_doubles,
 };
 
-
-bool is_convertible_to_type(const Value* e, enum ValueType expected) {
-  if (e->type == expected) {
-    return true;
-  }
-
-  for (size_t i = 0; convertion_table[i].in_type != 0; ++i) {
-    const struct ConvertionTableField* field = convertion_table + i;
-
-    if (field->in_type == e->type) {
-      for (size_t j = 0; field->convertible_to[j].fn != NULL; ++j) {
-        const struct ConvertionFunction* convfn = field->convertible_to + j;
-        if (convfn->out_type == expected) {
-          return true;
-        }
-      }
-    }
-  }
-
-  return false;
-}
-
 void value_pretty_print(const Value* e) {
-  switch(e->type) {
-    case EVAL_TYPE_DOUBLE:
-      printf("Double: %f", e->dvalue);
+  switch(value_type(*e)) {
+    case EVAL_TYPE_DOUBLE: {
+      double d = value_as_double(*e);
+      // The sign of a NaN depends on the operand order the C compiler picked, it's left out so every engine prints the same
+      if (isnan(d)) printf("Double: nan");
+      else printf("Double: %f", d);
+    }
     break;
     case EVAL_TYPE_STRING_VIEW:
-      printf("String: "SV_Fmt, SV_Fmt_arg(e->svvalue));
+      printf("String: "SV_Fmt, SV_Fmt_arg(value_as_sv(*e)));
     break;
     case EVAL_TYPE_BOOL:
-      printf("Boolean: %s", e->bvalue ? "true" : "false");
+      printf("Boolean: %s", value_as_bool(*e) ? "true" : "false");
     break;
-    case EVAL_TYPE_FUN:
-      printf("Function[%llu](", e->fnvalue.capture.rsc->id);
-      for (size_t i = 0; i < e->fnvalue.params.count; ++i) {
-        printf(SV_Fmt, SV_Fmt_arg(e->fnvalue.params.xs[i]));
+    case EVAL_TYPE_FUN: {
+      const FunctionValue* fn = value_as_fun(*e);
+      // 'this' counts as captured by bound methods
+      printf("Function[%zu](", (fn->captures ? fn->captures->count : 0) + (fn->receiver ? 1 : 0));
+      for (size_t i = 0; i < fn->proto->params.count; ++i) {
+        printf(SV_Fmt, SV_Fmt_arg(fn->proto->params.xs[i]));
       }
       printf(")");
+    }
     break;
     case EVAL_TYPE_CLASS:
-      printf("Class: "SV_Fmt, SV_Fmt_arg(e->classvalue.rsc->name));
+      printf("Class: "SV_Fmt, SV_Fmt_arg(value_as_class(*e)->name));
     break;
     case EVAL_TYPE_INSTANCE:
-      printf("Instance of "SV_Fmt, SV_Fmt_arg(e->instancevalue.rsc->class.rsc->name));
+      printf("Instance of "SV_Fmt, SV_Fmt_arg(value_as_instance(*e)->class->name));
     break;
     case EVAL_TYPE_NIL:
       printf("NIL");
@@ -113,308 +86,448 @@ void value_pretty_print(const Value* e) {
   }
 }
 
-bool convert_to(Value* e, enum ValueType to_type) {
-  if (e->type == to_type) {
-    return true;
-  }
-
-  for (size_t i = 0; convertion_table[i].in_type != 0; ++i) {
-    const struct ConvertionTableField* field = convertion_table + i;
+struct ShapeTransitions {
+  struct Shape** xs;
+  size_t count;
+  size_t capacity;
+};
 
-    if (field->in_type == e->type) {
-      for (size_t j = 0; field->convertible_to[j].fn != NULL; ++j) {
-        const struct ConvertionFunction* convfn = field->convertible_to + j;
-        if (convfn->out_type == to_type) {
-          convfn->fn(e);
-          return true;
-        }
-      }
-    }
-  }
+struct Shape {
+  // NULL for the empty shape every instance starts with
+  struct Shape* parent;
+  // Property added by the transition from parent, it's stored in the last slot
+  StringView name;
+  size_t num_slots;
+  // Shapes reached by adding one property, they are shared by all instances in this shape
+  struct ShapeTransitions transitions;
+};
 
-  return false;
-}
+// Open addressing table of the interned strings, kept at most half full
+struct StringTable {
+  struct StringValue** xs;
+  size_t count;
+  size_t capacity;
+};
 
 static Pool class_pool; 
 static Pool instance_pool; 
 static StringView this_kw;
 static StringView super_kw;
+static struct Shape empty_shape;
+// Strings are interned before value_init by the compilers, value_free releases them
+static struct StringTable strings;
 
 void value_init(size_t num_classes, size_t num_instances, StringView this_keyword, StringView super_keyword) {
   pool_new(&class_pool, sizeof(struct ClassValue), num_classes);
   pool_new(&instance_pool, sizeof(struct InstanceValue), num_instances);
   this_kw = this_keyword;
   super_kw = super_keyword;
+  empty_shape = (struct Shape){0};
+}
+
+static void shape_free_transitions(struct Shape* shape) {
+  for (size_t i = 0; i < shape->transitions.count; ++i) {
+    struct Shape* next = shape->transitions.xs[i];
+    shape_free_transitions(next);
+    free(next);
+  }
+  vector_free(shape->transitions);
 }
 
 void value_free() {
   pool_freeall(&class_pool);
   pool_freeall(&instance_pool);
+  shape_free_transitions(&empty_shape);
+
+  for (size_t i = 0; i < strings.capacity; ++i) {
+    free(strings.xs[i]);
+  }
+  free(strings.xs);
+  strings = (struct StringTable){0};
 }
 
-Value value_new_double(double val) {
-  Value e;
-  e.type = EVAL_TYPE_DOUBLE;
-  e.dvalue = val;
-  return e;
+static bool shape_find_slot(const struct Shape* shape, StringView name, size_t* slot) {
+  for (; shape->parent; shape = shape->parent) {
+    if (sv_eq(shape->name, name)) {
+      *slot = shape->num_slots - 1;
+      return true;
+    }
+  }
+  return false;
 }
 
-Value value_new_stringview(StringView sv) {
-  Value e;
-  e.type = EVAL_TYPE_STRING_VIEW;
-  e.svvalue = sv;
-  return e;
+static const struct Shape* shape_add_property(const struct Shape* shape, StringView name) {
+  struct Shape* from = (struct Shape*)shape;
+  for (size_t i = 0; i < from->transitions.count; ++i) {
+    if (sv_eq(from->transitions.xs[i]->name, name)) {
+      return from->transitions.xs[i];
+    }
+  }
+
+  struct Shape* to = malloc(sizeof(struct Shape));
+  *to = (struct Shape){
+    .parent = from,
+    .name = name,
+    .num_slots = from->num_slots + 1,
+  };
+
+  if (from->transitions.capacity == 0) {
+    vector_new(from->transitions, 1);
+  }
+  vector_push(from->transitions, to);
+  return to;
+}
+
+static bool property_cache_probe(const PropertyCache* cache, const struct Shape* shape, struct PropertyCacheEntry* entry) {
+  if (!cache) return false;
+
+  size_t count = cache->count < PROPERTY_CACHE_SIZE ? cache->count : PROPERTY_CACHE_SIZE;
+  for (size_t i = 0; i < count; ++i) {
+    if (cache->xs[i].shape == shape) {
+      *entry = cache->xs[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+static void property_cache_insert(PropertyCache* cache, struct PropertyCacheEntry entry) {
+  if (!cache) return;
+
+  cache->xs[cache->count % PROPERTY_CACHE_SIZE] = entry;
+  cache->count += 1;
 }
 
-Value value_new_bool(bool val) {
-  Value e;
-  e.type = EVAL_TYPE_BOOL;
-  e.bvalue = val;
-  return e;
+static size_t sv_hash(StringView name, size_t capacity) {
+  // FNV-1a
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < name.len; ++i) {
+    h ^= (unsigned char)name.str[i];
+    h *= 0x100000001b3ull;
+  }
+  return (size_t)h & (capacity - 1);
 }
 
-Value value_new_err() {
-  return (Value){EVAL_TYPE_ERR};
+static void string_table_insert(struct StringTable* table, struct StringValue* string) {
+  size_t idx = sv_hash(string->sv, table->capacity);
+  while (table->xs[idx]) {
+    idx = (idx + 1) & (table->capacity - 1);
+  }
+  table->xs[idx] = string;
+  table->count += 1;
 }
 
-Value value_new_nil() {
-  return (Value){EVAL_TYPE_NIL};
+static void string_table_grow(struct StringTable* table) {
+  struct StringTable grown = {
+    .xs = calloc(table->capacity ? table->capacity * 2 : 64, sizeof(struct StringValue*)),
+    .count = 0,
+    .capacity = table->capacity ? table->capacity * 2 : 64,
+  };
+
+  for (size_t i = 0; i < table->capacity; ++i) {
+    if (table->xs[i]) string_table_insert(&grown, table->xs[i]);
+  }
+  free(table->xs);
+  *table = grown;
 }
 
-Value value_new_fun(Statement* body, const StringView* params, size_t num_params, ScopeRef capture) {
-  assert(body->type == STATEMENT_BLOCK && "Attempted to create a function value with non block body");
+Value value_new_stringview(StringView sv) {
+  if ((strings.count + 1) * 2 > strings.capacity) {
+    string_table_grow(&strings);
+  }
 
-  Value e;
-  e.type = EVAL_TYPE_FUN;
-  e.fnvalue = (FunctionValue){
-    .params = {0},
-    .body = body,
+  size_t idx = sv_hash(sv, strings.capacity);
+  while (strings.xs[idx]) {
+    if (sv_eq(strings.xs[idx]->sv, sv)) return value_box_object(VALUE_BOX_STRING, strings.xs[idx]);
+    idx = (idx + 1) & (strings.capacity - 1);
+  }
+
+  struct StringValue* string = malloc(sizeof(struct StringValue));
+  string->sv = sv;
+  strings.xs[idx] = string;
+  strings.count += 1;
+  return value_box_object(VALUE_BOX_STRING, string);
+}
+
+Value value_new_fun(const FunctionProto* proto, struct Captures* captures) {
+  assert(proto->body->type == STATEMENT_BLOCK && "Attempted to create a function value with non block body");
+
+  FunctionValue* fn = malloc(sizeof(FunctionValue));
+  *fn = (FunctionValue){
+    .obj = {1},
+    .proto = proto,
+    .captures = captures,
+    .receiver = NULL,
   };
 
-  rc_move(&(e.fnvalue.capture), &capture);
+  return value_box_object(VALUE_BOX_FUN, fn);
+}
+
+static void fun_free(FunctionValue* fn) {
+  captures_release(fn->captures);
+  if (fn->receiver) {
+    value_scopeexit(&fn->receiver->this);
+    free(fn->receiver);
+  }
+  free(fn);
+}
+
+// The first method inserted under a name wins
+static void vtable_insert(struct Vtable* vtable, StringView name, const Value* method) {
+  size_t idx = sv_hash(name, vtable->capacity);
+  while (vtable->xs[idx].method) {
+    if (sv_eq(vtable->xs[idx].identifier, name)) return;
+    idx = (idx + 1) & (vtable->capacity - 1);
+  }
+
+  vtable->xs[idx] = (VtableEntry){name, method};
+  vtable->count += 1;
+}
+
+static const VtableEntry* vtable_find(const struct Vtable* vtable, StringView name) {
+  if (vtable->count == 0) return NULL;
+
+  size_t idx = sv_hash(name, vtable->capacity);
+  while (vtable->xs[idx].method) {
+    if (sv_eq(vtable->xs[idx].identifier, name)) return vtable->xs + idx;
+    idx = (idx + 1) & (vtable->capacity - 1);
+  }
+  return NULL;
+}
 
-  vector_new(e.fnvalue.params, num_params);
-  for (size_t i = 0; i < num_params; ++i) {
-    vector_push(e.fnvalue.params, params[i]);
+// Flattens the methods of the class and of its ancestors, the table is kept at most half full
+static void vtable_build(struct ClassValue* class) {
+  const struct Vtable* inherited = class->super ? &class->super->vtable : NULL;
+  size_t count = class->methods.count + (inherited ? inherited->count : 0);
+
+  size_t capacity = 1;
+  while (capacity < count * 2) capacity *= 2;
+  class->vtable = (struct Vtable){
+    .xs = calloc(capacity, sizeof(VtableEntry)),
+    .count = 0,
+    .capacity = capacity,
+  };
+
+  for (size_t i = 0; i < class->methods.count; ++i) {
+    ClassMethod* m = class->methods.xs + i;
+    vtable_insert(&class->vtable, m->identifier, &m->method);
   }
 
-  return e; 
+  if (!inherited) return;
+  for (size_t i = 0; i < inherited->capacity; ++i) {
+    const VtableEntry* e = inherited->xs + i;
+    if (e->method) vtable_insert(&class->vtable, e->identifier, e->method);
+  }
 }
 
-void class_free(void* rsc) {
-  struct ClassValue* class = (struct ClassValue*)rsc;
+static void class_free(struct ClassValue* class) {
   for (size_t i = 0; i < class->methods.count; ++i) {
-    ClassMethod* method = class->methods.xs + i;
-    rc_release(&method->method.fnvalue.capture);
+    value_scopeexit(&class->methods.xs[i].method);
   }
   vector_free(class->methods);
-  pool_free(&class_pool, rsc);
+  free(class->vtable.xs);
+
+  if (class->super) {
+    Value super = value_box_object(VALUE_BOX_CLASS, class->super);
+    value_scopeexit(&super);
+  }
+  pool_free(&class_pool, class);
 }
 
 Value value_new_class(StringView name, ClassMethods methods, const Value* super) {
   struct ClassValue* class; 
   pool_alloc(&class_pool, (void**)&class);
+  class->obj = (struct ValueObject){1};
   class->name = name;
+  class->super = NULL;
   if (super) {
-    rc_acquire(super->classvalue, &class->super);
-  } else {
-    rc_null(&class->super);
+    class->super = value_as_class(value_copy(super));
   }
 
   vector_new(class->methods, methods.count);
   for (size_t i = 0; i < methods.count; ++i) {
     const ClassMethod* m = methods.xs + i;
-    assert(m->method.type == EVAL_TYPE_FUN && "Method value is not a function type");
+    assert(value_type(m->method) == EVAL_TYPE_FUN && "Method value is not a function type");
     ClassMethod method = {m->identifier, m->method};
     vector_push(class->methods, method);
   }
+  vtable_build(class);
 
-  ClassRef classref;
-  rc_new(class, class_free, &classref);
-
-  Value e;
-  e.type = EVAL_TYPE_CLASS;
-  rc_move(&(e.classvalue), &classref); 
-
-  return e;
+  return value_box_object(VALUE_BOX_CLASS, class);
 }
 
-void instance_free(void* rsc) {
-  struct InstanceValue* inst = (struct InstanceValue*)rsc;
-
-  for (size_t i = 0; i < inst->properties.count; ++i) {
-    struct InstanceProperty* prop = inst->properties.xs + i;
-    value_scopeexit(&prop->value);
+static void instance_free(struct InstanceValue* inst) {
+  for (size_t i = 0; i < inst->slots.count; ++i) {
+    value_scopeexit(inst->slots.xs + i);
   }
-  vector_free(inst->properties);
+  vector_free(inst->slots);
 
-  rc_release(&inst->class);
-  pool_free(&instance_pool, rsc);
+  Value class = value_box_object(VALUE_BOX_CLASS, inst->class);
+  value_scopeexit(&class);
+  pool_free(&instance_pool, inst);
 }
 
 Value value_new_instance(const Value* class) {
-  assert(class->type == EVAL_TYPE_CLASS && "Attempted to instanciate a class but passed value is not a Class");
+  assert(value_type(*class) == EVAL_TYPE_CLASS && "Attempted to instanciate a class but passed value is not a Class");
   
   struct InstanceValue* instance;
   pool_alloc(&instance_pool, (void**)&instance);
-  rc_acquire(class->classvalue, &(instance->class));
-  vector_new(instance->properties, 1);
-
-  if (class->classvalue.rsc->super.rsc) {
-    Value superclass_wrap = {EVAL_TYPE_CLASS};
-    rc_acquire(class->classvalue.rsc->super, &superclass_wrap.classvalue);
+  instance->obj = (struct ValueObject){1};
+  instance->class = value_as_class(value_copy(class));
+  instance->shape = &empty_shape;
+  vector_new(instance->slots, 1);
 
-    Value super = value_new_instance(&superclass_wrap);
-    rc_move(&instance->super, &super.instancevalue);
+  return value_box_object(VALUE_BOX_INSTANCE, instance);
+}
 
-    rc_release(&superclass_wrap.classvalue);
-  } else {
-    rc_null(&instance->super);
+void value_object_free(Value v) {
+  switch (value_type(v)) {
+    case EVAL_TYPE_FUN:
+      fun_free(value_as_fun(v));
+    break;
+    case EVAL_TYPE_CLASS:
+      class_free(value_as_class(v));
+    break;
+    case EVAL_TYPE_INSTANCE:
+      instance_free(value_as_instance(v));
+    break;
+    default:
+      assert(false && "Attempted to free a value which isn't an object");
   }
-
-  Value e;
-  e.type = EVAL_TYPE_INSTANCE;
-  rc_new(instance, instance_free, &e.instancevalue); 
-
-  return e;
 }
 
-Value instance_method_set_capture(const Value* fun, ScopeRef new_capture) {
-  Value new;
-  new.type = EVAL_TYPE_FUN;
-  new.fnvalue = (FunctionValue) {
-    .params = fun->fnvalue.params,
-    .body = fun->fnvalue.body,
-  };
+// Bound methods are functions of their own, they share the body and captures of the method
+static Value instance_bind_method(Value method, const struct Receiver* receiver) {
+  const FunctionValue* fn = value_as_fun(method);
+  Value bound = value_new_fun(fn->proto, captures_acquire(fn->captures));
 
-  rc_acquire(new_capture, &new.fnvalue.capture);
+  struct Receiver* bound_receiver = malloc(sizeof(struct Receiver));
+  bound_receiver->this = value_copy(&receiver->this);
+  value_as_fun(bound)->receiver = bound_receiver;
 
-  return new;
+  value_scopeexit(&method);
+  return bound;
 }
 
-
-Value instance_find_property(const Value* instance, StringView name) {
+Value instance_find_method(const Value* instance, StringView name, PropertyCache* cache, struct Receiver* receiver) {
 #ifdef _DEBUG
   assert(instance != NULL && "Attempted to find property on NULL instance");
-  assert(instance->type == EVAL_TYPE_INSTANCE && "Attempted to find property on non-instance");
+  assert(value_type(*instance) == EVAL_TYPE_INSTANCE && "Attempted to find property on non-instance");
 #endif
 
-  bool has_super = instance->instancevalue.rsc->super.rsc != NULL;
+  const struct InstanceValue* inst = value_as_instance(*instance);
+  receiver->this = value_new_nil();
 
-  for (size_t i = 0; i < instance->instancevalue.rsc->properties.count; ++i) {
-    const struct InstanceProperty* prop = 
-      instance->instancevalue.rsc->properties.xs + i;
+  // Properties shadow methods
+  struct PropertyCacheEntry entry;
+  if (property_cache_probe(cache, inst->shape, &entry)) {
+    return value_copy(inst->slots.xs + entry.slot);
+  }
 
-    if (strncmp(prop->identifier.str, name.str, prop->identifier.len) == 0) {
-      return value_copy(&prop->value);
-    }
+  size_t slot;
+  if (shape_find_slot(inst->shape, name, &slot)) {
+    property_cache_insert(cache, (struct PropertyCacheEntry){inst->shape, NULL, slot});
+    return value_copy(inst->slots.xs + slot);
   }
 
-  // Look for method
-  struct ClassValue* class = instance->instancevalue.rsc->class.rsc;
-  for (size_t i = 0; i < class->methods.count; ++i) {
-    ClassMethod* method = class->methods.xs + i;
-
-    if (strncmp(method->identifier.str, name.str, method->identifier.len) == 0) {
-      ScopeRef instance_capture = scope_create();
-      scope_set_upper(instance_capture, scope_ref_get_current());
-      scope_insert_into(instance_capture, this_kw, instance);
-
-      if (has_super) {
-        Value superinstance_wrap = {EVAL_TYPE_INSTANCE};
-        rc_acquire(instance->instancevalue.rsc->super, &superinstance_wrap.instancevalue);
-        scope_insert_into(instance_capture, super_kw, &superinstance_wrap);
-        rc_release(&superinstance_wrap.instancevalue);
-      }
+  const VtableEntry* method = vtable_find(&inst->class->vtable, name);
+  if (!method) {
+    return value_new_nil();
+  }
 
-      Value ret = instance_method_set_capture(&method->method, instance_capture);
-      rc_release(&instance_capture);
-      return ret;
-    }
+  // The receiver borrows the instance, the caller holds it
+  receiver->this = *instance;
+  return value_copy(method->method);
+}
+
+Value instance_find_property(const Value* instance, StringView name, PropertyCache* cache) {
+  struct Receiver receiver;
+  Value property = instance_find_method(instance, name, cache, &receiver);
+  if (value_type(receiver.this) != EVAL_TYPE_INSTANCE) {
+    return property;
   }
 
-  if (has_super) {
-    Value superinstance_wrap = {EVAL_TYPE_INSTANCE};
-    rc_acquire(instance->instancevalue.rsc->super, &superinstance_wrap.instancevalue);
-    Value ret = instance_find_property(&superinstance_wrap, name);
-    rc_release(&superinstance_wrap.instancevalue);
-    return ret;
+  return instance_bind_method(property, &receiver);
+}
+
+Value super_find_method(const Value* super, const Value* this, StringView name, struct Receiver* receiver) {
+#ifdef _DEBUG
+  assert(value_type(*super) == EVAL_TYPE_CLASS && "Attempted to find a super method on non-class");
+  assert(value_type(*this) == EVAL_TYPE_INSTANCE && "Attempted to run a super method on non-instance");
+#endif
+
+  receiver->this = value_new_nil();
+
+  const VtableEntry* method = vtable_find(&value_as_class(*super)->vtable, name);
+  if (method) {
+    receiver->this = *this;
+    return value_copy(method->method);
   }
 
+  // Properties are shared by the whole hierarchy, 'super' reads the ones of 'this'
+  const struct InstanceValue* inst = value_as_instance(*this);
+  size_t slot;
+  if (shape_find_slot(inst->shape, name, &slot)) {
+    return value_copy(inst->slots.xs + slot);
+  }
   return value_new_nil();
 }
 
-void instance_set_property(Value* instance, StringView name, const Value* insert) {
-  for (size_t i = 0; i < instance->instancevalue.rsc->properties.count; ++i) {
-    struct InstanceProperty* prop = instance->instancevalue.rsc->properties.xs + i;
-    if (strncmp(prop->identifier.str, name.str, prop->identifier.len) == 0) {
-      prop->value = value_copy(insert);
-      return;
-    }
+Value super_find_property(const Value* super, const Value* this, StringView name) {
+  struct Receiver receiver;
+  Value method = super_find_method(super, this, name, &receiver);
+  if (value_type(receiver.this) != EVAL_TYPE_INSTANCE) {
+    return method;
   }
 
-  struct InstanceProperty new_prop = {
-    .identifier = name,
-    .value = value_copy(insert),
-  };
-
-  vector_push(instance->instancevalue.rsc->properties, new_prop);
+  return instance_bind_method(method, &receiver);
 }
 
-Value value_copy(const Value* v) {
-  switch (v->type) {
-    case EVAL_TYPE_FUN: {
-      Value fn = *v;
-      fn.fnvalue.capture = scope_ref_acquire(v->fnvalue.capture);
-      return fn;
-    }
-    break;
-    case EVAL_TYPE_CLASS: {
-      Value class = *v;
-      rc_acquire(v->classvalue, &(class.classvalue));
-      return class;
-    }
-    break;
-    case EVAL_TYPE_INSTANCE: {
-      Value instance = *v;
-      rc_acquire(v->instancevalue, &instance.instancevalue);
-      return instance;
+void instance_set_property(Value* instance, StringView name, const Value* insert, PropertyCache* cache) {
+  struct InstanceValue* inst = value_as_instance(*instance);
+  Value value = value_copy(insert);
+
+  struct PropertyCacheEntry entry;
+  if (!property_cache_probe(cache, inst->shape, &entry)) {
+    entry = (struct PropertyCacheEntry){inst->shape, NULL, 0};
+    if (!shape_find_slot(inst->shape, name, &entry.slot)) {
+      entry.transition = shape_add_property(inst->shape, name);
+      entry.slot = inst->shape->num_slots;
     }
-    break;
-    default:
-    return *v;
+    property_cache_insert(cache, entry);
+  }
+
+  if (entry.transition) {
+    inst->shape = entry.transition;
+    vector_push(inst->slots, value);
+  } else {
+    value_scopeexit(inst->slots.xs + entry.slot);
+    inst->slots.xs[entry.slot] = value;
   }
 }
 
-ClassMethods build_class_methods(struct ClassMethodsDecl methods_decl) {
+ClassMethods build_class_methods(struct ClassMethodsDecl methods_decl, const Value* super) {
   ClassMethods methods;
   vector_new(methods, methods_decl.count);
 
+  // Methods of a subclass capture 'super' from a scope wrapping them
+  if (super) {
+    scope_new();
+    scope_define(0, super_kw, super);
+  }
+
   for (size_t i = 0; i < methods_decl.count; ++i) {
     StatementMethodDecl* method = methods_decl.xs + i;
     
-    Value fn = value_new_fun(method->body, method->params.xs, method->params.count, scope_ref_get_current());
+    Value fn = value_new_fun(&method->proto, scope_capture(&method->proto.upvalues));
 
     ClassMethod built_method = {method->identifier, fn};
     vector_push(methods, built_method);
   }
 
-  return methods;
-}
-
-void value_scopeexit(Value* v) {
-  switch (v->type) {
-    case EVAL_TYPE_FUN: {
-      rc_release(&v->fnvalue.capture);
-    }
-    break;
-    case EVAL_TYPE_CLASS:
-      rc_release(&v->classvalue);
-    break;
-    case EVAL_TYPE_INSTANCE:
-      rc_release(&v->instancevalue);
-    break;
-    default: 
-    break;
+  if (super) {
+    scope_pop();
   }
+
+  return methods;
 }
@@ -1,6 +1,8 @@
 #ifndef _VALUE_H
 #define _VALUE_H
 
+#include <stdint.h>
+
 #include "string_view.h"
 #include "../error/analysis.h"
 #include "statements.h"
@@ -17,39 +19,66 @@ enum ValueType {
   EVAL_TYPE_NIL,
 };
 
-struct FunctionParameters {
-  StringView* xs;
-  size_t count;
-  size_t capacity;
+#define EVAL_TYPE_COUNT (EVAL_TYPE_NIL + 1)
+
+// Logic operators aren't part of it, they short circuit and only convert their operands
+enum BinaryOperator {
+  BINARY_OP_ADD,
+  BINARY_OP_SUBTRACT,
+  BINARY_OP_MULTIPLY,
+  BINARY_OP_DIVIDE,
+  BINARY_OP_LESS,
+  BINARY_OP_LESS_EQUAL,
+  BINARY_OP_GREATER,
+  BINARY_OP_GREATER_EQUAL,
+  BINARY_OP_EQUAL,
+  BINARY_OP_NOT_EQUAL,
+  BINARY_OP_COUNT,
 };
 
-typedef struct {
-  struct FunctionParameters params;
-  Statement* body;
-  ScopeRef capture;
-} FunctionValue;
+struct Captures;
+struct Receiver;
 
+// NaN-boxed value, 8 bytes. Doubles are stored as they are, every other type lives in a quiet NaN
+// with bit 50 set, arithmetic never produces such a NaN. The sign bit and bits 48-49 hold the tag,
+// the low 48 bits a bool or a pointer:
+// - strings point to interned StringValues
+// - functions, classes and instances point to reference counted objects, they have the sign bit set
 typedef struct {
-  struct ClassValue* rsc;
-  RcBlock* rc;
-} ClassRef;
+  uint64_t bits;
+} Value;
 
-typedef struct {
-  RcBlock* rc;
-  struct InstanceValue* rsc;
-} InstanceRef;
+#define VALUE_QNAN          ((uint64_t)0x7ffc000000000000)
+#define VALUE_SIGN_BIT      ((uint64_t)0x8000000000000000)
+#define VALUE_PAYLOAD_MASK  ((uint64_t)0x0000ffffffffffff)
+
+#define VALUE_BOX_STRING    (VALUE_QNAN)
+#define VALUE_BOX_NIL       (VALUE_QNAN | ((uint64_t)1 << 48))
+#define VALUE_BOX_ERR       (VALUE_QNAN | ((uint64_t)2 << 48))
+#define VALUE_BOX_BOOL      (VALUE_QNAN | ((uint64_t)3 << 48))
+#define VALUE_BOX_FUN       (VALUE_SIGN_BIT | VALUE_QNAN | ((uint64_t)1 << 48))
+#define VALUE_BOX_CLASS     (VALUE_SIGN_BIT | VALUE_QNAN | ((uint64_t)2 << 48))
+#define VALUE_BOX_INSTANCE  (VALUE_SIGN_BIT | VALUE_QNAN | ((uint64_t)3 << 48))
+
+// Header of the functions, classes and instances values point to
+struct ValueObject {
+  size_t refs;
+};
+
+// Strings are interned, they live until value_free
+struct StringValue {
+  StringView sv;
+};
 
 typedef struct {
-  enum ValueType type;
-  union {
-    double dvalue;
-    StringView svvalue;
-    bool bvalue;
-    FunctionValue fnvalue;
-    ClassRef classvalue;
-    InstanceRef instancevalue;
-  };
-} Value;
+  struct ValueObject obj;
+  // Owned by the declaration the function was created from
+  const FunctionProto* proto;
+  // NULL when the function doesn't capture anything
+  struct Captures* captures;
+  // Set for methods read from an instance without being called right away
+  struct Receiver* receiver;
+} FunctionValue;
 
 typedef struct {
   StringView identifier;
@@ -62,32 +91,171 @@ typedef struct {
   size_t capacity;
 } ClassMethods;
 
+// Method of the class or of an ancestor, overriding methods shadow the inherited ones
+typedef struct {
+  StringView identifier;
+  // NULL for empty buckets
+  const Value* method;
+} VtableEntry;
+
+// Hash table of every method callable on instances of a class, including inherited ones
+struct Vtable {
+  VtableEntry* xs;
+  size_t count;
+  size_t capacity;
+};
+
 struct ClassValue {
+  struct ValueObject obj;
   StringView name;
-  ClassRef super;
+  // NULL for classes without a superclass
+  struct ClassValue* super;
   ClassMethods methods;
+  struct Vtable vtable;
 };
 
-struct InstanceProperty {
-  StringView identifier;
-  Value value;
-};
+// Hidden class, instances which got the same properties in the same order share it
+// and store each property in the same slot
+struct Shape;
 
-struct InstanceProperties {
-  struct InstanceProperty* xs;
+// Dense property values of an instance, in the order of its shape
+struct InstanceSlots {
+  Value* xs;
   size_t count;
   size_t capacity;
 };
 
+// One object per instance whatever the depth of its class hierarchy,
+// the methods of every class store their properties in the same slots
 struct InstanceValue {
-  ClassRef class;
-  InstanceRef super;
-  struct InstanceProperties properties;
+  struct ValueObject obj;
+  struct ClassValue* class;
+  const struct Shape* shape;
+  struct InstanceSlots slots;
+};
+
+// Shape seen by a get or set expression and the slot of the property in it.
+// transition is set when a set adds the property, it is the shape the instance moves to
+struct PropertyCacheEntry {
+  const struct Shape* shape;
+  const struct Shape* transition;
+  size_t slot;
 };
 
+#define PROPERTY_CACHE_SIZE 4
+
+// Inline cache of a get or set expression, the oldest entry is replaced once it's full
+typedef struct {
+  struct PropertyCacheEntry xs[PROPERTY_CACHE_SIZE];
+  size_t count;
+} PropertyCache;
+
 typedef Value* ValueRef;
 
-static const char* eval_type_to_str(enum ValueType t) {
+typedef struct Upvalue Upvalue;
+
+// A captured variable. It is open and reads its scope's slot as long as that scope is alive,
+// the value moves into the upvalue when the scope exits
+struct Upvalue {
+  size_t refs;
+  // NULL once closed
+  struct Scope* scope;
+  uint16_t slot;
+  Value closed;
+  // next open upvalue of the same scope
+  Upvalue* next;
+};
+
+// Instance a method runs on, defined in the method's call scope after its parameters.
+// Bound methods own one, method invocations pass theirs without allocating it.
+// 'super' isn't part of it, methods of subclasses capture their superclass when they're created
+struct Receiver {
+  Value this;
+};
+
+// Flat array of the upvalues of a closure, shared between copies of a function value
+struct Captures {
+  size_t refs;
+  size_t count;
+  Upvalue* xs[];
+};
+
+static inline enum ValueType value_type(Value v) {
+  static const enum ValueType tags[8] = {
+    EVAL_TYPE_STRING_VIEW, EVAL_TYPE_NIL, EVAL_TYPE_ERR, EVAL_TYPE_BOOL,
+    EVAL_TYPE_ERR, EVAL_TYPE_FUN, EVAL_TYPE_CLASS, EVAL_TYPE_INSTANCE,
+  };
+
+  if ((v.bits & VALUE_QNAN) != VALUE_QNAN) return EVAL_TYPE_DOUBLE;
+  return tags[((v.bits >> 61) & 4) | ((v.bits >> 48) & 3)];
+}
+
+static inline bool value_is_double(Value v) {
+  return (v.bits & VALUE_QNAN) != VALUE_QNAN;
+}
+
+// Functions, classes and instances
+static inline bool value_is_object(Value v) {
+  return (v.bits & (VALUE_SIGN_BIT | VALUE_QNAN)) == (VALUE_SIGN_BIT | VALUE_QNAN);
+}
+
+static inline void* value_as_pointer(Value v) {
+  return (void*)(uintptr_t)(v.bits & VALUE_PAYLOAD_MASK);
+}
+
+static inline double value_as_double(Value v) {
+  union { uint64_t bits; double d; } u = {v.bits};
+  return u.d;
+}
+
+static inline bool value_as_bool(Value v) {
+  return (v.bits & 1) != 0;
+}
+
+static inline StringView value_as_sv(Value v) {
+  return ((const struct StringValue*)value_as_pointer(v))->sv;
+}
+
+static inline FunctionValue* value_as_fun(Value v) {
+  return (FunctionValue*)value_as_pointer(v);
+}
+
+static inline struct ClassValue* value_as_class(Value v) {
+  return (struct ClassValue*)value_as_pointer(v);
+}
+
+static inline struct InstanceValue* value_as_instance(Value v) {
+  return (struct InstanceValue*)value_as_pointer(v);
+}
+
+static inline Value value_new_double(double val) {
+  union { double d; uint64_t bits; } u = {val};
+  return (Value){u.bits};
+}
+
+static inline Value value_new_bool(bool val) {
+  return (Value){VALUE_BOX_BOOL | (val ? 1 : 0)};
+}
+
+static inline Value value_new_err() {
+  return (Value){VALUE_BOX_ERR};
+}
+
+static inline Value value_new_nil() {
+  return (Value){VALUE_BOX_NIL};
+}
+
+// Stands for an operand that failed to convert, arithmetic keeps reading 0 or false out of it.
+// An error value would be read as a NaN whose payload is the error tag
+static inline Value value_new_zero(enum ValueType type) {
+  return (type == EVAL_TYPE_BOOL) ? value_new_bool(false) : value_new_double(0.0);
+}
+
+static inline Value value_box_object(uint64_t box, void* object) {
+  return (Value){box | ((uint64_t)(uintptr_t)object & VALUE_PAYLOAD_MASK)};
+}
+
+static inline const char* eval_type_to_str(enum ValueType t) {
   switch (t) {
   case EVAL_TYPE_DOUBLE:
     return "double";
@@ -106,27 +274,83 @@ static const char* eval_type_to_str(enum ValueType t) {
   case EVAL_TYPE_NIL:
     return "nil";
   }
+  return "unknown";
 }
 
 void value_pretty_print(const Value* v);
-bool is_convertible_to_type(const Value* e, enum ValueType expected); 
-bool convert_to(Value* e, enum ValueType to_type); 
+
+typedef void (*ConversionFn)(Value* e);
+typedef Value (*BinaryOperatorFn)(Value left, Value right);
+
+// Dispatch tables filled at compile time, NULL where the types have no entry, see value.c
+extern const ConversionFn conversions[EVAL_TYPE_COUNT][EVAL_TYPE_COUNT];
+// Pairs without an entry have their operands converted to doubles, every operator has an entry for those
+extern const BinaryOperatorFn binary_operators[BINARY_OP_COUNT][EVAL_TYPE_COUNT][EVAL_TYPE_COUNT];
+
+static inline bool is_convertible_to_type(const Value* e, enum ValueType expected) {
+  enum ValueType type = value_type(*e);
+  return type == expected || conversions[type][expected] != NULL;
+}
+
+static inline bool convert_to(Value* e, enum ValueType to_type) {
+  enum ValueType type = value_type(*e);
+  if (type == to_type) return true;
+
+  ConversionFn fn = conversions[type][to_type];
+  if (fn == NULL) return false;
+
+  fn(e);
+  return true;
+}
+
+static inline BinaryOperatorFn binary_operator_find(enum BinaryOperator op, Value left, Value right) {
+  return binary_operators[op][value_type(left)][value_type(right)];
+}
+
+// Whether op has an entry for some pair with this left type. When it doesn't,
+// the left operand can be converted before the right one is evaluated
+static inline bool binary_operator_takes_left(enum BinaryOperator op, enum ValueType left) {
+  for (size_t right = 0; right < EVAL_TYPE_COUNT; ++right) {
+    if (binary_operators[op][left][right] != NULL) return true;
+  }
+  return false;
+}
 
 void value_init(size_t num_classes, size_t num_instances, StringView this_keyword, StringView super_keyword);
 void value_free();
-Value value_new_double(double val);
+// Interns sv, its characters must outlive the value module
 Value value_new_stringview(StringView sv);
-Value value_new_bool(bool val);
-Value value_new_err();
-Value value_new_nil();
-Value value_new_fun(Statement* body, const StringView* params, size_t num_params, ScopeRef capture);
-ClassMethods build_class_methods(struct ClassMethodsDecl methods_decl);
+Value value_new_fun(const FunctionProto* proto, struct Captures* captures);
+// super is NULL for classes without a superclass
+ClassMethods build_class_methods(struct ClassMethodsDecl methods_decl, const Value* super);
 Value value_new_class(StringView name, ClassMethods methods, const Value* super);
 Value value_new_instance(const Value* class);
-Value instance_find_property(const Value* instance, StringView name);
-void instance_set_property(Value* instance, StringView name, const Value* insert);
+// cache may be NULL
+Value instance_find_property(const Value* instance, StringView name, PropertyCache* cache);
+// Same lookup as instance_find_property, made to call the property right away: methods aren't bound,
+// receiver is set to the instance they run on instead. receiver->this is nil for other properties
+Value instance_find_method(const Value* instance, StringView name, PropertyCache* cache, struct Receiver* receiver);
+// Lookups through 'super': methods are the superclass' ones and run on this, properties are the ones of this
+Value super_find_property(const Value* super, const Value* this, StringView name);
+Value super_find_method(const Value* super, const Value* this, StringView name, struct Receiver* receiver);
+void instance_set_property(Value* instance, StringView name, const Value* insert, PropertyCache* cache);
+
+// Frees an object whose last reference went away
+void value_object_free(Value v);
 
-Value value_copy(const Value* v);
-void value_scopeexit(Value* v);
+static inline Value value_copy(const Value* v) {
+  if (value_is_object(*v)) {
+    ((struct ValueObject*)value_as_pointer(*v))->refs += 1;
+  }
+  return *v;
+}
+
+static inline void value_scopeexit(Value* v) {
+  if (!value_is_object(*v)) return;
+
+  struct ValueObject* obj = value_as_pointer(*v);
+  obj->refs -= 1;
+  if (obj->refs == 0) value_object_free(*v);
+}
 
 #endif
@@ -0,0 +1,696 @@
+#include "vm.h"
+#include "parser.h"
+#include "interpreter.h"
+#include "resolver.h"
+#include "jit.h"
+#include "interpreter/scope.h"
+#include "interpreter/stack.h"
+#include "types/value.h"
+#include "types/string_view.h"
+#include "types/token.h"
+#include "error/runtime.h"
+
+#include <assert.h>
+#include <string.h>
+#include <math.h>
+
+// Labels as values are a GNU extension, other compilers get a switch based dispatch
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_COMPUTED_GOTO
+#endif
+
+static VM vm;
+
+static inline void push(Value v) {
+  stack_push(&vm.stack, &v);
+}
+
+static inline Value pop() {
+  return stack_pop(&vm.stack);
+}
+
+// Pops and releases the top n values
+static void discard(size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    Value v = pop();
+    value_scopeexit(&v);
+  }
+}
+
+static void binary_convert_operand(Value* v, Expression* origin, bool left, enum ValueType expected_type) {
+  if (convert_to(v, expected_type)) return;
+
+  runtime_error(
+    find_token(left ? origin->binary.left : origin->binary.right),
+    "Binary operation not permitted: %s operand is not convertible to %s",
+    left ? "left" : "right", eval_type_to_str(expected_type)
+  );
+
+  value_scopeexit(v);
+  *v = value_new_zero(expected_type);
+}
+
+// Operand pairs without an entry in the dispatch table are converted to doubles.
+// Releases both operands
+static Value binary_apply(enum BinaryOperator op, Value* l, Value* r, Expression* origin) {
+  BinaryOperatorFn fn = binary_operator_find(op, *l, *r);
+  if (fn == NULL) {
+    binary_convert_operand(l, origin, true, EVAL_TYPE_DOUBLE);
+    binary_convert_operand(r, origin, false, EVAL_TYPE_DOUBLE);
+    fn = binary_operators[op][EVAL_TYPE_DOUBLE][EVAL_TYPE_DOUBLE];
+  }
+
+  Value e = fn(*l, *r);
+  value_scopeexit(l);
+  value_scopeexit(r);
+  return e;
+}
+
+// memo is the cache entry of a pure function call, NULL otherwise
+static bool call_function(Value* callee, size_t argc, Expression* origin, const struct Receiver* receiver, Value instance, const MemoCall* memo) {
+  FunctionValue* fn = value_as_fun(*callee);
+  size_t params_count = fn->proto->params.count;
+
+  if (argc < params_count) {
+    runtime_error_missing_args(&origin->call.open_paren, fn->proto->params.xs, argc, params_count);
+    return false;
+  } else if (argc > params_count) {
+    runtime_error(&origin->call.open_paren, "Extraneous arguments in function call");
+    return false;
+  }
+
+  if (vm.frame_count == MAX_FRAMES) {
+    runtime_error(&origin->call.open_paren, "Call stack overflow");
+    exit(70);
+  }
+
+  const CompiledFunction* compiled = program_find_function(vm.program, fn->proto->body);
+  assert(compiled && "Function body was not compiled");
+
+  // Enter the call scope and bind the callee and args
+  scope_enter_call(fn);
+  ScopeRef arg_scope = scope_ref_get_current();
+  scope_define_into(arg_scope, CALLEE_SLOT, compiled->name, callee);
+  Value* args = stack_peek(&vm.stack, argc - 1);
+  for (size_t i = 0; i < argc; ++i) {
+    scope_define_into(arg_scope, CALLEE_SLOT + 1 + i, fn->proto->params.xs[i], args + i);
+  }
+  scope_define_receiver(arg_scope, fn, receiver);
+  scope_ref_release(&arg_scope);
+
+  // args and callee
+  discard(argc + 1);
+
+  vm.frames[vm.frame_count++] = (CallFrame){
+    .fn = compiled,
+    .chunk = &compiled->chunk,
+    .ip = compiled->chunk.code.xs,
+    .instance = instance,
+    .memo = memo ? *memo : (MemoCall){0},
+  };
+
+  return true;
+}
+
+// Calls the callee sitting below argc args, returns true when a frame was pushed
+static bool call_value(size_t argc, Expression* origin, const struct Receiver* receiver) {
+  Value* callee = stack_peek(&vm.stack, argc);
+
+  switch (value_type(*callee)) {
+    case EVAL_TYPE_FUN: {
+      FunctionValue* fn = value_as_fun(*callee);
+      Value* args = stack_peek(&vm.stack, argc - 1);
+      Value native_ret;
+      MemoCall memo = {0};
+      if (fn->proto->pure && memo_lookup(fn, args, argc, &native_ret, &memo)) {
+        discard(argc + 1);
+        push(native_ret);
+      } else if (jit_call(fn, args, argc, &native_ret)) {
+        discard(argc + 1);
+        push(native_ret);
+      } else if (call_function(callee, argc, origin, receiver, value_new_nil(), &memo)) {
+        return true;
+      } else {
+        discard(argc + 1);
+        push(value_new_err());
+      }
+    }
+    break;
+
+    case EVAL_TYPE_CLASS: {
+      Value instance = value_new_instance(callee);
+      struct Receiver this;
+      Value constructor = instance_find_method(&instance, sv_new("constructor"), NULL, &this);
+      if (value_type(constructor) == EVAL_TYPE_FUN) {
+        value_scopeexit(callee);
+        *callee = constructor;
+        if (call_function(callee, argc, origin, &this, instance, NULL)) {
+          return true;
+        }
+      } else {
+        value_scopeexit(&constructor);
+      }
+
+      discard(argc + 1);
+      push(instance);
+    }
+    break;
+
+    case EVAL_TYPE_ERR:
+      // An unresolved identifier has already been reported by OP_GET_CALLEE
+      if (origin->call.callee->type != EXPRESSION_LITERAL) {
+        runtime_error(find_token(origin->call.callee), "Cannot resolve callee as callable");
+      }
+      discard(argc + 1);
+      push(value_new_err());
+    break;
+
+    default:
+      runtime_error(find_token(origin->call.callee), "Cannot resolve callee as callable");
+      discard(argc + 1);
+      push(value_new_err());
+  }
+  return false;
+}
+
+static void define_class(Statement* stmt) {
+  StringView identifier = stmt->class_decl.identifier;
+
+  Value* super = NULL;
+  if (stmt->class_decl.super) {
+    Token* super_token = &stmt->class_decl.super->literal;
+    super = scope_get_val_ref(stmt->class_decl.super->var);
+    if (!super) {
+      runtime_error(super_token, "Can't find class \""SV_Fmt"\" to inherit from", SV_Fmt_arg(super_token->lexeme));
+      return;
+    } else if (value_type(*super) != EVAL_TYPE_CLASS) {
+      runtime_error(super_token, "\""SV_Fmt"\" is not a class !", SV_Fmt_arg(super_token->lexeme));
+      return;
+    }
+  }
+
+  ClassMethods methods = build_class_methods(stmt->class_decl.methods_decl, super);
+  Value class = value_new_class(identifier, methods, super);
+  scope_define(stmt->class_decl.slot, identifier, &class);
+  value_scopeexit(&class);
+  vector_free(methods);
+}
+
+static void run() {
+  CallFrame* frame = vm.frames + vm.frame_count - 1;
+  const Chunk* chunk = frame->chunk;
+  const uint8_t* ip = frame->ip;
+
+#define READ_BYTE() (*ip++)
+#define READ_U16() (ip += 2, chunk_read_u16(ip - 2))
+#define READ_CONSTANT() (chunk->constants.xs + READ_U16())
+#define READ_NAME() (value_as_sv(*READ_CONSTANT()))
+#define READ_VAR() (ip += 4, (VarSlot){chunk_read_u16(ip - 4), chunk_read_u16(ip - 2)})
+// Every byte of an instruction shares the same origin
+#define ORIGIN() (chunk->origins.xs[ip - chunk->code.xs - 1])
+
+#define LOAD_FRAME() do { \
+  frame = vm.frames + vm.frame_count - 1; \
+  chunk = frame->chunk; \
+  ip = frame->ip; \
+} while (0)
+
+#define BINARY_OP(OPERATOR, RESULT_CTOR, OPERATION) do { \
+  Value* l = stack_peek(&vm.stack, 1); \
+  Value* r = stack_peek(&vm.stack, 0); \
+  if (value_type(*l) == EVAL_TYPE_DOUBLE && value_type(*r) == EVAL_TYPE_DOUBLE) { \
+    double a = value_as_double(*l); \
+    double b = value_as_double(*r); \
+    *l = RESULT_CTOR(OPERATION); \
+  } else { \
+    *l = binary_apply(OPERATOR, l, r, ORIGIN()); \
+  } \
+  vector_pop(vm.stack); \
+} while (0)
+
+#ifdef VM_COMPUTED_GOTO
+  static void* dispatch_table[OP_NUM_OPCODES] = {
+    [OP_CONSTANT] = &&do_OP_CONSTANT,
+    [OP_NIL] = &&do_OP_NIL,
+    [OP_TRUE] = &&do_OP_TRUE,
+    [OP_FALSE] = &&do_OP_FALSE,
+    [OP_POP] = &&do_OP_POP,
+    [OP_GET_VAR] = &&do_OP_GET_VAR,
+    [OP_GET_CALLEE] = &&do_OP_GET_CALLEE,
+    [OP_SET_VAR] = &&do_OP_SET_VAR,
+    [OP_DEFINE_VAR] = &&do_OP_DEFINE_VAR,
+    [OP_GET_PROPERTY] = &&do_OP_GET_PROPERTY,
+    [OP_SET_PROPERTY] = &&do_OP_SET_PROPERTY,
+    [OP_GET_METHOD] = &&do_OP_GET_METHOD,
+    [OP_GET_SUPER] = &&do_OP_GET_SUPER,
+    [OP_GET_SUPER_METHOD] = &&do_OP_GET_SUPER_METHOD,
+    [OP_NEGATE] = &&do_OP_NEGATE,
+    [OP_NOT] = &&do_OP_NOT,
+    [OP_ADD] = &&do_OP_ADD,
+    [OP_SUBTRACT] = &&do_OP_SUBTRACT,
+    [OP_MULTIPLY] = &&do_OP_MULTIPLY,
+    [OP_DIVIDE] = &&do_OP_DIVIDE,
+    [OP_LESS] = &&do_OP_LESS,
+    [OP_LESS_EQUAL] = &&do_OP_LESS_EQUAL,
+    [OP_GREATER] = &&do_OP_GREATER,
+    [OP_GREATER_EQUAL] = &&do_OP_GREATER_EQUAL,
+    [OP_EQUAL] = &&do_OP_EQUAL,
+    [OP_NOT_EQUAL] = &&do_OP_NOT_EQUAL,
+    [OP_TEST_AND] = &&do_OP_TEST_AND,
+    [OP_TEST_OR] = &&do_OP_TEST_OR,
+    [OP_TO_BOOL] = &&do_OP_TO_BOOL,
+    [OP_JUMP] = &&do_OP_JUMP,
+    [OP_JUMP_IF_FALSE] = &&do_OP_JUMP_IF_FALSE,
+    [OP_LOOP] = &&do_OP_LOOP,
+    [OP_SCOPE_PUSH] = &&do_OP_SCOPE_PUSH,
+    [OP_SCOPE_POP] = &&do_OP_SCOPE_POP,
+    [OP_FUNCTION] = &&do_OP_FUNCTION,
+    [OP_CLASS] = &&do_OP_CLASS,
+    [OP_CALL] = &&do_OP_CALL,
+    [OP_INVOKE] = &&do_OP_INVOKE,
+    [OP_RETURN] = &&do_OP_RETURN,
+    [OP_PRINT] = &&do_OP_PRINT,
+    [OP_RUNTIME_ERROR] = &&do_OP_RUNTIME_ERROR,
+    [OP_HALT] = &&do_OP_HALT,
+  };
+
+#define CASE(OP) do_##OP:
+#define DISPATCH() goto *dispatch_table[READ_BYTE()]
+
+  DISPATCH();
+#else
+#define CASE(OP) case OP:
+#define DISPATCH() continue
+
+  for (;;) switch (READ_BYTE()) {
+#endif
+
+  CASE(OP_CONSTANT) {
+    push(*READ_CONSTANT());
+    DISPATCH();
+  }
+
+  CASE(OP_NIL) {
+    push(value_new_nil());
+    DISPATCH();
+  }
+
+  CASE(OP_TRUE) {
+    push(value_new_bool(true));
+    DISPATCH();
+  }
+
+  CASE(OP_FALSE) {
+    push(value_new_bool(false));
+    DISPATCH();
+  }
+
+  CASE(OP_POP) {
+    discard(1);
+    DISPATCH();
+  }
+
+  CASE(OP_GET_VAR) {
+    Value val = scope_get_val_copy(READ_VAR());
+    if (value_type(val) == EVAL_TYPE_ERR) {
+      StringView name = ORIGIN()->literal.lexeme;
+      runtime_error(NULL, "Unresolved identifier: "SV_Fmt, SV_Fmt_arg(name));
+    }
+    push(val);
+    DISPATCH();
+  }
+
+  CASE(OP_GET_CALLEE) {
+    ValueRef callee = scope_get_val_ref(READ_VAR());
+    if (callee == NULL) {
+      runtime_error(find_token(ORIGIN()), "Unresolved identifier as callable");
+      push(value_new_err());
+    } else {
+      push(value_copy(callee));
+    }
+    DISPATCH();
+  }
+
+  CASE(OP_SET_VAR) {
+    VarSlot var = READ_VAR();
+    Value* rhs = stack_peek(&vm.stack, 0);
+    if (!scope_assign(var, rhs)) {
+      runtime_error(&ORIGIN()->assignment.name, "Assignement failed. Variable must be declared with the 'var' keyword first");
+      value_scopeexit(rhs);
+      *rhs = value_new_err();
+    }
+    DISPATCH();
+  }
+
+  CASE(OP_DEFINE_VAR) {
+    uint16_t slot = READ_U16();
+    StringView name = READ_NAME();
+    Value e = pop();
+    scope_define(slot, name, &e);
+    value_scopeexit(&e);
+    DISPATCH();
+  }
+
+  CASE(OP_GET_PROPERTY) {
+    StringView name = READ_NAME();
+    Value object = pop();
+    if (value_type(object) != EVAL_TYPE_INSTANCE) {
+      runtime_error(find_token(ORIGIN()), "Get accessor must be used on instances");
+      value_scopeexit(&object);
+      push(value_new_err());
+      DISPATCH();
+    }
+
+    Value property = instance_find_property(&object, name, &ORIGIN()->get.cache);
+    value_scopeexit(&object);
+    push(property);
+    DISPATCH();
+  }
+
+  CASE(OP_GET_METHOD) {
+    StringView name = READ_NAME();
+    Value object = pop();
+    if (value_type(object) != EVAL_TYPE_INSTANCE) {
+      runtime_error(find_token(ORIGIN()), "Get accessor must be used on instances");
+      value_scopeexit(&object);
+      push(value_new_nil());
+      push(value_new_err());
+      DISPATCH();
+    }
+
+    // The receiver stays below the method until OP_INVOKE
+    struct Receiver receiver;
+    Value method = instance_find_method(&object, name, &ORIGIN()->get.cache, &receiver);
+    push(value_copy(&receiver.this));
+    push(method);
+    value_scopeexit(&object);
+    DISPATCH();
+  }
+
+  CASE(OP_GET_SUPER) {
+    StringView name = READ_NAME();
+    Value super = pop();
+    Value this = pop();
+    push(super_find_property(&super, &this, name));
+    value_scopeexit(&super);
+    value_scopeexit(&this);
+    DISPATCH();
+  }
+
+  CASE(OP_GET_SUPER_METHOD) {
+    StringView name = READ_NAME();
+    Value super = pop();
+    struct Receiver receiver;
+    push(super_find_method(&super, stack_peek(&vm.stack, 0), name, &receiver));
+    value_scopeexit(&super);
+    DISPATCH();
+  }
+
+  CASE(OP_SET_PROPERTY) {
+    StringView name = READ_NAME();
+    Value right = pop();
+    Value object = pop();
+    if (value_type(object) != EVAL_TYPE_INSTANCE) {
+      runtime_error(find_token(ORIGIN()), "Get accessor must be used on instances");
+      value_scopeexit(&right);
+      value_scopeexit(&object);
+      push(value_new_err());
+      DISPATCH();
+    }
+
+    instance_set_property(&object, name, &right, &ORIGIN()->set.cache);
+    value_scopeexit(&right);
+    push(object);
+    DISPATCH();
+  }
+
+  CASE(OP_NEGATE) {
+    Value* v = stack_peek(&vm.stack, 0);
+    if (value_type(*v) == EVAL_TYPE_DOUBLE || convert_to(v, EVAL_TYPE_DOUBLE)) {
+      *v = value_new_double(-value_as_double(*v));
+    } else {
+      runtime_error(find_token(ORIGIN()->unary.child), "Unary operation not permitted: operand is not a number");
+      value_scopeexit(v);
+      *v = value_new_err();
+    }
+    DISPATCH();
+  }
+
+  CASE(OP_NOT) {
+    Value* v = stack_peek(&vm.stack, 0);
+    if (convert_to(v, EVAL_TYPE_BOOL)) {
+      *v = value_new_bool(!value_as_bool(*v));
+    } else {
+      runtime_error(find_token(ORIGIN()->unary.child), "Unary operation not permitted: operand is not convertible to boolean");
+      value_scopeexit(v);
+      *v = value_new_err();
+    }
+    DISPATCH();
+  }
+
+  CASE(OP_ADD) {
+    BINARY_OP(BINARY_OP_ADD, value_new_double, a + b);
+    DISPATCH();
+  }
+
+  CASE(OP_SUBTRACT) {
+    BINARY_OP(BINARY_OP_SUBTRACT, value_new_double, a - b);
+    DISPATCH();
+  }
+
+  CASE(OP_MULTIPLY) {
+    BINARY_OP(BINARY_OP_MULTIPLY, value_new_double, a * b);
+    DISPATCH();
+  }
+
+  CASE(OP_DIVIDE) {
+    BINARY_OP(BINARY_OP_DIVIDE, value_new_double, (b == 0.0) ? NAN : a / b);
+    DISPATCH();
+  }
+
+  CASE(OP_LESS) {
+    BINARY_OP(BINARY_OP_LESS, value_new_bool, a < b);
+    DISPATCH();
+  }
+
+  CASE(OP_LESS_EQUAL) {
+    BINARY_OP(BINARY_OP_LESS_EQUAL, value_new_bool, a <= b);
+    DISPATCH();
+  }
+
+  CASE(OP_GREATER) {
+    BINARY_OP(BINARY_OP_GREATER, value_new_bool, a > b);
+    DISPATCH();
+  }
+
+  CASE(OP_GREATER_EQUAL) {
+    BINARY_OP(BINARY_OP_GREATER_EQUAL, value_new_bool, a >= b);
+    DISPATCH();
+  }
+
+  CASE(OP_EQUAL) {
+    BINARY_OP(BINARY_OP_EQUAL, value_new_bool, a == b);
+    DISPATCH();
+  }
+
+  CASE(OP_NOT_EQUAL) {
+    BINARY_OP(BINARY_OP_NOT_EQUAL, value_new_bool, a != b);
+    DISPATCH();
+  }
+
+  CASE(OP_TEST_AND) {
+    uint16_t offset = READ_U16();
+    Value* left = stack_peek(&vm.stack, 0);
+    binary_convert_operand(left, ORIGIN(), true, EVAL_TYPE_BOOL);
+    if (!value_as_bool(*left)) {
+      *left = value_new_bool(false);
+      ip += offset;
+    } else {
+      vector_pop(vm.stack);
+    }
+    DISPATCH();
+  }
+
+  CASE(OP_TEST_OR) {
+    uint16_t offset = READ_U16();
+    Value* left = stack_peek(&vm.stack, 0);
+    binary_convert_operand(left, ORIGIN(), true, EVAL_TYPE_BOOL);
+    if (value_as_bool(*left)) {
+      *left = value_new_bool(true);
+      ip += offset;
+    } else {
+      vector_pop(vm.stack);
+    }
+    DISPATCH();
+  }
+
+  CASE(OP_TO_BOOL) {
+    Value* right = stack_peek(&vm.stack, 0);
+    binary_convert_operand(right, ORIGIN(), false, EVAL_TYPE_BOOL);
+    *right = value_new_bool(value_as_bool(*right));
+    DISPATCH();
+  }
+
+  CASE(OP_JUMP) {
+    uint16_t offset = READ_U16();
+    ip += offset;
+    DISPATCH();
+  }
+
+  CASE(OP_JUMP_IF_FALSE) {
+    enum JumpCondition kind = READ_BYTE();
+    uint16_t offset = READ_U16();
+    Value condition = pop();
+    if (!convert_to(&condition, EVAL_TYPE_BOOL)) {
+      runtime_error(NULL, (kind == JUMP_CONDITION_IF)
+        ? "If statement condition can't be evaluated as boolean"
+        : "While loop condition does not evaluate to bool");
+      value_scopeexit(&condition);
+      // The branch of an if ends with the jump past the whole conditional, the other branches are skipped too
+      ip += (kind == JUMP_CONDITION_IF) ? offset - 3 : offset;
+    } else if (!value_as_bool(condition)) {
+      ip += offset;
+    }
+    DISPATCH();
+  }
+
+  CASE(OP_LOOP) {
+    uint16_t offset = READ_U16();
+    ip -= offset;
+    DISPATCH();
+  }
+
+  CASE(OP_SCOPE_PUSH) {
+    ScopeLayout layout = {.size = READ_U16()};
+    layout.captured = READ_BYTE();
+    scope_enter_block(layout);
+    DISPATCH();
+  }
+
+  CASE(OP_SCOPE_POP) {
+    scope_pop();
+    DISPATCH();
+  }
+
+  CASE(OP_FUNCTION) {
+    const CompiledFunction* fn = vm.program->functions.xs[READ_U16()];
+    push(value_new_fun(fn->proto, scope_capture(&fn->proto->upvalues)));
+    DISPATCH();
+  }
+
+  CASE(OP_CLASS) {
+    Statement* stmt = vm.program->classes.xs[READ_U16()];
+    define_class(stmt);
+    DISPATCH();
+  }
+
+  CASE(OP_CALL) {
+    size_t argc = READ_BYTE();
+    frame->ip = ip;
+    if (call_value(argc, ORIGIN(), NULL)) {
+      LOAD_FRAME();
+    }
+    DISPATCH();
+  }
+
+  CASE(OP_INVOKE) {
+    size_t argc = READ_BYTE();
+    frame->ip = ip;
+
+    // The receiver leaves the stack, the callee and args slide over it
+    Value* below = stack_peek(&vm.stack, argc + 1);
+    Value this = *below;
+    memmove(below, below + 1, (argc + 1) * sizeof(Value));
+    vm.stack.count -= 1;
+
+    struct Receiver receiver = { .this = this };
+
+    bool entered = call_value(argc, ORIGIN(), &receiver);
+    value_scopeexit(&this);
+    if (entered) {
+      LOAD_FRAME();
+    }
+    DISPATCH();
+  }
+
+  CASE(OP_RETURN) {
+    size_t block_scopes = READ_BYTE();
+    Value ret = pop();
+
+    for (size_t i = 0; i < block_scopes; ++i) {
+      scope_pop();
+    }
+    scope_leave_call();
+    memo_store(&frame->memo, &ret);
+
+    if (value_type(frame->instance) == EVAL_TYPE_INSTANCE) {
+      value_scopeexit(&ret);
+      ret = frame->instance;
+    }
+
+    vm.frame_count -= 1;
+    LOAD_FRAME();
+    push(ret);
+    DISPATCH();
+  }
+
+  CASE(OP_PRINT) {
+    Value e = pop();
+    value_pretty_print(&e);
+    printf("\n");
+    value_scopeexit(&e);
+    DISPATCH();
+  }
+
+  CASE(OP_RUNTIME_ERROR) {
+    Value* msg = READ_CONSTANT();
+    runtime_error(find_token(ORIGIN()), SV_Fmt, SV_Fmt_arg(value_as_sv(*msg)));
+    DISPATCH();
+  }
+
+  CASE(OP_HALT) {
+    return;
+  }
+
+#ifndef VM_COMPUTED_GOTO
+  }
+#endif
+
+#undef READ_BYTE
+#undef READ_U16
+#undef READ_CONSTANT
+#undef READ_NAME
+#undef READ_VAR
+#undef ORIGIN
+#undef LOAD_FRAME
+#undef BINARY_OP
+#undef CASE
+#undef DISPATCH
+}
+
+void vm_run(const Program* program) {
+  const char* this = keyword_to_string(RESERVED_KEYWORD_THIS);
+  assert(this && "Unable to get string value of RESERVED_KEYWORD_THIS");
+  const char* super = keyword_to_string(RESERVED_KEYWORD_SUPER);
+  assert(super && "Unable to get string value of RESERVED_KEYWORD_SUPER");
+
+  value_init(NUM_CLASSES, NUM_INSTANCES, sv_new(this), sv_new(super));
+
+  vm.program = program;
+  vm.stack = stack_new();
+  vm.frame_count = 1;
+  vm.frames[0] = (CallFrame){
+    .fn = NULL,
+    .chunk = &program->script,
+    .ip = program->script.code.xs,
+    .instance = value_new_nil(),
+  };
+
+  scope_new();
+  run();
+  scope_pop();
+
+  stack_free(&vm.stack);
+  value_free();
+  jit_free();
+}
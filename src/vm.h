@@ -0,0 +1,29 @@
+#ifndef _VM_H
+#define _VM_H
+
+#include "vm/chunk.h"
+#include "interpreter/stack.h"
+#include "interpreter/memo.h"
+
+#define MAX_FRAMES 1024
+
+typedef struct {
+  const CompiledFunction* fn;
+  const Chunk* chunk;
+  const uint8_t* ip;
+  // instance being built when the frame runs a constructor, nil otherwise
+  Value instance;
+  // cache entry of a pure function call, stored when the frame returns
+  MemoCall memo;
+} CallFrame;
+
+typedef struct {
+  const Program* program;
+  Stack stack;
+  CallFrame frames[MAX_FRAMES];
+  size_t frame_count;
+} VM;
+
+void vm_run(const Program* program);
+
+#endif
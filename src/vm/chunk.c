@@ -0,0 +1,227 @@
+#include "chunk.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "../types/vector.h"
+
+#define CHUNK_INITIAL_CAP 64
+
+void chunk_new(Chunk* chunk) {
+  vector_new(chunk->code, CHUNK_INITIAL_CAP);
+  vector_new(chunk->origins, CHUNK_INITIAL_CAP);
+  vector_new(chunk->constants, 8);
+}
+
+void chunk_free(Chunk* chunk) {
+  vector_free(chunk->code);
+  vector_free(chunk->origins);
+  vector_free(chunk->constants);
+}
+
+void chunk_write(Chunk* chunk, uint8_t byte, Expression* origin) {
+  vector_push(chunk->code, byte);
+  vector_push(chunk->origins, origin);
+}
+
+void chunk_write_u16(Chunk* chunk, uint16_t value, Expression* origin) {
+  chunk_write(chunk, value & 0xFF, origin);
+  chunk_write(chunk, (value >> 8) & 0xFF, origin);
+}
+
+size_t chunk_add_constant(Chunk* chunk, Value value) {
+  vector_push(chunk->constants, value);
+  return chunk->constants.count - 1;
+}
+
+static const char* opcode_to_str(enum OpCode op) {
+  switch (op) {
+    case OP_CONSTANT:       return "CONSTANT";
+    case OP_NIL:            return "NIL";
+    case OP_TRUE:           return "TRUE";
+    case OP_FALSE:          return "FALSE";
+    case OP_POP:            return "POP";
+    case OP_GET_VAR:        return "GET_VAR";
+    case OP_GET_CALLEE:     return "GET_CALLEE";
+    case OP_SET_VAR:        return "SET_VAR";
+    case OP_DEFINE_VAR:     return "DEFINE_VAR";
+    case OP_GET_PROPERTY:   return "GET_PROPERTY";
+    case OP_SET_PROPERTY:   return "SET_PROPERTY";
+    case OP_GET_METHOD:     return "GET_METHOD";
+    case OP_GET_SUPER:      return "GET_SUPER";
+    case OP_GET_SUPER_METHOD: return "GET_SUPER_METHOD";
+    case OP_NEGATE:         return "NEGATE";
+    case OP_NOT:            return "NOT";
+    case OP_ADD:            return "ADD";
+    case OP_SUBTRACT:       return "SUBTRACT";
+    case OP_MULTIPLY:       return "MULTIPLY";
+    case OP_DIVIDE:         return "DIVIDE";
+    case OP_LESS:           return "LESS";
+    case OP_LESS_EQUAL:     return "LESS_EQUAL";
+    case OP_GREATER:        return "GREATER";
+    case OP_GREATER_EQUAL:  return "GREATER_EQUAL";
+    case OP_EQUAL:          return "EQUAL";
+    case OP_NOT_EQUAL:      return "NOT_EQUAL";
+    case OP_TEST_AND:       return "TEST_AND";
+    case OP_TEST_OR:        return "TEST_OR";
+    case OP_TO_BOOL:        return "TO_BOOL";
+    case OP_JUMP:           return "JUMP";
+    case OP_JUMP_IF_FALSE:  return "JUMP_IF_FALSE";
+    case OP_LOOP:           return "LOOP";
+    case OP_SCOPE_PUSH:     return "SCOPE_PUSH";
+    case OP_SCOPE_POP:      return "SCOPE_POP";
+    case OP_FUNCTION:       return "FUNCTION";
+    case OP_CLASS:          return "CLASS";
+    case OP_CALL:           return "CALL";
+    case OP_INVOKE:         return "INVOKE";
+    case OP_RETURN:         return "RETURN";
+    case OP_PRINT:          return "PRINT";
+    case OP_RUNTIME_ERROR:  return "RUNTIME_ERROR";
+    case OP_HALT:           return "HALT";
+    default:                return "UNKNOWN";
+  }
+}
+
+// Returns the offset of the next instruction
+static size_t disassemble_instruction(const Chunk* chunk, size_t offset) {
+  const uint8_t* code = chunk->code.xs;
+  enum OpCode op = code[offset];
+  printf("%04zu %-16s", offset, opcode_to_str(op));
+
+  switch (op) {
+    case OP_GET_VAR:
+    case OP_GET_CALLEE:
+    case OP_SET_VAR: {
+      uint16_t depth = chunk_read_u16(code + offset + 1);
+      uint16_t slot = chunk_read_u16(code + offset + 3);
+      if (depth == UPVALUE_DEPTH) printf("   up %5u\n", slot);
+      else printf("%5u %5u\n", depth, slot);
+      return offset + 5;
+    }
+    case OP_DEFINE_VAR: {
+      uint16_t idx = chunk_read_u16(code + offset + 3);
+      printf("%5u '", chunk_read_u16(code + offset + 1));
+      value_pretty_print(chunk->constants.xs + idx);
+      printf("'\n");
+      return offset + 5;
+    }
+    case OP_CONSTANT:
+    case OP_GET_PROPERTY:
+    case OP_SET_PROPERTY:
+    case OP_GET_METHOD:
+    case OP_GET_SUPER:
+    case OP_GET_SUPER_METHOD:
+    case OP_RUNTIME_ERROR: {
+      uint16_t idx = chunk_read_u16(code + offset + 1);
+      printf("%5u '", idx);
+      value_pretty_print(chunk->constants.xs + idx);
+      printf("'\n");
+      return offset + 3;
+    }
+    case OP_FUNCTION:
+    case OP_CLASS:
+      printf("%5u\n", chunk_read_u16(code + offset + 1));
+      return offset + 3;
+    case OP_CALL:
+    case OP_INVOKE:
+    case OP_RETURN:
+      printf("%5u\n", code[offset + 1]);
+      return offset + 2;
+    case OP_TEST_AND:
+    case OP_TEST_OR:
+    case OP_JUMP: {
+      uint16_t jump = chunk_read_u16(code + offset + 1);
+      printf("%5zu -> %zu\n", offset, offset + 3 + jump);
+      return offset + 3;
+    }
+    case OP_JUMP_IF_FALSE: {
+      uint16_t jump = chunk_read_u16(code + offset + 2);
+      printf("%5zu -> %zu\n", offset, offset + 4 + jump);
+      return offset + 4;
+    }
+    case OP_LOOP: {
+      uint16_t jump = chunk_read_u16(code + offset + 1);
+      printf("%5zu -> %zu\n", offset, offset + 3 - jump);
+      return offset + 3;
+    }
+    case OP_SCOPE_PUSH:
+      printf("%5u%s\n", chunk_read_u16(code + offset + 1), code[offset + 3] ? " captured" : "");
+      return offset + 4;
+    default:
+      printf("\n");
+      return offset + 1;
+  }
+}
+
+void chunk_disassemble(const Chunk* chunk, const char* name) {
+  printf("== %s ==\n", name);
+  for (size_t offset = 0; offset < chunk->code.count;) {
+    offset = disassemble_instruction(chunk, offset);
+  }
+}
+
+void program_new(Program* program) {
+  chunk_new(&program->script);
+  vector_new(program->functions, 8);
+  vector_new(program->classes, 4);
+  program->table.xs = NULL;
+  program->table.capacity = 0;
+}
+
+void program_free(Program* program) {
+  chunk_free(&program->script);
+  for (size_t i = 0; i < program->functions.count; ++i) {
+    CompiledFunction* fn = program->functions.xs[i];
+    chunk_free(&fn->chunk);
+    free(fn);
+  }
+  vector_free(program->functions);
+  vector_free(program->classes);
+  free(program->table.xs);
+}
+
+static size_t function_table_hash(const Statement* body, size_t capacity) {
+  uintptr_t h = (uintptr_t)body;
+  h ^= h >> 17;
+  h *= 0x9E3779B97F4A7C15ull;
+  return (size_t)(h >> 7) & (capacity - 1);
+}
+
+// Builds the body -> function lookup table, to be called once compilation is done
+void program_link(Program* program) {
+  size_t capacity = 8;
+  while (capacity < program->functions.count * 2) capacity *= 2;
+
+  program->table.capacity = capacity;
+  program->table.xs = calloc(capacity, sizeof(CompiledFunction*));
+
+  for (size_t i = 0; i < program->functions.count; ++i) {
+    CompiledFunction* fn = program->functions.xs[i];
+    size_t idx = function_table_hash(fn->proto->body, capacity);
+    while (program->table.xs[idx]) idx = (idx + 1) & (capacity - 1);
+    program->table.xs[idx] = fn;
+  }
+}
+
+CompiledFunction* program_find_function(const Program* program, const Statement* body) {
+  size_t capacity = program->table.capacity;
+  size_t idx = function_table_hash(body, capacity);
+
+  CompiledFunction* fn;
+  while ((fn = program->table.xs[idx])) {
+    if (fn->proto->body == body) return fn;
+    idx = (idx + 1) & (capacity - 1);
+  }
+
+  return NULL;
+}
+
+void program_disassemble(const Program* program) {
+  chunk_disassemble(&program->script, "<script>");
+  for (size_t i = 0; i < program->functions.count; ++i) {
+    const CompiledFunction* fn = program->functions.xs[i];
+    char name[256];
+    snprintf(name, sizeof(name), "[%zu] "SV_Fmt, i, SV_Fmt_arg(fn->name));
+    chunk_disassemble(&fn->chunk, name);
+  }
+}
@@ -0,0 +1,144 @@
+#ifndef _CHUNK_H
+#define _CHUNK_H
+
+#include <stdint.h>
+
+#include "../types/value.h"
+#include "../types/statements.h"
+#include "../types/expressions.h"
+
+// Operands are written right after their opcode.
+// u8/u16 operands are little endian, jumps are relative to the end of the instruction
+enum OpCode {
+  OP_CONSTANT,        // u16 constant index
+  OP_NIL,
+  OP_TRUE,
+  OP_FALSE,
+  OP_POP,
+
+  OP_GET_VAR,         // u16 depth, u16 slot
+  OP_GET_CALLEE,      // u16 depth, u16 slot
+  OP_SET_VAR,         // u16 depth, u16 slot
+  OP_DEFINE_VAR,      // u16 slot, u16 name constant
+  OP_GET_PROPERTY,    // u16 name constant
+  OP_SET_PROPERTY,    // u16 name constant
+  OP_GET_METHOD,      // u16 name constant, pushes the receiver then the method
+  OP_GET_SUPER,       // u16 name constant, pops the superclass and 'this'
+  OP_GET_SUPER_METHOD, // u16 name constant, pops the superclass and leaves 'this' as the receiver
+
+  OP_NEGATE,
+  OP_NOT,
+  OP_ADD,
+  OP_SUBTRACT,
+  OP_MULTIPLY,
+  OP_DIVIDE,
+  OP_LESS,
+  OP_LESS_EQUAL,
+  OP_GREATER,
+  OP_GREATER_EQUAL,
+  OP_EQUAL,
+  OP_NOT_EQUAL,
+
+  OP_TEST_AND,        // u16 jump offset, short circuits when the left operand is false
+  OP_TEST_OR,         // u16 jump offset, short circuits when the left operand is true
+  OP_TO_BOOL,         // converts the right operand of a logical operator
+
+  OP_JUMP,            // u16 forward offset
+  OP_JUMP_IF_FALSE,   // u8 condition kind, u16 forward offset
+  OP_LOOP,            // u16 backward offset
+
+  OP_SCOPE_PUSH,      // u16 slots, u8 captured
+  OP_SCOPE_POP,
+
+  OP_FUNCTION,        // u16 function index
+  OP_CLASS,           // u16 class index
+  OP_CALL,            // u8 argument count
+  OP_INVOKE,          // u8 argument count, the receiver sits below the callee
+  OP_RETURN,          // u8 number of block scopes to pop
+  OP_PRINT,
+  OP_RUNTIME_ERROR,   // u16 message constant
+
+  OP_HALT,
+  OP_NUM_OPCODES,
+};
+
+// Which statement a conditional jump belongs to, only used to report errors
+enum JumpCondition {
+  JUMP_CONDITION_IF,
+  JUMP_CONDITION_WHILE,
+};
+
+struct ChunkCode {
+  uint8_t* xs;
+  size_t count;
+  size_t capacity;
+};
+
+// Source expression of each byte in the code, used to report runtime errors
+struct ChunkOrigins {
+  Expression** xs;
+  size_t count;
+  size_t capacity;
+};
+
+struct ChunkConstants {
+  Value* xs;
+  size_t count;
+  size_t capacity;
+};
+
+typedef struct {
+  struct ChunkCode code;
+  struct ChunkOrigins origins;
+  struct ChunkConstants constants;
+} Chunk;
+
+typedef struct {
+  const FunctionProto* proto;
+  StringView name;
+  Chunk chunk;
+} CompiledFunction;
+
+struct CompiledFunctions {
+  CompiledFunction** xs;
+  size_t count;
+  size_t capacity;
+};
+
+struct CompiledClasses {
+  Statement** xs;
+  size_t count;
+  size_t capacity;
+};
+
+// Maps a function body to its compiled chunk, function values only know about their body
+struct FunctionTable {
+  CompiledFunction** xs;
+  size_t capacity;
+};
+
+typedef struct {
+  Chunk script;
+  struct CompiledFunctions functions;
+  struct CompiledClasses classes;
+  struct FunctionTable table;
+} Program;
+
+void chunk_new(Chunk* chunk);
+void chunk_free(Chunk* chunk);
+void chunk_write(Chunk* chunk, uint8_t byte, Expression* origin);
+void chunk_write_u16(Chunk* chunk, uint16_t value, Expression* origin);
+size_t chunk_add_constant(Chunk* chunk, Value value);
+void chunk_disassemble(const Chunk* chunk, const char* name);
+
+static inline uint16_t chunk_read_u16(const uint8_t* at) {
+  return (uint16_t)at[0] | ((uint16_t)at[1] << 8);
+}
+
+void program_new(Program* program);
+void program_free(Program* program);
+void program_link(Program* program);
+CompiledFunction* program_find_function(const Program* program, const Statement* body);
+void program_disassemble(const Program* program);
+
+#endif
@@ -0,0 +1,438 @@
+#include "compiler.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "../parser.h"
+#include "../resolver.h"
+#include "../types/vector.h"
+#include "../types/token.h"
+#include "../error/analysis.h"
+
+struct Compiler {
+  Program* program;
+  Chunk* chunk;
+  bool in_function;
+  // number of block scopes opened since the start of the current function body
+  size_t scope_depth;
+  bool had_error;
+};
+
+static void compile_expression(struct Compiler* c, Expression* expr);
+static void compile_statement(struct Compiler* c, Statement* stmt);
+
+static void emit_byte(struct Compiler* c, uint8_t byte, Expression* origin) {
+  chunk_write(c->chunk, byte, origin);
+}
+
+static void emit_op_u16(struct Compiler* c, enum OpCode op, uint16_t operand, Expression* origin) {
+  chunk_write(c->chunk, op, origin);
+  chunk_write_u16(c->chunk, operand, origin);
+}
+
+static uint16_t make_constant(struct Compiler* c, Value value, Expression* origin) {
+  size_t idx = chunk_add_constant(c->chunk, value);
+  if (idx > UINT16_MAX) {
+    static_error(origin ? find_token(origin) : NULL, "Too many constants in one chunk");
+    c->had_error = true;
+    return 0;
+  }
+
+  return (uint16_t)idx;
+}
+
+static void emit_constant(struct Compiler* c, Value value, Expression* origin) {
+  emit_op_u16(c, OP_CONSTANT, make_constant(c, value, origin), origin);
+}
+
+static void emit_named(struct Compiler* c, enum OpCode op, StringView name, Expression* origin) {
+  emit_op_u16(c, op, make_constant(c, value_new_stringview(name), origin), origin);
+}
+
+static void emit_var(struct Compiler* c, enum OpCode op, VarSlot var, Expression* origin) {
+  emit_op_u16(c, op, var.depth, origin);
+  chunk_write_u16(c->chunk, var.slot, origin);
+}
+
+static void emit_define(struct Compiler* c, uint16_t slot, StringView name) {
+  emit_op_u16(c, OP_DEFINE_VAR, slot, NULL);
+  chunk_write_u16(c->chunk, make_constant(c, value_new_stringview(name), NULL), NULL);
+}
+
+// Emits a forward jump and returns the offset of its operand for later patching
+static size_t emit_jump(struct Compiler* c, enum OpCode op, Expression* origin) {
+  emit_byte(c, op, origin);
+  emit_byte(c, 0xFF, origin);
+  emit_byte(c, 0xFF, origin);
+  return c->chunk->code.count - 2;
+}
+
+static size_t emit_conditional_jump(struct Compiler* c, enum JumpCondition kind, Expression* origin) {
+  emit_byte(c, OP_JUMP_IF_FALSE, origin);
+  emit_byte(c, kind, origin);
+  emit_byte(c, 0xFF, origin);
+  emit_byte(c, 0xFF, origin);
+  return c->chunk->code.count - 2;
+}
+
+static void patch_jump(struct Compiler* c, size_t operand_offset) {
+  size_t jump = c->chunk->code.count - operand_offset - 2;
+  if (jump > UINT16_MAX) {
+    static_error(NULL, "Too much code to jump over");
+    c->had_error = true;
+  }
+
+  c->chunk->code.xs[operand_offset] = jump & 0xFF;
+  c->chunk->code.xs[operand_offset + 1] = (jump >> 8) & 0xFF;
+}
+
+static void emit_loop(struct Compiler* c, size_t loop_start) {
+  emit_byte(c, OP_LOOP, NULL);
+  size_t jump = c->chunk->code.count - loop_start + 2;
+  if (jump > UINT16_MAX) {
+    static_error(NULL, "Loop body is too large");
+    c->had_error = true;
+  }
+
+  chunk_write_u16(c->chunk, (uint16_t)jump, NULL);
+}
+
+static uint16_t compile_function(struct Compiler* c, StringView name, const FunctionProto* proto) {
+  assert(proto->body->type == STATEMENT_BLOCK && "Function body must be a block");
+
+  CompiledFunction* fn = malloc(sizeof(CompiledFunction));
+  fn->proto = proto;
+  fn->name = name;
+  chunk_new(&fn->chunk);
+
+  vector_push(c->program->functions, fn);
+  size_t idx = c->program->functions.count - 1;
+  if (idx > UINT16_MAX) {
+    static_error(NULL, "Too many functions in one program");
+    c->had_error = true;
+  }
+
+  struct Compiler fc = {
+    .program = c->program,
+    .chunk = &fn->chunk,
+    .in_function = true,
+    .scope_depth = 0,
+    .had_error = false,
+  };
+
+  // Parameters and body share the call scope
+  for (size_t i = 0; i < proto->body->block.count; ++i) {
+    compile_statement(&fc, proto->body->block.xs + i);
+  }
+  emit_byte(&fc, OP_NIL, NULL);
+  emit_byte(&fc, OP_RETURN, NULL);
+  emit_byte(&fc, 0, NULL);
+
+  c->had_error |= fc.had_error;
+  return (uint16_t)idx;
+}
+
+static void compile_expression_literal(struct Compiler* c, Expression* expr) {
+  Token* literal = &expr->literal;
+  switch (literal->type) {
+    case TOKEN_TYPE_STRING:
+      emit_constant(c, parser_constants()[expr->constant], expr);
+    break;
+    case TOKEN_TYPE_NUMBER:
+      emit_constant(c, parser_constants()[expr->constant], expr);
+    break;
+    case TOKEN_TYPE_IDENTIFIER:
+      emit_var(c, OP_GET_VAR, expr->var, expr);
+    break;
+    case TOKEN_TYPE_KEYWORD:
+      switch (literal->keyword) {
+        case RESERVED_KEYWORD_THIS:
+        case RESERVED_KEYWORD_SUPER:
+          emit_var(c, OP_GET_VAR, expr->var, expr);
+        break;
+        case RESERVED_KEYWORD_TRUE:
+          emit_byte(c, OP_TRUE, expr);
+        break;
+        case RESERVED_KEYWORD_FALSE:
+          emit_byte(c, OP_FALSE, expr);
+        break;
+        case RESERVED_KEYWORD_NIL:
+          emit_byte(c, OP_NIL, expr);
+        break;
+        default:
+          internal_logic_error(literal, "Keyword cannot be compiled");
+      }
+    break;
+    default:
+      internal_logic_error(literal, "Unimplemented token type literal");
+  }
+}
+
+static void compile_expression_binary(struct Compiler* c, Expression* expr) {
+  Token* op = &expr->binary.operator;
+
+  if (op->type == TOKEN_TYPE_KEYWORD) {
+    bool is_or = op->keyword == RESERVED_KEYWORD_OR;
+    assert((is_or || op->keyword == RESERVED_KEYWORD_AND) && "Unrecognized logical operator");
+
+    compile_expression(c, expr->binary.left);
+    size_t short_circuit = emit_jump(c, is_or ? OP_TEST_OR : OP_TEST_AND, expr);
+    compile_expression(c, expr->binary.right);
+    emit_byte(c, OP_TO_BOOL, expr);
+    patch_jump(c, short_circuit);
+    return;
+  }
+
+  compile_expression(c, expr->binary.left);
+  compile_expression(c, expr->binary.right);
+
+  enum OpCode opcode;
+  switch (op->type) {
+    case TOKEN_TYPE_PLUS:           opcode = OP_ADD; break;
+    case TOKEN_TYPE_MINUS:          opcode = OP_SUBTRACT; break;
+    case TOKEN_TYPE_STAR:           opcode = OP_MULTIPLY; break;
+    case TOKEN_TYPE_SLASH:          opcode = OP_DIVIDE; break;
+    case TOKEN_TYPE_LESS:           opcode = OP_LESS; break;
+    case TOKEN_TYPE_LESS_EQUAL:     opcode = OP_LESS_EQUAL; break;
+    case TOKEN_TYPE_GREATER:        opcode = OP_GREATER; break;
+    case TOKEN_TYPE_GREATER_EQUAL:  opcode = OP_GREATER_EQUAL; break;
+    case TOKEN_TYPE_EQUAL_EQUAL:    opcode = OP_EQUAL; break;
+    case TOKEN_TYPE_BANG_EQUAL:     opcode = OP_NOT_EQUAL; break;
+    default:
+      internal_logic_error(op, "Binary expression with unrecognized operator");
+      return;
+  }
+
+  emit_byte(c, opcode, expr);
+}
+
+// Pushes 'this' then the superclass
+static void compile_get_super(struct Compiler* c, Expression* get) {
+  emit_var(c, OP_GET_VAR, get->var, get->get.object);
+  emit_var(c, OP_GET_VAR, get->get.object->var, get->get.object);
+}
+
+static void compile_expression_call(struct Compiler* c, Expression* expr) {
+  Expression* callee = expr->call.callee;
+  uint8_t opcode = OP_CALL;
+
+  if (callee->type == EXPRESSION_LITERAL && callee->literal.type == TOKEN_TYPE_IDENTIFIER) {
+    emit_var(c, OP_GET_CALLEE, callee->var, callee);
+  } else if (callee->type == EXPRESSION_GET) {
+    // Methods are invoked on their receiver without being bound
+    if (expression_is_super(callee->get.object)) {
+      compile_get_super(c, callee);
+      emit_named(c, OP_GET_SUPER_METHOD, callee->get.name.lexeme, callee);
+    } else {
+      compile_expression(c, callee->get.object);
+      emit_named(c, OP_GET_METHOD, callee->get.name.lexeme, callee);
+    }
+    opcode = OP_INVOKE;
+  } else {
+    compile_expression(c, callee);
+  }
+
+  for (size_t i = 0; i < expr->call.args.count; ++i) {
+    compile_expression(c, expr->call.args.xs[i]);
+  }
+
+  emit_byte(c, opcode, expr);
+  emit_byte(c, (uint8_t)expr->call.args.count, expr);
+}
+
+static void compile_expression(struct Compiler* c, Expression* expr) {
+  switch (expr->type) {
+    case EXPRESSION_STATIC:
+      switch (value_type(expr->evaluated)) {
+        case EVAL_TYPE_NIL:
+          emit_byte(c, OP_NIL, expr);
+        break;
+        case EVAL_TYPE_BOOL:
+          emit_byte(c, value_as_bool(expr->evaluated) ? OP_TRUE : OP_FALSE, expr);
+        break;
+        default:
+          emit_constant(c, expr->evaluated, expr);
+      }
+    break;
+    case EXPRESSION_LITERAL:
+      compile_expression_literal(c, expr);
+    break;
+    case EXPRESSION_GROUP:
+      compile_expression(c, expr->group.child);
+    break;
+    case EXPRESSION_UNARY:
+      compile_expression(c, expr->unary.child);
+      switch (expr->unary.operator.type) {
+        case TOKEN_TYPE_MINUS:
+          emit_byte(c, OP_NEGATE, expr);
+        break;
+        case TOKEN_TYPE_BANG:
+          emit_byte(c, OP_NOT, expr);
+        break;
+        default:
+          internal_logic_error(&expr->unary.operator, "Unary expression with unrecognized operator");
+      }
+    break;
+    case EXPRESSION_BINARY:
+      compile_expression_binary(c, expr);
+    break;
+    case EXPRESSION_CALL:
+      compile_expression_call(c, expr);
+    break;
+    case EXPRESSION_GET:
+      if (expression_is_super(expr->get.object)) {
+        compile_get_super(c, expr);
+        emit_named(c, OP_GET_SUPER, expr->get.name.lexeme, expr);
+        break;
+      }
+      compile_expression(c, expr->get.object);
+      emit_named(c, OP_GET_PROPERTY, expr->get.name.lexeme, expr);
+    break;
+    case EXPRESSION_SET:
+      compile_expression(c, expr->set.object);
+      compile_expression(c, expr->set.right);
+      emit_named(c, OP_SET_PROPERTY, expr->set.name.lexeme, expr);
+    break;
+    case EXPRESSION_ASSIGNMENT:
+      compile_expression(c, expr->assignment.right);
+      emit_var(c, OP_SET_VAR, expr->var, expr);
+    break;
+    case EXPRESSION_ANON_FUN: {
+      uint16_t idx = compile_function(c, sv_new("<anonymous>"), &expr->anon_fun.proto);
+      emit_op_u16(c, OP_FUNCTION, idx, expr);
+    }
+    break;
+  }
+}
+
+static void compile_statement_conditional(struct Compiler* c, Statement* stmt) {
+  struct EndJumps {
+    size_t* xs;
+    size_t count;
+    size_t capacity;
+  } end_jumps;
+  vector_new(end_jumps, stmt->cond.count);
+
+  for (size_t i = 0; i < stmt->cond.count; ++i) {
+    struct ConditionalBlock* b = stmt->cond.xs + i;
+
+    // else statement
+    if (b->condition == NULL) {
+      compile_statement(c, b->branch);
+      break;
+    }
+
+    compile_expression(c, b->condition);
+    size_t next_branch = emit_conditional_jump(c, JUMP_CONDITION_IF, b->condition);
+    compile_statement(c, b->branch);
+    // Must directly precede the next branch, the VM takes it when the condition isn't a bool
+    vector_push(end_jumps, emit_jump(c, OP_JUMP, NULL));
+    patch_jump(c, next_branch);
+  }
+
+  for (size_t i = 0; i < end_jumps.count; ++i) {
+    patch_jump(c, end_jumps.xs[i]);
+  }
+  vector_free(end_jumps);
+}
+
+static void compile_statement_while(struct Compiler* c, Statement* stmt) {
+  size_t loop_start = c->chunk->code.count;
+  compile_expression(c, stmt->while_loop.condition);
+  size_t exit = emit_conditional_jump(c, JUMP_CONDITION_WHILE, stmt->while_loop.condition);
+  compile_statement(c, stmt->while_loop.body);
+  emit_loop(c, loop_start);
+  patch_jump(c, exit);
+}
+
+static void compile_statement_class_decl(struct Compiler* c, Statement* stmt) {
+  struct ClassMethodsDecl* methods = &stmt->class_decl.methods_decl;
+  for (size_t i = 0; i < methods->count; ++i) {
+    StatementMethodDecl* m = methods->xs + i;
+    compile_function(c, m->identifier, &m->proto);
+  }
+
+  vector_push(c->program->classes, stmt);
+  emit_op_u16(c, OP_CLASS, (uint16_t)(c->program->classes.count - 1), stmt->class_decl.super);
+}
+
+static void compile_statement(struct Compiler* c, Statement* stmt) {
+  switch (stmt->type) {
+    case STATEMENT_EXPR:
+      compile_expression(c, stmt->expr);
+      emit_byte(c, OP_POP, NULL);
+    break;
+    case STATEMENT_PRINT_EXPR:
+      compile_expression(c, stmt->expr);
+      emit_byte(c, OP_PRINT, NULL);
+    break;
+    case STATEMENT_VAR_DECL:
+      compile_expression(c, stmt->var_decl.expr);
+      emit_define(c, stmt->var_decl.slot, stmt->var_decl.identifier);
+    break;
+    case STATEMENT_FUN_DECL: {
+      StringView name = stmt->fun_decl.identifier;
+      uint16_t idx = compile_function(c, name, &stmt->fun_decl.proto);
+      emit_op_u16(c, OP_FUNCTION, idx, NULL);
+      emit_define(c, stmt->fun_decl.slot, name);
+    }
+    break;
+    case STATEMENT_CLASS_DECL:
+      compile_statement_class_decl(c, stmt);
+    break;
+    case STATEMENT_BLOCK:
+      emit_byte(c, OP_SCOPE_PUSH, NULL);
+      chunk_write_u16(c->chunk, stmt->scope.size, NULL);
+      emit_byte(c, stmt->scope.captured, NULL);
+      c->scope_depth += 1;
+      for (size_t i = 0; i < stmt->block.count; ++i) {
+        compile_statement(c, stmt->block.xs + i);
+      }
+      c->scope_depth -= 1;
+      emit_byte(c, OP_SCOPE_POP, NULL);
+    break;
+    case STATEMENT_CONDITIONAL:
+      compile_statement_conditional(c, stmt);
+    break;
+    case STATEMENT_WHILE:
+      compile_statement_while(c, stmt);
+    break;
+    case STATEMENT_RETURN:
+      if (!c->in_function) {
+        Value msg = value_new_stringview(sv_new("Return statement must be used inside a function body"));
+        emit_op_u16(c, OP_RUNTIME_ERROR, make_constant(c, msg, stmt->ret), stmt->ret);
+        break;
+      }
+
+      if (c->scope_depth > UINT8_MAX) {
+        static_error(find_token(stmt->ret), "Return statement is nested in too many blocks");
+        c->had_error = true;
+      }
+
+      compile_expression(c, stmt->ret);
+      emit_byte(c, OP_RETURN, stmt->ret);
+      emit_byte(c, (uint8_t)c->scope_depth, stmt->ret);
+    break;
+  }
+}
+
+bool compile(Statements stmts, Program* program) {
+  program_new(program);
+
+  struct Compiler c = {
+    .program = program,
+    .chunk = &program->script,
+    .in_function = false,
+    .scope_depth = 0,
+    .had_error = false,
+  };
+
+  for (size_t i = 0; i < stmts.count; ++i) {
+    compile_statement(&c, stmts.xs + i);
+  }
+  emit_byte(&c, OP_HALT, NULL);
+
+  program_link(program);
+  return !c.had_error;
+}
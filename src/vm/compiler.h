@@ -0,0 +1,10 @@
+#ifndef _COMPILER_H
+#define _COMPILER_H
+
+#include "chunk.h"
+#include "../types/statements.h"
+
+// Compiles parsed statements into bytecode, program must be freed with program_free
+bool compile(Statements stmts, Program* program);
+
+#endif
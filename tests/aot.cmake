@@ -0,0 +1,28 @@
+# Compiles SCRIPT with the 'compile' command and checks the program prints the same as 'interpret'
+#   cmake -DINTERPRETER=... -DSCRIPT=... -DCC=... -DCFLAGS=... -DSOURCE_DIR=... -DRUNTIME_DIR=... -DWORK_DIR=... -P aot.cmake
+get_filename_component(name ${SCRIPT} NAME_WE)
+set(program ${WORK_DIR}/${name})
+# Same flags as the runtime library it links
+separate_arguments(cflags UNIX_COMMAND "${CFLAGS}")
+
+execute_process(COMMAND ${INTERPRETER} interpret ${SCRIPT} OUTPUT_VARIABLE expected ERROR_VARIABLE expected)
+execute_process(COMMAND ${INTERPRETER} compile ${SCRIPT} OUTPUT_FILE ${program}.c RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "Can't compile ${SCRIPT}")
+endif()
+
+# Both levels, the C compiler may reorder the arithmetic it inlines when optimizing
+foreach(level -O0 -O2)
+  execute_process(
+    COMMAND ${CC} ${cflags} ${level} ${program}.c -I${SOURCE_DIR}/src -L${RUNTIME_DIR} -lcox_runtime -lm -o ${program}
+    RESULT_VARIABLE result
+  )
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "Can't build ${program}.c at ${level}")
+  endif()
+
+  execute_process(COMMAND ${program} OUTPUT_VARIABLE output ERROR_VARIABLE output)
+  if(NOT output STREQUAL expected)
+    message(FATAL_ERROR "${SCRIPT} at ${level}, interpret printed:\n${expected}the compiled program printed:\n${output}")
+  endif()
+endforeach()
@@ -0,0 +1,12 @@
+# Runs the interpreter on SCRIPT and compares what it prints with EXPECTED
+#   cmake -DINTERPRETER=... -DSCRIPT=... -DEXPECTED=... "-DARGS=interpret;-O0" -P check.cmake
+execute_process(
+  COMMAND ${INTERPRETER} ${ARGS}
+  OUTPUT_VARIABLE output
+  ERROR_VARIABLE output
+  RESULT_VARIABLE result
+)
+file(READ ${EXPECTED} expected)
+if(NOT result EQUAL 0 OR NOT output STREQUAL expected)
+  message(FATAL_ERROR "${SCRIPT} (exit ${result}), expected:\n${expected}got:\n${output}")
+endif()